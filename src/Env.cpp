@@ -10,9 +10,14 @@
 #include "Env.hpp"
 #include "value.hpp"
 #include "parse.hpp"
+#include "stats.hpp"
 
 PTR(Env) Env::emptyenv = NEW(EmptyEnv)();
 
+EmptyEnv::EmptyEnv() {
+    COUNT_ALLOC(EmptyEnv);
+}
+
 PTR(Val) EmptyEnv::lookup(std::string find_name) {
     throw std::runtime_error("free variable: " + find_name);
 }
@@ -27,9 +32,31 @@ ExtendedEnv::ExtendedEnv(std::string name, PTR(Val) val, PTR(Env) env) {
     this->rest = env;
     this->name = name;
     this->val = val;
+    this->hash = 0;
+    COUNT_ALLOC(ExtendedEnv);
+}
+
+// Like `lookup` through an `ExtendedEnv` holding `name` and `val`,
+// but also noting for --stats how far down `find_name` was found
+static PTR(Val) counted_lookup(const std::string *name, PTR(Val) val, PTR(Env) rest,
+                               const std::string &find_name) {
+    long depth = 1;
+    while (find_name != *name) {
+        PTR(ExtendedEnv) ee = CAST(ExtendedEnv)(rest);
+        if (ee == NULL)
+            return rest->lookup(find_name);
+        depth++;
+        name = &ee->name;
+        val = ee->val;
+        rest = ee->rest;
+    }
+    Stats::note_lookup_depth(depth);
+    return val;
 }
 
 PTR(Val) ExtendedEnv::lookup(std::string find_name) {
+    if (Stats::enabled)
+        return counted_lookup(&name, val, rest, find_name);
     if (find_name == name)
         return val;
     else
@@ -5,6 +5,7 @@
 
 #include <string>
 #include "pointer.hpp"
+#include "arena.hpp"
 #include "value.hpp"
 
 
@@ -12,6 +13,7 @@ class Val;
 
 class Env {
 public:
+    ARENA_ALLOCATED
     
     static PTR(Env) emptyenv;
     
@@ -22,6 +24,7 @@ public:
 
 class EmptyEnv : public Env {
 public:
+    EmptyEnv();
     PTR(Val) lookup(std::string find_name);
     bool equals(PTR(Env) env);
 };
@@ -32,6 +35,9 @@ public:
     PTR(Val) val;
     PTR(Env) rest;
     
+    /* Filled in by `CallMemo` when it first needs it; 0 until then */
+    size_t hash;
+    
     ExtendedEnv(std::string name, PTR(Val) val, PTR(Env) env);
     PTR(Val) lookup(std::string find_name);
     bool equals(PTR(Env) env);
@@ -0,0 +1,114 @@
+//
+//  arena.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <cstdint>
+#include <new>
+#include "arena.hpp"
+#include "catch.hpp"
+
+bool Arena::active = false;
+std::vector<std::pair<char*, size_t>> Arena::blocks;
+char *Arena::next = nullptr;
+char *Arena::end = nullptr;
+size_t Arena::used_before = 0;
+
+// Where the block that `next` points into starts
+static char *current = nullptr;
+
+void Arena::start() {
+    if (blocks.empty())
+        blocks.push_back(std::make_pair(new char[BLOCK_SIZE], BLOCK_SIZE));
+    current = next = blocks[0].first;
+    end = current + BLOCK_SIZE;
+    used_before = 0;
+    active = true;
+}
+
+void Arena::reset() {
+    // A program that needed many blocks does not keep them all
+    for (size_t i = 1; i < blocks.size(); i++)
+        delete[] blocks[i].first;
+    blocks.resize(blocks.empty() ? 0 : 1);
+    current = next = end = nullptr;
+    used_before = 0;
+    active = false;
+}
+
+size_t Arena::used() {
+    return used_before + (size_t)(next - current);
+}
+
+void *Arena::allocate_slow(size_t size) {
+    if (size > BLOCK_SIZE / 4) {
+        // Too big to share a block; the current one stays in use
+        char *big = new char[size];
+        blocks.push_back(std::make_pair(big, size));
+        used_before += size;
+        return big;
+    }
+    used_before += (size_t)(next - current);
+    blocks.push_back(std::make_pair(new char[BLOCK_SIZE], BLOCK_SIZE));
+    current = next = blocks.back().first;
+    end = next + BLOCK_SIZE;
+    void *p = next;
+    next += size;
+    return p;
+}
+
+bool Arena::owns(void *p) {
+    for (auto &block : blocks) {
+        if ((uintptr_t)p >= (uintptr_t)block.first && (uintptr_t)p < (uintptr_t)block.first + block.second)
+            return true;
+    }
+    return false;
+}
+
+void Arena::release(void *p) {
+    // Arena memory only goes back all at once
+    if (!owns(p))
+        ::operator delete(p);
+}
+
+/* for tests */
+class Counted {
+public:
+    ARENA_ALLOCATED
+    long payload[3];
+};
+
+TEST_CASE( "arena" ) {
+    Counted *before = new Counted();
+    
+    Arena::start();
+    Counted *a = new Counted();
+    Counted *b = new Counted();
+    CHECK( (char*)b - (char*)a == 32 );
+    CHECK( ((uintptr_t)a % alignof(std::max_align_t)) == 0 );
+    CHECK( Arena::used() == 64 );
+    // Filling more than a block, and one big allocation, both work
+    for (int i = 0; i < 100000; i++)
+        new Counted();
+    CHECK( Arena::used() == 64 + 100000 * 32 );
+    void *big = Arena::allocate(1 << 20);
+    CHECK( big != nullptr );
+    CHECK( Arena::used() == 64 + 100000 * 32 + (1 << 20) );
+    delete b;
+    Arena::reset();
+    
+    // The next program starts over in the same block
+    Arena::start();
+    CHECK( new Counted() == a );
+    Arena::reset();
+    
+    // Outside of a program, objects come from the heap as usual
+    CHECK( !Arena::active );
+    Counted *after = new Counted();
+    CHECK( after != a );
+    delete after;
+    delete before;
+}
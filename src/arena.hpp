@@ -0,0 +1,69 @@
+//
+//  arena.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <stdio.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/* Memory for the nodes, values, environments and continuations made
+ while running one program, which `reset` gives back all at once;
+ with raw pointers (see pointer.hpp) nothing is freed otherwise. It
+ is for a process that runs one program after another, such as a
+ `--serve` worker, and only while `active`; it is not thread-safe,
+ so it must not be active under `--parallel`. Strings, vectors and
+ big numbers inside objects still come from the heap, so a long name
+ (too long to be stored in place) is lost at `reset`; a `--serve`
+ worker is replaced from time to time to get that back. */
+class Arena {
+public:
+    static bool active;
+
+    // Starts taking allocations of `ARENA_ALLOCATED` classes
+    static void start();
+    // Forgets everything allocated since `start`, keeping one block
+    // for next time, and stops
+    static void reset();
+    // Bytes handed out since `start`
+    static size_t used();
+
+    static void *allocate(size_t size);
+    static void release(void *p);
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+    // Each block and its size
+    static std::vector<std::pair<char*, size_t>> blocks;
+    static char *next;
+    static char *end;
+    static size_t used_before;
+
+    static bool owns(void *p);
+    static void *allocate_slow(size_t size);
+};
+
+/* In a class: allocate it (and its subclasses) from the `Arena`. */
+#define ARENA_ALLOCATED \
+    static void *operator new(size_t size) { return Arena::allocate(size); } \
+    static void operator delete(void *p) { Arena::release(p); }
+
+inline void *Arena::allocate(size_t size) {
+    if (!active)
+        return ::operator new(size);
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if ((size_t)(end - next) < size)
+        return allocate_slow(size);
+    void *p = next;
+    next += size;
+    return p;
+}
+
+#endif /* arena_hpp */
@@ -0,0 +1,214 @@
+//
+//  bignum.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include "bignum.hpp"
+#include "catch.hpp"
+
+BigNum::BigNum() {
+    negative = false;
+}
+
+BigNum::BigNum(long long n) {
+    negative = (n < 0);
+    // Negating in unsigned arithmetic is defined even for LLONG_MIN
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)n : (unsigned long long)n;
+    while (magnitude != 0) {
+        limbs.push_back((uint32_t)magnitude);
+        magnitude >>= 32;
+    }
+}
+
+void BigNum::trim() {
+    while (!limbs.empty() && limbs.back() == 0)
+        limbs.pop_back();
+    if (limbs.empty())
+        negative = false;
+}
+
+BigNum BigNum::from_string(const std::string &digits) {
+    size_t start = (!digits.empty() && digits[0] == '-') ? 1 : 0;
+    if (start == digits.length())
+        throw std::runtime_error("expected a number, but found " + digits);
+    
+    BigNum n;
+    for (size_t i = start; i < digits.length(); i++) {
+        if (!isdigit((unsigned char)digits[i]))
+            throw std::runtime_error("expected a number, but found " + digits);
+        // n = n * 10 + digit, one limb at a time
+        uint64_t carry = (uint64_t)(digits[i] - '0');
+        for (uint32_t &limb : n.limbs) {
+            uint64_t d = (uint64_t)limb * 10 + carry;
+            limb = (uint32_t)d;
+            carry = d >> 32;
+        }
+        if (carry != 0)
+            n.limbs.push_back((uint32_t)carry);
+    }
+    n.negative = (start == 1);
+    n.trim();
+    return n;
+}
+
+bool BigNum::fits() const {
+    if (limbs.size() > 2)
+        return false;
+    unsigned long long magnitude = 0;
+    for (size_t i = limbs.size(); i-- > 0; )
+        magnitude = (magnitude << 32) | limbs[i];
+    return magnitude <= (unsigned long long)LLONG_MAX
+        || (negative && magnitude == (unsigned long long)LLONG_MAX + 1);
+}
+
+long long BigNum::to_long() const {
+    unsigned long long magnitude = 0;
+    for (size_t i = limbs.size(); i-- > 0; )
+        magnitude = (magnitude << 32) | limbs[i];
+    return negative ? (long long)(0ULL - magnitude) : (long long)magnitude;
+}
+
+int BigNum::compare_magnitude(const BigNum &other) const {
+    if (limbs.size() != other.limbs.size())
+        return limbs.size() < other.limbs.size() ? -1 : 1;
+    for (size_t i = limbs.size(); i-- > 0; ) {
+        if (limbs[i] != other.limbs[i])
+            return limbs[i] < other.limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+BigNum BigNum::add(const BigNum &other) const {
+    BigNum sum;
+    if (negative == other.negative) {
+        sum.negative = negative;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < std::max(limbs.size(), other.limbs.size()); i++) {
+            uint64_t d = carry;
+            if (i < limbs.size())
+                d += limbs[i];
+            if (i < other.limbs.size())
+                d += other.limbs[i];
+            sum.limbs.push_back((uint32_t)d);
+            carry = d >> 32;
+        }
+        if (carry != 0)
+            sum.limbs.push_back((uint32_t)carry);
+    } else {
+        // Subtract the smaller magnitude from the larger, which
+        // gives the sign
+        const BigNum &larger = (compare_magnitude(other) >= 0) ? *this : other;
+        const BigNum &smaller = (&larger == this) ? other : *this;
+        sum.negative = larger.negative;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < larger.limbs.size(); i++) {
+            int64_t d = (int64_t)larger.limbs[i] - borrow;
+            if (i < smaller.limbs.size())
+                d -= smaller.limbs[i];
+            borrow = (d < 0) ? 1 : 0;
+            sum.limbs.push_back((uint32_t)(d + (borrow << 32)));
+        }
+    }
+    sum.trim();
+    return sum;
+}
+
+BigNum BigNum::mult(const BigNum &other) const {
+    BigNum product;
+    product.limbs.assign(limbs.size() + other.limbs.size(), 0);
+    for (size_t i = 0; i < limbs.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < other.limbs.size(); j++) {
+            uint64_t d = (uint64_t)limbs[i] * other.limbs[j] + product.limbs[i + j] + carry;
+            product.limbs[i + j] = (uint32_t)d;
+            carry = d >> 32;
+        }
+        product.limbs[i + other.limbs.size()] = (uint32_t)carry;
+    }
+    product.negative = (negative != other.negative);
+    product.trim();
+    return product;
+}
+
+bool BigNum::equals(const BigNum &other) const {
+    return negative == other.negative && limbs == other.limbs;
+}
+
+std::string BigNum::to_string() const {
+    if (limbs.empty())
+        return "0";
+    // Divide by 10^9 repeatedly, each remainder giving nine digits
+    std::vector<uint32_t> rest = limbs;
+    std::string digits;
+    while (!rest.empty()) {
+        uint64_t remainder = 0;
+        for (size_t i = rest.size(); i-- > 0; ) {
+            uint64_t d = (remainder << 32) | rest[i];
+            rest[i] = (uint32_t)(d / 1000000000);
+            remainder = d % 1000000000;
+        }
+        while (!rest.empty() && rest.back() == 0)
+            rest.pop_back();
+        for (int k = 0; k < 9 && (!rest.empty() || remainder != 0); k++) {
+            digits.push_back((char)('0' + remainder % 10));
+            remainder /= 10;
+        }
+    }
+    if (negative)
+        digits.push_back('-');
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+size_t BigNum::hash() const {
+    size_t h = negative ? 1 : 0;
+    for (uint32_t limb : limbs)
+        h = h * 1000003 ^ limb;
+    return h;
+}
+
+TEST_CASE( "bignum" ) {
+    CHECK( BigNum(0).to_string() == "0" );
+    CHECK( BigNum(-7).to_string() == "-7" );
+    CHECK( BigNum(LLONG_MIN).to_string() == "-9223372036854775808" );
+    CHECK( BigNum(LLONG_MIN).fits() );
+    CHECK( BigNum(LLONG_MIN).to_long() == LLONG_MIN );
+    CHECK( BigNum(1000000000).to_string() == "1000000000" );
+    CHECK( BigNum(4000000000LL).to_string() == "4000000000" );
+    
+    BigNum big = BigNum::from_string("123456789012345678901234567890");
+    CHECK( big.to_string() == "123456789012345678901234567890" );
+    CHECK( !big.fits() );
+    CHECK( BigNum::from_string("-0").to_string() == "0" );
+    CHECK( BigNum::from_string("-9223372036854775809").to_string() == "-9223372036854775809" );
+    CHECK( !BigNum::from_string("-9223372036854775809").fits() );
+    CHECK( !BigNum::from_string("9223372036854775808").fits() );
+    CHECK_THROWS_WITH( BigNum::from_string("12a"), "expected a number, but found 12a" );
+    CHECK_THROWS_WITH( BigNum::from_string("-"), "expected a number, but found -" );
+    
+    // Past 64 bits and back
+    BigNum max(LLONG_MAX);
+    BigNum over = max.add(BigNum(1));
+    CHECK( over.to_string() == "9223372036854775808" );
+    CHECK( !over.fits() );
+    CHECK( over.add(BigNum(-1)).equals(max) );
+    CHECK( over.add(BigNum(-1)).fits() );
+    CHECK( BigNum(-5).add(BigNum(3)).to_string() == "-2" );
+    CHECK( BigNum(5).add(BigNum(-5)).equals(BigNum(0)) );
+    CHECK( BigNum(5).add(BigNum(-5)).negative == false );
+    CHECK( BigNum(-3).add(over).to_string() == "9223372036854775805" );
+    
+    CHECK( big.mult(big).to_string() == "15241578753238836750495351562536198787501905199875019052100" );
+    CHECK( big.mult(BigNum(-1)).to_string() == "-123456789012345678901234567890" );
+    CHECK( big.mult(BigNum(0)).equals(BigNum(0)) );
+    CHECK( big.mult(BigNum(-2)).add(big).add(big).equals(BigNum(0)) );
+    
+    CHECK( big.hash() == BigNum::from_string("123456789012345678901234567890").hash() );
+    CHECK( !big.equals(big.mult(BigNum(-1))) );
+}
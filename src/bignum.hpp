@@ -0,0 +1,53 @@
+//
+//  bignum.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef bignum_hpp
+#define bignum_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* An integer of any size, as a sign and a magnitude in base 2^32
+ digits ("limbs"), least significant first, with no zero limbs at
+ the top (so zero has none, and is never negative). A number is a
+ `long long` (see `NumVal` and `NumExpr`) until arithmetic on it
+ overflows; only then is a `BigNum` made, and a result that fits in
+ a `long long` again goes back to being one. */
+class BigNum {
+public:
+    bool negative;
+    std::vector<uint32_t> limbs;
+    
+    explicit BigNum(long long n);
+    
+    // Parses decimal digits, after an optional `-`; throws
+    // `runtime_error` for anything else
+    static BigNum from_string(const std::string &digits);
+    
+    // Whether the number fits in a `long long`, and then its value
+    bool fits() const;
+    long long to_long() const;
+    
+    BigNum add(const BigNum &other) const;
+    BigNum mult(const BigNum &other) const;
+    bool equals(const BigNum &other) const;
+    
+    std::string to_string() const;
+    size_t hash() const;
+    
+private:
+    BigNum();
+    
+    void trim();
+    // Compares magnitudes only: -1, 0 or 1
+    int compare_magnitude(const BigNum &other) const;
+};
+
+#endif /* bignum_hpp */
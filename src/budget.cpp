@@ -0,0 +1,89 @@
+//
+//  budget.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <climits>
+#include <sstream>
+#include "budget.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+
+bool Budget::active = false;
+std::atomic<long> Budget::fuel(LONG_MAX);
+std::chrono::steady_clock::time_point Budget::deadline;
+bool Budget::has_deadline = false;
+
+void Budget::start(long steps, long ms) {
+    fuel = (steps > 0) ? steps : LONG_MAX;
+    has_deadline = (ms > 0);
+    if (has_deadline)
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    active = true;
+}
+
+void Budget::stop() {
+    active = false;
+    fuel = LONG_MAX;
+    has_deadline = false;
+}
+
+void Budget::check(long left) {
+    if (left < 0)
+        throw OutOfBudget("out of fuel");
+    if (has_deadline && std::chrono::steady_clock::now() > deadline)
+        throw OutOfBudget("time limit exceeded");
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+/* for tests */
+static std::string budget_error(PTR(Expr) e, bool step, long steps, long ms) {
+    Budget::start(steps, ms);
+    try {
+        if (step)
+            (void)Step::interp_by_steps(e);
+        else
+            (void)e->to_value(Env::emptyenv);
+        Budget::stop();
+        return "";
+    } catch (OutOfBudget &exn) {
+        Budget::stop();
+        return exn.what();
+    }
+}
+
+TEST_CASE( "evaluation budget" ) {
+    PTR(Expr) forever = parse_str("_let loop = _fun(loop) _fun(n) loop(loop)(n + 1)"
+                                  "_in loop(loop)(0)");
+    PTR(Expr) countdown = parse_str("_let countdown = _fun(countdown)"
+                                    "  _fun(n)"
+                                    "    _if n == 0"
+                                    "    _then 0"
+                                    "    _else countdown(countdown)(n + -1)"
+                                    "_in countdown(countdown)(100)");
+    
+    CHECK( budget_error(forever, true, 100000, 0) == "out of fuel" );
+    CHECK( budget_error(forever, true, 0, 50) == "time limit exceeded" );
+    CHECK( budget_error(forever, false, 1000, 0) == "out of fuel" );
+    
+    CHECK( budget_error(countdown, true, 100000, 0) == "" );
+    CHECK( budget_error(countdown, false, 1000, 0) == "" );
+    CHECK( budget_error(countdown, false, 100, 0) == "out of fuel" );
+    
+    // Errors in the program are not budget errors
+    Budget::start(1000, 0);
+    CHECK_THROWS_WITH( parse_str("1 + _true")->to_value(Env::emptyenv), "input is not a number" );
+    Budget::stop();
+}
@@ -0,0 +1,55 @@
+//
+//  budget.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef budget_hpp
+#define budget_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+/* Raised when a program uses up its budget, so that callers can
+ tell it apart from an error in the program itself. */
+class OutOfBudget : public std::runtime_error {
+public:
+    OutOfBudget(const std::string &what) : std::runtime_error(what) { }
+};
+
+/* Limits how long a (possibly untrusted) program may run. The fuel
+ is a number of steps: one per `Step::interp_by_steps` iteration,
+ and one per function call in `to_value`, since only calls can keep
+ the direct evaluator going indefinitely. The deadline is checked
+ on every `CLOCK_INTERVAL`-th step, so reading the clock costs next
+ to nothing. When `active` is false, nothing is charged at all. */
+class Budget {
+public:
+    static bool active;
+    static std::atomic<long> fuel;
+    static std::chrono::steady_clock::time_point deadline;
+    static bool has_deadline;
+    
+    static const long CLOCK_INTERVAL = 1024;
+    
+    // Starts charging; `steps` or `ms` of 0 or less means no limit
+    static void start(long steps, long ms);
+    static void stop();
+    
+    // Uses one unit of fuel, throwing `OutOfBudget` when there is
+    // none left or the deadline has passed
+    static inline void charge() {
+        long left = fuel.fetch_sub(1, std::memory_order_relaxed) - 1;
+        if (left <= 0 || (left % CLOCK_INTERVAL) == 0)
+            check(left);
+    }
+    
+private:
+    static void check(long left);
+};
+
+#endif /* budget_hpp */
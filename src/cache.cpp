@@ -0,0 +1,120 @@
+//
+//  cache.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.hpp"
+#include "catch.hpp"
+#include "serialize.hpp"
+#include "expr.hpp"
+#include "parse.hpp"
+
+// 64-bit FNV-1a
+static unsigned long long hash_text(const std::string &text) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+CompileCache::CompileCache(std::string dir) {
+    this->dir = dir;
+    this->hits = 0;
+    this->misses = 0;
+}
+
+std::string CompileCache::entry_path(const std::string &source, bool optimized) {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx", hash_text(source));
+    return (dir + "/" + name
+            + "-" + INTERPRETER_VERSION
+            + "-" + std::to_string(IMAGE_VERSION)
+            + (optimized ? "-opt" : "") + ".msdc");
+}
+
+PTR(Expr) CompileCache::lookup(const std::string &source, bool optimized) {
+    std::ifstream in(entry_path(source, optimized), std::ios::binary);
+    if (in) {
+        std::string entry((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        if (entry.length() > source.length()
+            && entry.compare(0, source.length(), source) == 0) {
+            try {
+                PTR(Expr) e = read_image(entry.substr(source.length()));
+                hits++;
+                return e;
+            } catch (std::runtime_error &) {
+                // treat a damaged entry as a miss; `store` replaces it
+            }
+        }
+    }
+    misses++;
+    return nullptr;
+}
+
+void CompileCache::store(const std::string &source, bool optimized, PTR(Expr) e) {
+    mkdir(dir.c_str(), 0777);
+    
+    std::string path = entry_path(source, optimized);
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return;
+        out.write(source.data(), source.length());
+        write_image(e, out, optimized);
+        if (!out) {
+            out.close();
+            unlink(tmp_path.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        unlink(tmp_path.c_str());
+}
+
+TEST_CASE( "compile cache" ) {
+    char dir_template[] = "/tmp/msdcacheXXXXXX";
+    REQUIRE( mkdtemp(dir_template) != nullptr );
+    CompileCache cache(std::string(dir_template) + "/entries");
+    
+    std::string source = "_let x = 2 _in x * 21";
+    std::istringstream in(source);
+    PTR(Expr) e = parse(in);
+    
+    CHECK( cache.lookup(source, false) == nullptr );
+    cache.store(source, false, e);
+    CHECK( cache.lookup(source, false)->equals(e) );
+    
+    // Optimized trees are kept apart from parsed ones
+    CHECK( cache.lookup(source, true) == nullptr );
+    cache.store(source, true, e->optimize());
+    CHECK( cache.lookup(source, true)->equals(NEW(NumExpr)(42)) );
+    
+    CHECK( cache.lookup(source + " ", false) == nullptr );
+    CHECK( cache.hits == 2 );
+    CHECK( cache.misses == 3 );
+    
+    // A damaged entry is a miss
+    {
+        std::ofstream damaged(cache.entry_path(source, false), std::ios::binary | std::ios::trunc);
+        damaged << source << "garbage";
+    }
+    CHECK( cache.lookup(source, false) == nullptr );
+    
+    unlink(cache.entry_path(source, false).c_str());
+    unlink(cache.entry_path(source, true).c_str());
+    rmdir(cache.dir.c_str());
+    rmdir(dir_template);
+}
@@ -0,0 +1,46 @@
+//
+//  cache.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef cache_hpp
+#define cache_hpp
+
+#include <stdio.h>
+#include <string>
+#include "pointer.hpp"
+
+class Expr;
+
+/* Bump whenever parsing or `optimize` can produce a different
+ tree for the same text, so stale cache entries are ignored. */
+static const char * const INTERPRETER_VERSION = "2026.10.5";
+
+/* An on-disk cache of compiled images (see serialize.hpp), keyed
+ by a hash of the script text. Each entry is one file named after
+ the hash, the interpreter and image versions, and whether the tree
+ was optimized. The file holds the script text followed by the
+ image, so a hash collision is detected instead of trusted. */
+class CompileCache {
+public:
+    std::string dir;
+    int hits;
+    int misses;
+    
+    CompileCache(std::string dir);
+    
+    // Returns the cached tree for `source`, or `nullptr` on a miss
+    PTR(Expr) lookup(const std::string &source, bool optimized);
+    
+    // Records `e` as the tree for `source`. The entry is written to
+    // a temporary file and renamed, so readers never see a partial
+    // entry. Failing to write is not an error; the cache just misses.
+    void store(const std::string &source, bool optimized, PTR(Expr) e);
+    
+    std::string entry_path(const std::string &source, bool optimized);
+};
+
+#endif /* cache_hpp */
@@ -0,0 +1,130 @@
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "client.hpp"
+
+static int needs_retry(ssize_t rtn);
+
+// Connect to the server listening at `socket_path`
+ServerConnection::ServerConnection(const char *socket_path) {
+  signal(SIGPIPE, SIG_IGN);
+  
+  struct sockaddr_un address;
+  if (strlen(socket_path) >= sizeof(address.sun_path))
+    throw std::runtime_error("socket path too long");
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+  
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    throw std::runtime_error("socket failed");
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    throw std::runtime_error(std::string("cannot connect to ") + socket_path);
+  }
+}
+
+ServerConnection::~ServerConnection() {
+  close(fd);
+}
+
+// Send one request and wait for its response
+ExecResult ServerConnection::run(const std::string &flags, const std::string &input) {
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  write_frame(fd, flags + "\n" + input);
+  
+  std::string response;
+  if (!read_frame(fd, response) || response.empty())
+    throw std::runtime_error("server closed the connection");
+  
+  ExecResult r;
+  r.exit_code = (unsigned char)response[0];
+  if (r.exit_code == 0)
+    r.out = response.substr(1);
+  else
+    r.err = response.substr(1);
+  r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  return r;
+}
+
+ExecResult serve_program(const char *socket_path, const std::string &flags, std::string input) {
+  ServerConnection connection(socket_path);
+  return connection.run(flags, input);
+}
+
+std::string frame(const std::string &payload) {
+  uint32_t len = (uint32_t)payload.length();
+  std::string framed(4, '\0');
+  framed[0] = (char)(len >> 24);
+  framed[1] = (char)(len >> 16);
+  framed[2] = (char)(len >> 8);
+  framed[3] = (char)len;
+  return framed + payload;
+}
+
+bool take_frame(std::string &buffer, std::string &payload) {
+  if (buffer.length() < 4)
+    return false;
+  uint32_t len = (((uint32_t)(unsigned char)buffer[0] << 24)
+                  | ((uint32_t)(unsigned char)buffer[1] << 16)
+                  | ((uint32_t)(unsigned char)buffer[2] << 8)
+                  | (uint32_t)(unsigned char)buffer[3]);
+  if (buffer.length() - 4 < len)
+    return false;
+  payload = buffer.substr(4, len);
+  buffer.erase(0, 4 + (size_t)len);
+  return true;
+}
+
+bool read_frame(int fd, std::string &payload) {
+  std::string buffer;
+  char chunk[65536];
+  // Read no further than the frame, so that nothing of the next
+  // one is lost
+  size_t want = 4;
+  while (buffer.length() < want) {
+    ssize_t len;
+    do {
+      len = read(fd, chunk, std::min(sizeof(chunk), want - buffer.length()));
+    } while (needs_retry(len));
+    if (len <= 0)
+      return false;
+    buffer.append(chunk, len);
+    if (buffer.length() == 4)
+      want = 4 + (((size_t)(unsigned char)buffer[0] << 24)
+                  | ((size_t)(unsigned char)buffer[1] << 16)
+                  | ((size_t)(unsigned char)buffer[2] << 8)
+                  | (size_t)(unsigned char)buffer[3]);
+  }
+  return take_frame(buffer, payload);
+}
+
+void write_frame(int fd, const std::string &payload) {
+  std::string framed = frame(payload);
+  size_t offset = 0;
+  while (offset < framed.length()) {
+    ssize_t len;
+    do {
+      len = write(fd, framed.data() + offset, framed.length() - offset);
+    } while (needs_retry(len));
+    if (len < 0)
+      throw std::runtime_error("write to server connection failed");
+    offset += len;
+  }
+}
+
+// Check whether a system call result means "retry"
+static int needs_retry(ssize_t rtn) {
+  return (rtn == -1) && (errno == EINTR);
+}
@@ -0,0 +1,40 @@
+#ifndef client_hpp
+#define client_hpp
+
+#include <string>
+#include "exec.hpp"
+
+// The protocol of `msdscript --serve`: every request and response is
+// a 4-byte big-endian length followed by that many bytes. A request
+// is a line of flags (`--opt`, `--step` or `--types`, separated by
+// spaces, or none) followed by the program. A response is a status
+// byte, which is what `msdscript`'s exit status would have been,
+// followed by what it would have printed to stdout (for status 0)
+// or stderr (otherwise).
+
+// A connection to a server, for running one program after another
+// without starting a process for each
+class ServerConnection {
+public:
+  ServerConnection(const char *socket_path);
+  ~ServerConnection();
+  // Like `exec_program` with `msdscript` and the given flags
+  ExecResult run(const std::string &flags, const std::string &input);
+private:
+  int fd;
+};
+
+// Runs one program on the server at `socket_path`
+extern ExecResult serve_program(const char *socket_path, const std::string &flags, std::string input);
+
+// For both ends of a connection: `frame` adds the length to a
+// payload; `take_frame` removes a complete frame from the front of
+// `buffer` into `payload`, if there is one; `read_frame` blocks
+// until a frame arrives, returning false at EOF; `write_frame` blocks
+// until the frame is written
+extern std::string frame(const std::string &payload);
+extern bool take_frame(std::string &buffer, std::string &payload);
+extern bool read_frame(int fd, std::string &payload);
+extern void write_frame(int fd, const std::string &payload);
+
+#endif /* client_hpp */
@@ -12,6 +12,9 @@
 #include "Env.hpp"
 #include "expr.hpp"
 #include "parse.hpp"
+#include "memo.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
 
 
 PTR(Cont) Cont::done = NEW(DoneCont)();
@@ -27,6 +30,7 @@ RightThenAddCont::RightThenAddCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest)
     this->rhs = rhs;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(RightThenAddCont);
 }
 
 void RightThenAddCont::step_continue() {
@@ -35,17 +39,22 @@ void RightThenAddCont::step_continue() {
     Step::expr = rhs;
     Step::env = env;
     Step::cont = NEW(AddCont)(lhs_val, rest);
+    Step::cont->origin = origin;
 }
 
 AddCont::AddCont(PTR(Val) lhs_val, PTR(Cont) rest) {
     this->lhs_val = lhs_val;
     this->rest = rest;
+    COUNT_CONT(AddCont);
 }
 
 void AddCont::step_continue() {
     PTR(Val) rhs_val = Step::val;
     Step::mode = Step::continue_mode;
-    Step::val = lhs_val->add_to(rhs_val);
+    if (origin != nullptr && origin->well_typed)
+        Step::val = NumVal::add(STATIC_CAST(NumVal)(lhs_val), STATIC_CAST(NumVal)(rhs_val));
+    else
+        Step::val = lhs_val->add_to(rhs_val);
     Step::cont = rest;
 }
 
@@ -53,6 +62,7 @@ RightThenMultCont::RightThenMultCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest
     this->rhs = rhs;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(RightThenMultCont);
 }
 
 void RightThenMultCont::step_continue() {
@@ -61,17 +71,22 @@ void RightThenMultCont::step_continue() {
     Step::expr = rhs;
     Step::env = env;
     Step::cont = NEW(MultCont)(lhs_val, rest);
+    Step::cont->origin = origin;
 }
 
 MultCont::MultCont(PTR(Val) lhs_val, PTR(Cont) rest) {
     this->lhs_val = lhs_val;
     this->rest = rest;
+    COUNT_CONT(MultCont);
 }
 
 void MultCont::step_continue() {
     PTR(Val) rhs_val = Step::val;
     Step::mode = Step::continue_mode;
-    Step::val = lhs_val->mult_with(rhs_val);
+    if (origin != nullptr && origin->well_typed)
+        Step::val = NumVal::mult(STATIC_CAST(NumVal)(lhs_val), STATIC_CAST(NumVal)(rhs_val));
+    else
+        Step::val = lhs_val->mult_with(rhs_val);
     Step::cont = rest;
 }
 
@@ -79,6 +94,7 @@ RightThenCompCont::RightThenCompCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest
     this->rhs = rhs;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(RightThenCompCont);
 }
 
 void RightThenCompCont::step_continue() {
@@ -92,6 +108,7 @@ void RightThenCompCont::step_continue() {
 CompCont::CompCont(PTR(Val) lhs_val, PTR(Cont) rest) {
     this->lhs_val = lhs_val;
     this->rest = rest;
+    COUNT_CONT(CompCont);
 }
 
 void CompCont::step_continue() {
@@ -108,6 +125,7 @@ ArgThenCallCont::ArgThenCallCont(PTR(Expr) actual_arg, PTR(Env) env, PTR(Cont) r
     this->actual_arg = actual_arg;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(ArgThenCallCont);
 }
 
 void ArgThenCallCont::step_continue() {
@@ -116,15 +134,20 @@ void ArgThenCallCont::step_continue() {
     Step::expr = actual_arg;
     Step::env = env;
     Step::cont = NEW(CallCont)(to_be_called, rest);
+    Step::cont->origin = origin;
 }
 
 CallCont::CallCont(PTR(Val) to_be_called, PTR(Cont) rest) {
     this->to_be_called = to_be_called;
     this->rest = rest;
+    COUNT_CONT(CallCont);
 }
 
 void CallCont::step_continue() {
-    to_be_called->call_step(Step::val, rest);
+    if (origin != nullptr && origin->well_typed)
+        STATIC_CAST(FunVal)(to_be_called)->FunVal::call_step(Step::val, rest);
+    else
+        to_be_called->call_step(Step::val, rest);
 }
 
 IfBranchCont::IfBranchCont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) env, PTR(Cont) rest) {
@@ -132,10 +155,12 @@ IfBranchCont::IfBranchCont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) en
     this->else_part = else_part;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(IfBranchCont);
 }
 
 void IfBranchCont::step_continue() {
-    PTR(BoolVal) if_val = CAST(BoolVal)(Step::val);
+    PTR(BoolVal) if_val = ((origin != nullptr && origin->well_typed)
+                           ? STATIC_CAST(BoolVal)(Step::val) : CAST(BoolVal)(Step::val));
     
     if (if_val == NULL)
         throw std::runtime_error("if part doesn't evaluate to a bool val!");
@@ -153,12 +178,38 @@ LetBodyCont::LetBodyCont(std::string var, PTR(Expr) body, PTR(Env) env, PTR(Cont
     this->body = body;
     this->env = env;
     this->rest = rest;
+    COUNT_CONT(LetBodyCont);
 }
 
 void LetBodyCont::step_continue() {
     PTR(Val) rhs_val = Step::val;
     Step::mode = Step::interp_mode;
-    Step::env = NEW(ExtendedEnv)(var, rhs_val, Step::env);
+    Step::env = NEW(ExtendedEnv)(var, rhs_val, env);
     Step::expr = body;
     Step::cont = rest;
 }
+
+MemoCont::MemoCont(PTR(Expr) body, PTR(Env) env, PTR(Val) actual_arg_val, PTR(Cont) rest) {
+    this->body = body;
+    this->env = env;
+    this->actual_arg_val = actual_arg_val;
+    this->rest = rest;
+    COUNT_CONT(MemoCont);
+}
+
+void MemoCont::step_continue() {
+    CallMemo::store(body, env, actual_arg_val, Step::val);
+    Step::mode = Step::continue_mode;
+    Step::cont = rest;
+}
+
+ProfileLeaveCont::ProfileLeaveCont(PTR(Cont) rest) {
+    this->rest = rest;
+    COUNT_CONT(ProfileLeaveCont);
+}
+
+void ProfileLeaveCont::step_continue() {
+    Profiler::leave();
+    Step::mode = Step::continue_mode;
+    Step::cont = rest;
+}
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <iostream>
 #include "pointer.hpp"
+#include "arena.hpp"
 
 
 class Expr;
@@ -20,6 +21,8 @@ class Env;
 
 class Cont ENABLE_THIS(Cont) {
 public:
+    ARENA_ALLOCATED
+    
     /* To take one step in the computation starting
      with this continuation, reading from the registers
      in `Step` and updating them to indicate the next
@@ -32,6 +35,14 @@ public:
     virtual void step_continue() = 0;
     
     static PTR(Cont) done;
+    
+    /* How many continuations are under this one, only
+     filled in for --stats */
+    long depth = 0;
+    
+    /* The expression this continuation finishes, when it can
+     fail, so that `Step::interp_by_steps` knows whom to blame */
+    PTR(Expr) origin = nullptr;
 };
 
 class DoneCont : public Cont {
@@ -138,4 +149,25 @@ public:
     void step_continue();
 };
 
+/* Remembers the value a function call returns, see memo.hpp */
+class MemoCont : public Cont {
+public:
+    PTR(Expr) body;
+    PTR(Env) env;
+    PTR(Val) actual_arg_val;
+    PTR(Cont) rest;
+    
+    MemoCont(PTR(Expr) body, PTR(Env) env, PTR(Val) actual_arg_val, PTR(Cont) rest);
+    void step_continue();
+};
+
+/* Tells the profiler a function call has returned, see profile.hpp */
+class ProfileLeaveCont : public Cont {
+public:
+    PTR(Cont) rest;
+    
+    ProfileLeaveCont(PTR(Cont) rest);
+    void step_continue();
+};
+
 #endif /* cont_hpp */
@@ -0,0 +1,697 @@
+//
+//  emitc.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <climits>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "emitc.hpp"
+#include "catch.hpp"
+#include "exec.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "parse.hpp"
+#include "source.hpp"
+#include "gen.hpp"
+
+// What every unit starts with. The arithmetic, messages and order of
+// checks follow `NumVal`, `BoolVal`, `FunVal` and `BigNum`.
+static const char *RUNTIME = R"RUNTIME(/* Compiled from MSDScript by msdscript --emit-c */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { MSD_NUM, MSD_BOOL, MSD_FUN };
+
+/* A number too big for a long long: sign and base 2^32 limbs, least
+   significant first, with no zero limb at the top */
+typedef struct msd_big {
+    int negative;
+    size_t count;
+    uint32_t limbs[];
+} msd_big;
+
+typedef struct msd_val {
+    int tag;
+    /* A number that fits, or a boolean */
+    long long n;
+    /* A number's msd_big if it does not fit, or a function's closure */
+    void *p;
+} msd_val;
+
+typedef struct msd_closure {
+    int klass;
+    msd_val (*code)(struct msd_closure *self, msd_val arg);
+    size_t count;
+    msd_val env[];
+} msd_closure;
+
+static jmp_buf msd_escape;
+static int msd_status;
+static char *msd_error;
+
+static void msd_fail(const char *where, const char *message) {
+    msd_error = (char *)malloc(strlen(where) + strlen(message) + 1);
+    if (msd_error != NULL) {
+        strcpy(msd_error, where);
+        strcat(msd_error, message);
+    }
+    msd_status = 1;
+    longjmp(msd_escape, 1);
+}
+
+static void *msd_alloc(size_t size) {
+    void *p = malloc(size);
+    if (p == NULL) {
+        msd_error = NULL;
+        msd_status = 2;
+        longjmp(msd_escape, 1);
+    }
+    return p;
+}
+
+static msd_val msd_num(long long n) {
+    msd_val v = { MSD_NUM, n, NULL };
+    return v;
+}
+
+static msd_val msd_bool(int b) {
+    msd_val v = { MSD_BOOL, b, NULL };
+    return v;
+}
+
+static msd_val msd_fun(msd_closure *c) {
+    msd_val v = { MSD_FUN, 0, c };
+    return v;
+}
+
+static msd_closure *msd_closure_new(int klass, msd_val (*code)(msd_closure *, msd_val), size_t count) {
+    msd_closure *c = (msd_closure *)msd_alloc(sizeof(msd_closure) + count * sizeof(msd_val));
+    c->klass = klass;
+    c->code = code;
+    c->count = count;
+    return c;
+}
+
+static msd_val msd_free_variable(const char *where, const char *message) {
+    msd_fail(where, message);
+    return msd_num(0);
+}
+
+static msd_big *msd_big_new(size_t count) {
+    msd_big *b = (msd_big *)msd_alloc(sizeof(msd_big) + count * sizeof(uint32_t));
+    b->negative = 0;
+    b->count = count;
+    memset(b->limbs, 0, count * sizeof(uint32_t));
+    return b;
+}
+
+static msd_big *msd_big_of(msd_val v) {
+    unsigned long long magnitude;
+    msd_big *b;
+    if (v.p != NULL)
+        return (msd_big *)v.p;
+    magnitude = (v.n < 0) ? 0ULL - (unsigned long long)v.n : (unsigned long long)v.n;
+    b = msd_big_new(2);
+    b->negative = (v.n < 0);
+    b->limbs[0] = (uint32_t)magnitude;
+    b->limbs[1] = (uint32_t)(magnitude >> 32);
+    return b;
+}
+
+/* Trims `b` and turns it back into a long long if it fits */
+static msd_val msd_big_result(msd_big *b) {
+    unsigned long long magnitude = 0;
+    msd_val v = { MSD_NUM, 0, NULL };
+    while (b->count > 0 && b->limbs[b->count - 1] == 0)
+        b->count--;
+    if (b->count <= 2) {
+        if (b->count > 1)
+            magnitude = (unsigned long long)b->limbs[1] << 32;
+        if (b->count > 0)
+            magnitude |= b->limbs[0];
+        if (magnitude <= (unsigned long long)LLONG_MAX) {
+            v.n = b->negative ? -(long long)magnitude : (long long)magnitude;
+            return v;
+        }
+        if (b->negative && magnitude == (unsigned long long)LLONG_MAX + 1) {
+            v.n = LLONG_MIN;
+            return v;
+        }
+    }
+    v.p = b;
+    return v;
+}
+
+static int msd_big_compare_magnitude(const msd_big *a, const msd_big *b) {
+    size_t i;
+    size_t a_count = a->count, b_count = b->count;
+    while (a_count > 0 && a->limbs[a_count - 1] == 0)
+        a_count--;
+    while (b_count > 0 && b->limbs[b_count - 1] == 0)
+        b_count--;
+    if (a_count != b_count)
+        return a_count < b_count ? -1 : 1;
+    for (i = a_count; i-- > 0; ) {
+        if (a->limbs[i] != b->limbs[i])
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static msd_val msd_big_add(const msd_big *a, const msd_big *b) {
+    size_t i, count = (a->count > b->count ? a->count : b->count) + 1;
+    msd_big *sum = msd_big_new(count);
+    if (a->negative == b->negative) {
+        uint64_t carry = 0;
+        sum->negative = a->negative;
+        for (i = 0; i < count; i++) {
+            uint64_t d = carry;
+            if (i < a->count)
+                d += a->limbs[i];
+            if (i < b->count)
+                d += b->limbs[i];
+            sum->limbs[i] = (uint32_t)d;
+            carry = d >> 32;
+        }
+    } else {
+        const msd_big *larger = (msd_big_compare_magnitude(a, b) >= 0) ? a : b;
+        const msd_big *smaller = (larger == a) ? b : a;
+        int64_t borrow = 0;
+        sum->negative = larger->negative;
+        for (i = 0; i < larger->count; i++) {
+            int64_t d = (int64_t)larger->limbs[i] - borrow;
+            if (i < smaller->count)
+                d -= smaller->limbs[i];
+            borrow = (d < 0) ? 1 : 0;
+            sum->limbs[i] = (uint32_t)(d + (borrow << 32));
+        }
+    }
+    return msd_big_result(sum);
+}
+
+static msd_val msd_big_mult(const msd_big *a, const msd_big *b) {
+    size_t i, j;
+    msd_big *product = msd_big_new(a->count + b->count);
+    for (i = 0; i < a->count; i++) {
+        uint64_t carry = 0;
+        for (j = 0; j < b->count; j++) {
+            uint64_t d = (uint64_t)a->limbs[i] * b->limbs[j] + product->limbs[i + j] + carry;
+            product->limbs[i + j] = (uint32_t)d;
+            carry = d >> 32;
+        }
+        product->limbs[i + b->count] = (uint32_t)carry;
+    }
+    product->negative = (a->negative != b->negative);
+    return msd_big_result(product);
+}
+
+/* A literal too big for a long long */
+static msd_val msd_big_parse(const char *digits) {
+    int negative = (*digits == '-');
+    size_t i;
+    msd_big *b = msd_big_new(strlen(digits) / 9 + 1);
+    if (negative)
+        digits++;
+    b->count = 0;
+    for (; *digits != '\0'; digits++) {
+        uint64_t carry = (uint64_t)(*digits - '0');
+        for (i = 0; i < b->count; i++) {
+            uint64_t d = (uint64_t)b->limbs[i] * 10 + carry;
+            b->limbs[i] = (uint32_t)d;
+            carry = d >> 32;
+        }
+        if (carry != 0)
+            b->limbs[b->count++] = (uint32_t)carry;
+    }
+    b->negative = negative && b->count > 0;
+    return msd_big_result(b);
+}
+
+static char *msd_big_to_string(const msd_big *b) {
+    size_t i, rest_count = b->count, length = 0;
+    uint32_t *rest = (uint32_t *)msd_alloc((b->count + 1) * sizeof(uint32_t));
+    char *digits = (char *)msd_alloc(b->count * 10 + 3);
+    char *out;
+    memcpy(rest, b->limbs, b->count * sizeof(uint32_t));
+    while (rest_count > 0) {
+        uint64_t remainder = 0;
+        int k;
+        for (i = rest_count; i-- > 0; ) {
+            uint64_t d = (remainder << 32) | rest[i];
+            rest[i] = (uint32_t)(d / 1000000000);
+            remainder = d % 1000000000;
+        }
+        while (rest_count > 0 && rest[rest_count - 1] == 0)
+            rest_count--;
+        for (k = 0; k < 9 && (rest_count > 0 || remainder != 0); k++) {
+            digits[length++] = (char)('0' + remainder % 10);
+            remainder /= 10;
+        }
+    }
+    if (b->negative)
+        digits[length++] = '-';
+    out = (char *)msd_alloc(length + 1);
+    for (i = 0; i < length; i++)
+        out[i] = digits[length - 1 - i];
+    out[length] = '\0';
+    free(rest);
+    free(digits);
+    return out;
+}
+
+static msd_val msd_add(msd_val a, msd_val b, const char *where) {
+    long long sum;
+    if (a.tag != MSD_NUM)
+        msd_fail(where, a.tag == MSD_BOOL ? "cannot add booleans" : "cannot add functions");
+    if (b.tag != MSD_NUM)
+        msd_fail(where, "input is not a number");
+    if (a.p == NULL && b.p == NULL && !__builtin_add_overflow(a.n, b.n, &sum))
+        return msd_num(sum);
+    return msd_big_add(msd_big_of(a), msd_big_of(b));
+}
+
+static msd_val msd_mult(msd_val a, msd_val b, const char *where) {
+    long long product;
+    if (a.tag != MSD_NUM)
+        msd_fail(where, a.tag == MSD_BOOL ? "cannot multiply booleans" : "cannot multiply functions");
+    if (b.tag != MSD_NUM)
+        msd_fail(where, "input is not a number");
+    if (a.p == NULL && b.p == NULL && !__builtin_mul_overflow(a.n, b.n, &product))
+        return msd_num(product);
+    return msd_big_mult(msd_big_of(a), msd_big_of(b));
+}
+
+static int msd_equal(msd_val a, msd_val b) {
+    if (a.tag != b.tag)
+        return 0;
+    if (a.tag == MSD_BOOL)
+        return a.n == b.n;
+    if (a.tag == MSD_NUM) {
+        const msd_big *x = (const msd_big *)a.p, *y = (const msd_big *)b.p;
+        if (x == NULL || y == NULL)
+            return x == y && a.n == b.n;
+        return x->negative == y->negative && msd_big_compare_magnitude(x, y) == 0;
+    } else {
+        const msd_closure *f = (const msd_closure *)a.p, *g = (const msd_closure *)b.p;
+        size_t i;
+        if (f->klass != g->klass)
+            return 0;
+        for (i = 0; i < f->count; i++) {
+            if (!msd_equal(f->env[i], g->env[i]))
+                return 0;
+        }
+        return 1;
+    }
+}
+
+static int msd_test(msd_val v, const char *where) {
+    if (v.tag != MSD_BOOL)
+        msd_fail(where, "if part doesn't evaluate to a bool val!");
+    return (int)v.n;
+}
+
+static msd_val msd_call(msd_val f, msd_val arg, const char *where) {
+    msd_closure *c;
+    if (f.tag == MSD_NUM)
+        msd_fail(where, "Error");
+    if (f.tag == MSD_BOOL)
+        msd_fail(where, "error with function call");
+    c = (msd_closure *)f.p;
+    return c->code(c, arg);
+}
+
+static char *msd_to_string(msd_val v) {
+    char buffer[32];
+    char *out;
+    if (v.tag == MSD_NUM && v.p != NULL)
+        return msd_big_to_string((const msd_big *)v.p);
+    if (v.tag == MSD_NUM)
+        snprintf(buffer, sizeof(buffer), "%lld", v.n);
+    else if (v.tag == MSD_BOOL)
+        strcpy(buffer, v.n ? "_true" : "_false");
+    else
+        strcpy(buffer, "[FUNCTION]");
+    out = (char *)msd_alloc(strlen(buffer) + 1);
+    strcpy(out, buffer);
+    return out;
+}
+
+)RUNTIME";
+
+static const char *PROGRAM_END = R"END(
+int msd_program(char **result) {
+    if (setjmp(msd_escape)) {
+        *result = (msd_status == 2 || msd_error == NULL) ? (char *)"out of memory" : msd_error;
+        return msd_status;
+    }
+    *result = msd_to_string(msd_top());
+    return 0;
+}
+
+#ifndef MSD_NO_MAIN
+int main(void) {
+    char *result;
+    int status = msd_program(&result);
+    fprintf(status == 0 ? stdout : stderr, "%s\n", result);
+    return status;
+}
+#endif
+)END";
+
+// A C string literal for `s`
+static std::string c_string(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += std::string("\\") + c;
+        else if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+/* Compiles one program: `compile` appends the C statements that
+ compute an expression to `code` and returns a C expression, with no
+ effects, for its value. A scope lists each variable in scope, from
+ the outermost, with the C expression that holds its value. */
+class CProgram {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> scope_t;
+    
+    const std::string &text;
+    // Each `_fun`'s C function, in the order made
+    std::vector<std::string> functions;
+    // The index in `functions` for each distinct `_fun`: its text and
+    // the names in scope, which `FunVal::equals` compares
+    std::map<std::string, int> klasses;
+    long temps;
+    
+    CProgram(const std::string &text) : text(text) {
+        temps = 0;
+    }
+    
+    std::string temp() {
+        return "t" + std::to_string(temps++);
+    }
+    
+    std::string where(PTR(Expr) e) {
+        return c_string(SourceMap::where(e, text));
+    }
+    
+    static void line(std::string &code, int indent, const std::string &statement) {
+        code += std::string(indent * 4, ' ') + statement + "\n";
+    }
+    
+    std::string compile(PTR(Expr) e, scope_t &scope, std::string &code, int indent);
+    int function(PTR(FunExpr) f, scope_t &scope);
+};
+
+std::string CProgram::compile(PTR(Expr) e, scope_t &scope, std::string &code, int indent) {
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        if (n->big != nullptr)
+            return "msd_big_parse(" + c_string(n->big->to_string()) + ")";
+        if (n->num == LLONG_MIN)
+            return "msd_num(-9223372036854775807LL - 1)";
+        return "msd_num(" + std::to_string(n->num) + "LL)";
+    }
+    if (PTR(BoolExpr) b = CAST(BoolExpr)(e))
+        return b->rep ? "msd_bool(1)" : "msd_bool(0)";
+    if (PTR(VarExpr) v = CAST(VarExpr)(e)) {
+        for (size_t i = scope.size(); i-- > 0; ) {
+            if (scope[i].first == v->name)
+                return scope[i].second;
+        }
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_free_variable(" + where(e) + ", "
+             + c_string("free variable: " + v->name) + ");");
+        return t;
+    }
+    if (PTR(AddExpr) add = CAST(AddExpr)(e)) {
+        std::string lhs = compile(add->lhs, scope, code, indent);
+        std::string rhs = compile(add->rhs, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_add(" + lhs + ", " + rhs + ", " + where(e) + ");");
+        return t;
+    }
+    if (PTR(MultExpr) mult = CAST(MultExpr)(e)) {
+        std::string lhs = compile(mult->lhs, scope, code, indent);
+        std::string rhs = compile(mult->rhs, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_mult(" + lhs + ", " + rhs + ", " + where(e) + ");");
+        return t;
+    }
+    if (PTR(EqualExpr) equal = CAST(EqualExpr)(e)) {
+        std::string lhs = compile(equal->lhs, scope, code, indent);
+        std::string rhs = compile(equal->rhs, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_bool(msd_equal(" + lhs + ", " + rhs + "));");
+        return t;
+    }
+    if (PTR(LetExpr) let = CAST(LetExpr)(e)) {
+        std::string rhs = compile(let->rhs, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = " + rhs + ";");
+        scope.push_back(std::make_pair(let->name, t));
+        std::string body = compile(let->expr, scope, code, indent);
+        scope.pop_back();
+        return body;
+    }
+    if (PTR(IfExpr) branch = CAST(IfExpr)(e)) {
+        std::string test = compile(branch->if_part, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + ";");
+        line(code, indent, "if (msd_test(" + test + ", " + where(e) + ")) {");
+        std::string then_val = compile(branch->then_part, scope, code, indent + 1);
+        line(code, indent + 1, t + " = " + then_val + ";");
+        line(code, indent, "} else {");
+        std::string else_val = compile(branch->else_part, scope, code, indent + 1);
+        line(code, indent + 1, t + " = " + else_val + ";");
+        line(code, indent, "}");
+        return t;
+    }
+    if (PTR(FunExpr) fun = CAST(FunExpr)(e)) {
+        int k = function(fun, scope);
+        std::string c = temp();
+        line(code, indent, "msd_closure *" + c + " = msd_closure_new(" + std::to_string(k) + ", msd_fun_"
+             + std::to_string(k) + ", " + std::to_string(scope.size()) + ");");
+        for (size_t i = 0; i < scope.size(); i++)
+            line(code, indent, c + "->env[" + std::to_string(i) + "] = " + scope[i].second + ";");
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_fun(" + c + ");");
+        return t;
+    }
+    if (PTR(CallFunExpr) call = CAST(CallFunExpr)(e)) {
+        std::string f = compile(call->to_be_called, scope, code, indent);
+        std::string arg = compile(call->actual_arg, scope, code, indent);
+        std::string t = temp();
+        line(code, indent, "msd_val " + t + " = msd_call(" + f + ", " + arg + ", " + where(e) + ");");
+        return t;
+    }
+    throw std::runtime_error("cannot compile " + e->to_string());
+}
+
+// Makes (once) the C function for `f` made in `scope`; returns its
+// index, which is also its closures' `klass`
+int CProgram::function(PTR(FunExpr) f, scope_t &scope) {
+    std::string key = f->formal_arg + "\n" + f->body->to_string();
+    for (auto &binding : scope)
+        key += "\n" + binding.first;
+    auto found = klasses.find(key);
+    if (found != klasses.end())
+        return found->second;
+    
+    int k = (int)functions.size();
+    klasses[key] = k;
+    functions.push_back("");
+    
+    scope_t inner;
+    for (size_t i = 0; i < scope.size(); i++)
+        inner.push_back(std::make_pair(scope[i].first, "self->env[" + std::to_string(i) + "]"));
+    inner.push_back(std::make_pair(f->formal_arg, "arg"));
+    std::string body;
+    std::string result = compile(f->body, inner, body, 1);
+    std::string comment = f->label.empty() ? "" : "/* " + f->label + " */\n";
+    functions[k] = (comment
+                    + "static msd_val msd_fun_" + std::to_string(k) + "(msd_closure *self, msd_val arg) {\n"
+                    + body
+                    + "    (void)self;\n"
+                    + "    return " + result + ";\n"
+                    + "}\n");
+    return k;
+}
+
+void CEmitter::emit(PTR(Expr) e, const std::string &text, std::ostream &out) {
+    CProgram program(text);
+    CProgram::scope_t scope;
+    std::string body;
+    std::string result = program.compile(e, scope, body, 1);
+    
+    out << RUNTIME;
+    for (size_t k = 0; k < program.functions.size(); k++)
+        out << "static msd_val msd_fun_" << k << "(msd_closure *self, msd_val arg);\n";
+    out << "\n";
+    for (const std::string &f : program.functions)
+        out << f << "\n";
+    out << "static msd_val msd_top(void) {\n" << body << "    return " << result << ";\n}\n";
+    out << PROGRAM_END;
+}
+
+// `exec_program` runs a path, so a bare name is looked up in $PATH;
+// returns "" if it is not there
+static std::string find_program(const std::string &name) {
+    if (name.find('/') != std::string::npos)
+        return name;
+    const char *path = getenv("PATH");
+    std::istringstream dirs(path != nullptr ? path : "/usr/bin:/bin");
+    std::string dir;
+    while (std::getline(dirs, dir, ':')) {
+        std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return candidate;
+    }
+    return "";
+}
+
+// The C compiler to use: $CC, or cc
+static std::string c_compiler() {
+    const char *cc = getenv("CC");
+    return find_program(cc != nullptr && *cc != '\0' ? cc : "cc");
+}
+
+void CEmitter::build(const std::string &source, const std::string &output) {
+    std::string cc = c_compiler();
+    if (cc.empty())
+        throw std::runtime_error("no C compiler found (set CC)");
+    bool shared = ((output.length() > 3 && output.compare(output.length() - 3, 3, ".so") == 0)
+                   || (output.length() > 6 && output.compare(output.length() - 6, 6, ".dylib") == 0));
+    
+    std::vector<const char *> command = { cc.c_str(), "-O2", "-w" };
+    if (shared) {
+        command.push_back("-shared");
+        command.push_back("-fPIC");
+        command.push_back("-DMSD_NO_MAIN");
+    }
+    command.push_back("-o");
+    command.push_back(output.c_str());
+    command.push_back("-x");
+    command.push_back("c");
+    command.push_back("-");
+    command.push_back(nullptr);
+    
+    ExecResult r = exec_program(command.data(), source);
+    if (r.exit_code != 0)
+        throw std::runtime_error("C compiler failed (" + cc + "):\n" + r.err);
+}
+
+/* for tests */
+static std::string interpret(const std::string &text, int &status) {
+    SourceMap::clear();
+    SourceMap::recording = true;
+    std::istringstream in(text);
+    PTR(Expr) e = parse(in);
+    SourceMap::recording = false;
+    try {
+        status = 0;
+        return e->to_value(Env::emptyenv)->to_string();
+    } catch (std::runtime_error &exn) {
+        status = 1;
+        return SourceMap::describe(exn, text);
+    }
+}
+
+/* for tests */
+static std::string compiled_source(const std::string &text) {
+    SourceMap::clear();
+    SourceMap::recording = true;
+    std::istringstream in(text);
+    PTR(Expr) e = parse(in);
+    SourceMap::recording = false;
+    std::ostringstream out;
+    CEmitter::emit(e, text, out);
+    return out.str();
+}
+
+TEST_CASE( "emit-c" ) {
+    if (c_compiler().empty()) {
+        WARN( "no C compiler; skipping" );
+        return;
+    }
+    char dir[] = "/tmp/msdemitXXXXXX";
+    REQUIRE( mkdtemp(dir) != nullptr );
+    std::string exe = std::string(dir) + "/program";
+    
+    std::vector<std::string> programs = {
+        "1 + 2 * 3",
+        "_let x = 5 _in _let x = x + 1 _in x * x",
+        "_if 1 == 1 _then _true _else _false",
+        "_let fib = _fun(f) _fun(n) _if n == 0 _then 0 _else _if n == 1 _then 1 "
+        "_else f(f)(n + -1) + f(f)(n + -2) _in fib(fib)(20)",
+        "_let pow = _fun(f) _fun(n) _if n == 0 _then 1 _else 2 * f(f)(n + -1) _in pow(pow)(100)",
+        "9223372036854775807 + 1",
+        "-9223372036854775808 * -1 + -1",
+        "99999999999999999999 * -99999999999999999999 == -9999999999999999999800000000000000000001",
+        "_fun(x) x",
+        "_let add = _fun(x) _fun(y) x + y _in add(1) == add(1)",
+        "_let add = _fun(x) _fun(y) x + y _in add(1) == add(2)",
+        "(_fun(x) x) == (_fun(x) x)",
+        "(_let a = 1 _in _fun(x) x) == (_let a = 2 _in _fun(x) x)",
+        "(_let a = 1 _in _fun(x) x) == (_let b = 1 _in _fun(x) x)",
+        "1 == _true",
+        "1 + _true",
+        "_true + 1",
+        "(_fun(x) x) * 2",
+        "1 +\n  y",
+        "_let f = _fun(x) x + _true\n_in 1 + f(2)",
+        "_if 3 _then 1 _else 2",
+        "5(1)",
+        "_false(1)",
+        "_let f = _fun(x) x\n_in 1 + f(2)(3)"
+    };
+    for (unsigned seed = 1; seed <= 6; seed++)
+        programs.push_back(Gen::program(seed, GenOptions()));
+    
+    for (const std::string &text : programs) {
+        int status;
+        std::string expected = interpret(text, status);
+        CEmitter::build(compiled_source(text), exe);
+        const char *command[] = { exe.c_str(), nullptr };
+        ExecResult r = exec_program(command, "");
+        INFO( text );
+        CHECK( r.exit_code == status );
+        CHECK( (status == 0 ? r.out : r.err) == expected + "\n" );
+    }
+    
+    // A shared object is loaded and run in this process
+    std::string library = std::string(dir) + "/program.so";
+    CEmitter::build(compiled_source("_let sq = _fun(x) x * x _in sq(12)"), library);
+    void *handle = dlopen(library.c_str(), RTLD_NOW);
+    REQUIRE( handle != nullptr );
+    int (*run)(char **) = (int (*)(char **))dlsym(handle, "msd_program");
+    REQUIRE( run != nullptr );
+    char *result = nullptr;
+    CHECK( run(&result) == 0 );
+    CHECK( std::string(result) == "144" );
+    dlclose(handle);
+    
+    CHECK_THROWS( CEmitter::build("this is not C", exe) );
+    
+    unlink(exe.c_str());
+    unlink(library.c_str());
+    rmdir(dir);
+}
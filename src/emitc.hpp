@@ -0,0 +1,48 @@
+//
+//  emitc.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef emitc_hpp
+#define emitc_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include "pointer.hpp"
+
+class Expr;
+
+/* `--emit-c`: translates a program into one C translation unit that
+ computes the same result as `to_value`, for a script that is run
+ far more often than it changes. The unit carries a small runtime:
+ values are a tag plus a `long long` (or an arbitrary-precision
+ number once arithmetic overflows, as in `NumVal`), and every
+ `_fun` becomes a C function taking its closure, which holds the
+ values of all the variables in scope where it was made, so that
+ closures compare equal exactly when `FunVal::equals` says so. Each
+ error is raised with the message, and place in the script, that
+ the interpreter would give. There are no `--fuel` or `--timeout`
+ limits in compiled code.
+ 
+ The unit defines `int msd_program(char **result)`, which returns
+ what `msdscript`'s exit status would be and sets `result` to what
+ it would print (the value, or the error); unless `MSD_NO_MAIN` is
+ defined, it also has a `main` that prints it the same way. */
+class CEmitter {
+public:
+    // Writes the unit for `e`, whose errors are placed by the
+    // spans recorded for `text` (see source.hpp)
+    static void emit(PTR(Expr) e, const std::string &text, std::ostream &out);
+    
+    // Compiles a unit with the system C compiler (`$CC`, or `cc`)
+    // into `output`: a shared object (with no `main`) if the name
+    // ends in ".so" or ".dylib", else an executable. Throws
+    // `runtime_error` with the compiler's messages if it fails.
+    static void build(const std::string &source, const std::string &output);
+};
+
+#endif /* emitc_hpp */
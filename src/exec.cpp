@@ -1,11 +1,21 @@
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <vector>
 
 #include <unistd.h>
+#include <spawn.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <stdexcept>
 
 #include "exec.hpp"
 
@@ -16,23 +26,118 @@ static const int STDIN_FD  = 0;
 static const int STDOUT_FD = 1;
 static const int STDERR_FD = 2;
 
+// Inputs at least this big get a bigger stdin pipe where the system
+// allows it, so that they take fewer trips through `poll`
+static const size_t BIG_INPUT = 1 << 16;
+static const int BIG_PIPE = 1 << 20;
+
+extern char **environ;
+
 static void nonblocking(int fd, bool enabled);
+static void close_on_exec(int fd);
 static int needs_retry(int rtn);
-static void wait_until_one_ready(int wr_fd, bool wr_done,
-                                 int rd1_fd, bool rd1_done,
-                                 int rd2_fd, bool rd2_done);
-static void pump_to(std::string &str, int fd, bool &done);
+static void pump_to(const std::string &str, size_t &offset, int fd, bool &done);
 static void pump_from(int fd, std::string &str, bool &done);
-static void wait_child(pid_t pid, int &exit_code);
+static void wait_child(pid_t pid, ExecResult &r);
+
+// A running program and the parent's ends of its pipes
+class Child {
+public:
+  size_t job;
+  pid_t pid;
+  int in_fd, out_fd, err_fd;
+  bool in_done, out_done, err_done;
+  // The job's input, which stays put until every program is done,
+  // and how much of it has been written
+  const std::string *input;
+  size_t input_offset;
+  ExecLimits limits;
+  std::chrono::steady_clock::time_point started;
+  std::chrono::steady_clock::time_point deadline;
+  bool killed;
+};
+
+static Child start_child(const ExecJob &job, size_t index, ExecResult &r);
+static void set_limits(const ExecLimits &limits);
+static int poll_timeout(const std::vector<Child> &running);
+static void wait_until_one_ready(std::vector<Child> &running, std::vector<ExecResult> &results);
+static void stop_child(Child &c);
 
 // Run the program in command[0], where `command` must be a NULL-terminated
 // array (like `execv` expects). Supply the given string as stdin to the
 // program, wait until it complete, and report its exit status, stdout
 // as a string, and stderr s a string. The exit status is set to a signal
-// number if the program exits with a signal.
-ExecResult exec_program(const char * const *command, std::string input) {
+// number if the program exits with a signal. A program that exceeds
+// one of the `limits` is killed, and the result says which.
+ExecResult exec_program(const char * const *command, std::string input,
+                        const ExecLimits &limits) {
+  std::vector<ExecJob> jobs(1);
+  for (size_t i = 0; command[i] != NULL; i++)
+    jobs[0].command.push_back(command[i]);
+  jobs[0].input.swap(input);
+  jobs[0].limits = limits;
+  return exec_programs(jobs, 1)[0];
+}
+
+// Like `exec_program` for each job, but keeping up to `max_running`
+// programs going at once and moving data for whichever of them is
+// ready, so that a slow program does not hold up the others.
+std::vector<ExecResult> exec_programs(const std::vector<ExecJob> &jobs, size_t max_running) {
   signal(SIGPIPE, SIG_IGN);
   
+  if (max_running < 1)
+    max_running = 1;
+  
+  std::vector<ExecResult> results(jobs.size());
+  std::vector<Child> running;
+  size_t next = 0;
+  
+  while (next < jobs.size() || !running.empty()) {
+    while (next < jobs.size() && running.size() < max_running) {
+      running.push_back(start_child(jobs[next], next, results[next]));
+      next++;
+    }
+    
+    wait_until_one_ready(running, results);
+    
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < running.size(); ) {
+      Child &c = running[i];
+      ExecResult &r = results[c.job];
+      if (c.limits.timeout_seconds > 0 && !c.killed && now >= c.deadline) {
+        r.timed_out = true;
+        stop_child(c);
+      }
+      if (c.in_done && c.out_done && c.err_done) {
+        if (c.pid != -1)
+          wait_child(c.pid, r);
+        r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - c.started).count();
+        if (r.signaled && r.exit_code == SIGXCPU && c.limits.timeout_seconds > 0)
+          r.timed_out = true;
+        r.out_of_memory = (!r.timed_out && !r.output_capped
+                           && ((c.limits.memory_bytes > 0 && r.signaled && r.exit_code == SIGKILL && !c.killed)
+                               || r.err.find("bad_alloc") != std::string::npos
+                               || r.err.find("out of memory") != std::string::npos));
+        running.erase(running.begin() + i);
+      } else
+        i++;
+    }
+  }
+  
+  return results;
+}
+
+// Start the program for `job`, whose result goes at `index` and
+// in `r`. The program is started with `posix_spawn`, which does not
+// copy the parent's page tables the way `fork` does. A job with
+// memory or time limits is started with `fork` instead, so that the
+// child sets them itself before `exec` and never runs without them.
+static Child start_child(const ExecJob &job, size_t index, ExecResult &r) {
+  std::vector<const char *> command;
+  for (const std::string &arg : job.command)
+    command.push_back(arg.c_str());
+  command.push_back(NULL);
+  
   int in[2];
   if (pipe(in) != 0)
     throw std::runtime_error("stdin pipe failed");
@@ -44,121 +149,252 @@ ExecResult exec_program(const char * const *command, std::string input) {
   int err[2];
   if (pipe(err) != 0)
     throw std::runtime_error("stdout pipe failed");
-
-  pid_t pid = fork();
-  if (pid == -1)
-    throw std::runtime_error("fork failed");
-  else if (pid ==  0) {
-    /* child */
-    dup2(in[READ_END], STDIN_FD);
-    dup2(out[WRITE_END], STDOUT_FD);
-    dup2(err[WRITE_END], STDERR_FD);
-    
-    close(in[READ_END]);
-    close(in[WRITE_END]);
-    close(out[READ_END]);
-    close(out[WRITE_END]);
-    close(err[READ_END]);
-    close(err[WRITE_END]);
-    
-    execv(command[0], (char * const *)command);
+  
+  // The parent's ends must not leak into later children, or a
+  // child would never see EOF on stdin while a sibling holds it
+  close_on_exec(in[WRITE_END]);
+  close_on_exec(out[READ_END]);
+  close_on_exec(err[READ_END]);
+#ifdef F_SETPIPE_SZ
+  if (job.input.length() >= BIG_INPUT)
+    fcntl(in[WRITE_END], F_SETPIPE_SZ, BIG_PIPE);
+#endif
+  
+  Child c;
+  c.job = index;
+  c.limits = job.limits;
+  c.killed = false;
+  c.started = std::chrono::steady_clock::now();
+  c.deadline = c.started + std::chrono::duration_cast<std::chrono::steady_clock::duration>
+                             (std::chrono::duration<double>(job.limits.timeout_seconds));
+  
+  bool spawn = (job.limits.memory_bytes == 0 && job.limits.timeout_seconds <= 0);
+  
+  if (spawn) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[READ_END], STDIN_FD);
+    posix_spawn_file_actions_adddup2(&actions, out[WRITE_END], STDOUT_FD);
+    posix_spawn_file_actions_adddup2(&actions, err[WRITE_END], STDERR_FD);
+    posix_spawn_file_actions_addclose(&actions, in[READ_END]);
+    posix_spawn_file_actions_addclose(&actions, out[WRITE_END]);
+    posix_spawn_file_actions_addclose(&actions, err[WRITE_END]);
     
-    /* Getting here means that the execve failed */
-    {
-      const char *msg = "exec failed";
-      write(STDERR_FD, msg, strlen(msg));
-      exit(1);
+    int rtn = posix_spawn(&c.pid, command[0], &actions, NULL, (char * const *)command.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rtn != 0) {
+      /* Report it as the program would have if `exec` had failed in
+         a forked child */
+      c.pid = -1;
+      r.exit_code = 1;
+      r.err = "exec failed";
     }
   } else {
-    /* parent */
-    bool in_done = false, out_done = false, err_done = false;
-    ExecResult r;
-
-    close(in[READ_END]);
-    close(out[WRITE_END]);
-    close(err[WRITE_END]);
-    
-    do {
-      wait_until_one_ready(in[WRITE_END], in_done,
-                           out[READ_END], out_done,
-                           err[READ_END], err_done);
-      pump_to(input, in[WRITE_END], in_done);
-      pump_from(out[READ_END], r.out, out_done);
-      pump_from(err[READ_END], r.err, err_done);
-    } while (!in_done || !out_done || !err_done);
-    
-    wait_child(pid, r.exit_code);
-    
-    return r;
+    c.pid = fork();
+    if (c.pid == -1)
+      throw std::runtime_error("fork failed");
+    else if (c.pid ==  0) {
+      /* child */
+      dup2(in[READ_END], STDIN_FD);
+      dup2(out[WRITE_END], STDOUT_FD);
+      dup2(err[WRITE_END], STDERR_FD);
+      
+      close(in[READ_END]);
+      close(in[WRITE_END]);
+      close(out[READ_END]);
+      close(out[WRITE_END]);
+      close(err[READ_END]);
+      close(err[WRITE_END]);
+      
+      set_limits(job.limits);
+      execv(command[0], (char * const *)command.data());
+      
+      /* Getting here means that the execve failed */
+      {
+        const char *msg = "exec failed";
+        write(STDERR_FD, msg, strlen(msg));
+        _exit(1);
+      }
+    }
   }
+  
+  /* parent */
+  close(in[READ_END]);
+  close(out[WRITE_END]);
+  close(err[WRITE_END]);
+  
+  c.in_fd = in[WRITE_END];
+  c.out_fd = out[READ_END];
+  c.err_fd = err[READ_END];
+  nonblocking(c.in_fd, true);
+  nonblocking(c.out_fd, true);
+  nonblocking(c.err_fd, true);
+  c.in_done = c.out_done = c.err_done = false;
+  c.input = &job.input;
+  c.input_offset = 0;
+  
+  if (c.pid == -1) {
+    close(c.in_fd);
+    close(c.out_fd);
+    close(c.err_fd);
+    c.in_done = c.out_done = c.err_done = true;
+  }
+  
+  return c;
 }
 
-// Enable/disable nonblocking mode for a file descriptor
-static void nonblocking(int fd, bool enabled) {
-  int old_flags = fcntl(fd, F_GETFL, 0);
-  fcntl(fd, F_SETFL, (enabled
-                      ? old_flags | O_NONBLOCK
-                      : old_flags - (old_flags & O_NONBLOCK)));
+// Apply `limits` to this process, a child about to `exec`. The CPU
+// limit only matters if the parent is gone and cannot kill it on time.
+static void set_limits(const ExecLimits &limits) {
+  struct rlimit memory;
+  memory.rlim_cur = memory.rlim_max = (rlim_t)limits.memory_bytes;
+  struct rlimit cpu;
+  cpu.rlim_cur = (rlim_t)ceil(limits.timeout_seconds) + 1;
+  cpu.rlim_max = cpu.rlim_cur + 1;
+  
+  if (limits.memory_bytes > 0) {
+    setrlimit(RLIMIT_AS, &memory);
+    setrlimit(RLIMIT_DATA, &memory);
+  }
+  if (limits.timeout_seconds > 0)
+    setrlimit(RLIMIT_CPU, &cpu);
 }
 
-// Check whether a system call result means "retry"
-static int needs_retry(int rtn) {
-  return (rtn == -1) && (errno == EINTR);
+// Milliseconds until the first deadline of a running program, or
+// -1 to wait as long as it takes
+static int poll_timeout(const std::vector<Child> &running) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  long timeout = -1;
+  for (const Child &c : running) {
+    if (c.limits.timeout_seconds <= 0 || c.killed)
+      continue;
+    long left = (long)std::chrono::duration_cast<std::chrono::milliseconds>(c.deadline - now).count() + 1;
+    if (left < 0)
+      left = 0;
+    if (timeout < 0 || left < timeout)
+      timeout = left;
+  }
+  return (int)timeout;
 }
 
-// Block until reading or writing is possible on one of the
-// given file descriptors
-static void wait_until_one_ready(int wr_fd, bool wr_done,
-                                 int rd1_fd, bool rd1_done,
-                                 int rd2_fd, bool rd2_done) {
-  struct pollfd poll_info[3];
-  int count = 0;
-  
-  if (!wr_done) {
-    poll_info[count].fd = wr_fd;
-    poll_info[count++].events = POLLOUT;
-  }
-  if (!rd1_done) {
-    poll_info[count].fd = rd1_fd;
-    poll_info[count++].events = POLLIN;
-  }
-  if (!rd2_done) {
-    poll_info[count].fd = rd2_fd;
-    poll_info[count++].events = POLLIN;
+// Block until reading or writing is possible for one of the
+// running programs, or until the first deadline, then move data
+// for every one that is ready
+static void wait_until_one_ready(std::vector<Child> &running, std::vector<ExecResult> &results) {
+  std::vector<struct pollfd> poll_info;
+  // For each entry of `poll_info`, its child and which pipe it is
+  std::vector<std::pair<size_t, int>> owners;
+  
+  for (size_t i = 0; i < running.size(); i++) {
+    Child &c = running[i];
+    if (!c.in_done) {
+      poll_info.push_back({ c.in_fd, POLLOUT, 0 });
+      owners.push_back(std::make_pair(i, STDIN_FD));
+    }
+    if (!c.out_done) {
+      poll_info.push_back({ c.out_fd, POLLIN, 0 });
+      owners.push_back(std::make_pair(i, STDOUT_FD));
+    }
+    if (!c.err_done) {
+      poll_info.push_back({ c.err_fd, POLLIN, 0 });
+      owners.push_back(std::make_pair(i, STDERR_FD));
+    }
   }
   
-  if (count == 0)
+  if (poll_info.empty())
     return;
 
   int rtn;
   do {
-    rtn = poll(poll_info, count, -1);
+    rtn = poll(poll_info.data(), (nfds_t)poll_info.size(), poll_timeout(running));
   } while (needs_retry(rtn));
   
   if (rtn == -1)
     throw std::runtime_error("poll failed");
+  
+  for (size_t k = 0; k < poll_info.size(); k++) {
+    if (poll_info[k].revents == 0)
+      continue;
+    Child &c = running[owners[k].first];
+    ExecResult &r = results[c.job];
+    if (owners[k].second == STDIN_FD)
+      pump_to(*c.input, c.input_offset, c.in_fd, c.in_done);
+    else if (owners[k].second == STDOUT_FD)
+      pump_from(c.out_fd, r.out, c.out_done);
+    else
+      pump_from(c.err_fd, r.err, c.err_done);
+    
+    size_t cap = c.limits.output_bytes;
+    if (cap > 0 && !c.killed && r.out.length() + r.err.length() > cap) {
+      if (r.out.length() > cap)
+        r.out.resize(cap);
+      r.err.resize(std::min(r.err.length(), cap - r.out.length()));
+      r.output_capped = true;
+      stop_child(c);
+    }
+  }
 }
 
-// Move characters from the given string to the given file descriptor,
-// closing the file descriptor if the string is empty. The `done` flag
-// is consulted and possibly set to indicate whether the file descriptor
-// is still open.
-static void pump_to(std::string &str, int fd, bool &done) {
+// Kill a program and stop moving data for it; it is still waited
+// for like any other
+static void stop_child(Child &c) {
+  kill(c.pid, SIGKILL);
+  c.killed = true;
+  if (!c.in_done)
+    close(c.in_fd);
+  if (!c.out_done)
+    close(c.out_fd);
+  if (!c.err_done)
+    close(c.err_fd);
+  c.in_done = c.out_done = c.err_done = true;
+}
+
+// Enable/disable nonblocking mode for a file descriptor
+static void nonblocking(int fd, bool enabled) {
+  int old_flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, (enabled
+                      ? old_flags | O_NONBLOCK
+                      : old_flags - (old_flags & O_NONBLOCK)));
+}
+
+// Keep a file descriptor from being inherited by programs that
+// are started later
+static void close_on_exec(int fd) {
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
+}
+
+// Check whether a system call result means "retry"
+static int needs_retry(int rtn) {
+  return (rtn == -1) && (errno == EINTR);
+}
+
+// Move characters from the given string, starting at `offset`, to
+// the given file descriptor, closing the file descriptor once all
+// are written. The `done` flag is consulted and possibly set to
+// indicate whether the file descriptor is still open. On Linux the
+// pages of `str` are handed to the pipe with `vmsplice` instead of
+// being copied, so `str` must not change until the reader is done.
+static void pump_to(const std::string &str, size_t &offset, int fd, bool &done) {
   if (!done) {
     ssize_t len;
-    nonblocking(fd, true);
     do {
-      len = write(fd, str.c_str(), str.length());
+#ifdef __linux__
+      struct iovec rest;
+      rest.iov_base = (void *)(str.data() + offset);
+      rest.iov_len = str.length() - offset;
+      len = vmsplice(fd, &rest, 1, SPLICE_F_NONBLOCK);
+      if ((len < 0) && (errno != EAGAIN) && (errno != EINTR))
+#endif
+        len = write(fd, str.data() + offset, str.length() - offset);
     } while (needs_retry((int)len));
-    nonblocking(fd, false);
     if ((len < 0) && (errno == EAGAIN)) {
       // not ready to write
     } else {
       if (len < 0)
-        str.erase(0, str.length()); // treat error like writing all
+        offset = str.length(); // treat error like writing all
       else
-        str.erase(0, len);
-      if (str.length() == 0) {
+        offset += len;
+      if (offset == str.length()) {
         done = true;
         close(fd);
       }
@@ -172,13 +408,11 @@ static void pump_to(std::string &str, int fd, bool &done) {
 // open.
 static void pump_from(int fd, std::string &str, bool &done) {
   if (!done) {
-    char buffer[256];
+    char buffer[65536];
     ssize_t len;
-    nonblocking(fd, true);
     do {
-      len = read(fd, buffer, sizeof(buffer)-1);
+      len = read(fd, buffer, sizeof(buffer));
     } while (needs_retry((int)len));
-    nonblocking(fd, false);
     if ((len < 0) && (errno == EAGAIN)) {
       // nothing ready to read
     } else {
@@ -195,20 +429,33 @@ static void pump_from(int fd, std::string &str, bool &done) {
   }
 }
 
-// Wait until a process has terminated
-static void wait_child(pid_t pid, int &exit_code) {
+// Wait until a process has terminated, and record its status and
+// the resources it used
+static void wait_child(pid_t pid, ExecResult &r) {
   int status;
   pid_t rtn;
+  struct rusage usage;
+  int &exit_code = r.exit_code;
   
   do {
-    rtn = waitpid(pid, &status, 0);
+    rtn = wait4(pid, &status, 0, &usage);
   } while (needs_retry(rtn));
   if (rtn == -1)
     throw std::runtime_error("waitpid failed");
   if (WIFEXITED(status))
     exit_code = WEXITSTATUS(status);
-  else if (WIFSIGNALED(status))
+  else if (WIFSIGNALED(status)) {
     exit_code = WTERMSIG(status);
+    r.signaled = true;
+  }
   else
     throw std::runtime_error("unrecognized status from waitpid");
+  
+  r.user_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  r.system_seconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+  r.max_rss_kb = usage.ru_maxrss / 1024; // bytes on macOS
+#else
+  r.max_rss_kb = usage.ru_maxrss;
+#endif
 }
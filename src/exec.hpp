@@ -2,19 +2,73 @@
 #define exec_hpp
 
 #include <string>
+#include <vector>
 
 class ExecResult {
 public:
   int exit_code;
+  // Whether `exit_code` is the number of a signal that ended it
+  bool signaled;
   std::string out;
   std::string err;
+  // Wall-clock time from starting the program until it exited
+  double seconds;
+  // CPU time the program used, and the most memory it had resident
+  double user_seconds;
+  double system_seconds;
+  long max_rss_kb;
+  // Why the program was stopped, if it did not finish by itself; a
+  // program that ran out of memory is only recognized by reporting
+  // `bad_alloc` or `out of memory`, or by being killed from outside
+  bool timed_out;
+  bool out_of_memory;
+  bool output_capped;
   ExecResult() {
     exit_code = 0;
+    signaled = false;
     out = "";
     err = "";
+    seconds = 0;
+    user_seconds = 0;
+    system_seconds = 0;
+    max_rss_kb = 0;
+    timed_out = false;
+    out_of_memory = false;
+    output_capped = false;
   }
 };
 
-extern ExecResult exec_program(const char * const *command, std::string input);
+// Limits on a program; 0 means no limit
+class ExecLimits {
+public:
+  // Wall-clock seconds before the program is killed
+  double timeout_seconds;
+  // Address space the program may use, set with `setrlimit`
+  size_t memory_bytes;
+  // Bytes of stdout and stderr together that are kept; the program
+  // is killed when it writes more
+  size_t output_bytes;
+  ExecLimits() {
+    timeout_seconds = 0;
+    memory_bytes = 0;
+    output_bytes = 0;
+  }
+};
+
+// A program for `exec_programs` to run: `command` is the program
+// followed by its arguments, and `input` its stdin
+class ExecJob {
+public:
+  std::vector<std::string> command;
+  std::string input;
+  ExecLimits limits;
+};
+
+extern ExecResult exec_program(const char * const *command, std::string input,
+                               const ExecLimits &limits = ExecLimits());
+
+// Runs every job, at most `max_running` at a time, and returns their
+// results in the same order
+extern std::vector<ExecResult> exec_programs(const std::vector<ExecJob> &jobs, size_t max_running);
 
 #endif /* exec_hpp */
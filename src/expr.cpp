@@ -10,56 +10,1201 @@
 #include "catch.hpp"
 #include "value.hpp"
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
 #include "Env.hpp"
 #include "step.hpp"
 #include "cont.hpp"
 #include "parse.hpp"
+#include "serialize.hpp"
+#include "parallel.hpp"
+#include "stats.hpp"
+#include "source.hpp"
+
+// How much an unknown call is guessed to cost, see `Expr::cost`
+static const long CALL_COST = 1000;
+
+static PTR(Expr) share_common(PTR(Expr) e);
+// How many times each `_let` names its variable in its body, found
+// in one pass before `fold` looks at any of them
+static std::unordered_map<Expr*, long> occurrences;
+static void count_occurrences(PTR(Expr) e, std::unordered_map<std::string, std::vector<long*>> &counters);
+
+PTR(Expr) Expr::optimize() {
+    PTR(Val) val;
+    std::unordered_map<std::string, std::vector<long*>> counters;
+    occurrences.clear();
+    count_occurrences(THIS, counters);
+    return share_common(fold(Env::emptyenv, val));
+}
+
+// A variable in scope for `fold`, which also counts how many times
+// the folded program still refers to it
+class FoldBinding : public ExtendedEnv {
+public:
+    long uses;
+    // How many bindings `env` has, this one included
+    long depth;
+    
+    // For a `_let` whose right-hand side cannot fail: that right-hand
+    // side, to put in place of its only use (or of every use, if it is
+    // a variable), and how deep in `_fun`s and inlined calls the body
+    // is. `pending` is how many uses in the body are still to be
+    // folded, or -1 if not known; `moved` says the right-hand side
+    // went to its use.
+    PTR(Expr) replacement;
+    int fun_level;
+    int inline_level;
+    long pending;
+    bool moved;
+    
+    // The last `_if` folded right in this scope, and how many uses
+    // were counted in each of its parts
+    PTR(Expr) split;
+    long part_uses[3];
+    
+    FoldBinding(std::string name, PTR(Val) val, PTR(Env) env) : ExtendedEnv(name, val, env) {
+        uses = 0;
+        PTR(FoldBinding) outer = CAST(FoldBinding)(env);
+        depth = (outer != nullptr ? outer->depth : 0) + 1;
+        replacement = nullptr;
+        fun_level = 0;
+        inline_level = 0;
+        pending = -1;
+        moved = false;
+        split = nullptr;
+    }
+};
+
+// How many bindings a scope of `fold` has
+static long scope_depth(PTR(Env) env) {
+    PTR(FoldBinding) binding = CAST(FoldBinding)(env);
+    return binding != nullptr ? binding->depth : 0;
+}
+
+// The bindings in scope, innermost last for each name, so that
+// finding one costs the same however many `_let`s are around it
+static std::unordered_map<std::string, std::vector<PTR(FoldBinding)>> scope;
+
+// Puts a binding in `scope` for as long as it lives
+class InScope {
+public:
+    InScope(PTR(FoldBinding) binding) : bindings(scope[binding->name]) {
+        bindings.push_back(binding);
+    }
+    ~InScope() {
+        bindings.pop_back();
+    }
+private:
+    std::vector<PTR(FoldBinding)> &bindings;
+};
+
+// Where `name` is bound in `scope`; nullptr if it is free
+static PTR(FoldBinding) find_binding(const std::string &name) {
+    auto found = scope.find(name);
+    if (found == scope.end() || found->second.empty())
+        return nullptr;
+    return found->second.back();
+}
+
+// The constant value `fold` knows for `name`; nullptr if it is
+// unknown (a parameter, or bound to something not constant) or free
+static PTR(Val) known_value(const std::string &name) {
+    PTR(FoldBinding) binding = find_binding(name);
+    return binding != nullptr ? binding->val : nullptr;
+}
+
+// Notes `n` more (or, if negative, fewer) references to `name`
+static void count_use(const std::string &name, long n) {
+    PTR(FoldBinding) binding = find_binding(name);
+    if (binding != nullptr)
+        binding->uses += n;
+}
+
+// What `fold` binds a variable to when it is sure to hold a number
+// but does not know which; compared by address, never used as 0
+static PTR(Val) unknown_number = NEW(NumVal)(0);
+
+// Whether `e` either fails or produces a number
+static bool is_number(PTR(Expr) e) {
+    return (CAST(NumExpr)(e) != nullptr || CAST(AddExpr)(e) != nullptr
+            || CAST(MultExpr)(e) != nullptr);
+}
+
+// Whether `e` produces a number without fail, so that it can be
+// dropped from a product with 0 without losing an error
+static bool is_total_number(PTR(Expr) e) {
+    if (CAST(NumExpr)(e) != nullptr)
+        return true;
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr)
+        return known_value(var->name) == unknown_number;
+    PTR(AddExpr) add = CAST(AddExpr)(e);
+    if (add != nullptr)
+        return is_total_number(add->lhs) && is_total_number(add->rhs);
+    PTR(MultExpr) mult = CAST(MultExpr)(e);
+    if (mult != nullptr)
+        return is_total_number(mult->lhs) && is_total_number(mult->rhs);
+    return false;
+}
+
+// Whether evaluating `e` surely finishes without an error, so that
+// it makes no difference when, or whether, it is done
+static bool is_total(PTR(Expr) e) {
+    if (CAST(NumExpr)(e) != nullptr || CAST(BoolExpr)(e) != nullptr || CAST(FunExpr)(e) != nullptr)
+        return true;
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr)
+        return find_binding(var->name) != nullptr;
+    if (CAST(AddExpr)(e) != nullptr || CAST(MultExpr)(e) != nullptr)
+        return is_total_number(e);
+    PTR(EqualExpr) equal = CAST(EqualExpr)(e);
+    if (equal != nullptr)
+        return is_total(equal->lhs) && is_total(equal->rhs);
+    PTR(IfExpr) if_expr = CAST(IfExpr)(e);
+    if (if_expr != nullptr)
+        return (CAST(EqualExpr)(if_expr->if_part) != nullptr && is_total(if_expr->if_part)
+                && is_total(if_expr->then_part) && is_total(if_expr->else_part));
+    PTR(LetExpr) let = CAST(LetExpr)(e);
+    if (let != nullptr) {
+        if (!is_total(let->rhs))
+            return false;
+        PTR(Val) bound = is_total_number(let->rhs) ? unknown_number : nullptr;
+        InScope in_scope(NEW(FoldBinding)(let->name, bound, nullptr));
+        return is_total(let->expr);
+    }
+    return false;
+}
+
+// The largest function body (in nodes) that a call by name is
+// replaced with; a `_fun` written right at the call is always used
+static const long INLINE_SIZE = 40;
+// How many inlined bodies may be folded inside one another, which
+// also stops `(_fun(x) x(x))(_fun(x) x(x))` from unfolding forever
+static const int MAX_INLINE_DEPTH = 8;
+static int inline_depth = 0;
+// How many `_fun` bodies `fold` is inside
+static int fun_depth = 0;
+// Set while folding the function of a call that is itself called
+static bool folding_callee = false;
+
+// The subexpressions right below `e`
+static std::vector<PTR(Expr)> children(PTR(Expr) e) {
+    std::vector<PTR(Expr)> kids;
+    if (CAST(AddExpr)(e) != nullptr) {
+        kids.push_back(CAST(AddExpr)(e)->lhs);
+        kids.push_back(CAST(AddExpr)(e)->rhs);
+    } else if (CAST(MultExpr)(e) != nullptr) {
+        kids.push_back(CAST(MultExpr)(e)->lhs);
+        kids.push_back(CAST(MultExpr)(e)->rhs);
+    } else if (CAST(EqualExpr)(e) != nullptr) {
+        kids.push_back(CAST(EqualExpr)(e)->lhs);
+        kids.push_back(CAST(EqualExpr)(e)->rhs);
+    } else if (CAST(LetExpr)(e) != nullptr) {
+        kids.push_back(CAST(LetExpr)(e)->rhs);
+        kids.push_back(CAST(LetExpr)(e)->expr);
+    } else if (CAST(IfExpr)(e) != nullptr) {
+        kids.push_back(CAST(IfExpr)(e)->if_part);
+        kids.push_back(CAST(IfExpr)(e)->then_part);
+        kids.push_back(CAST(IfExpr)(e)->else_part);
+    } else if (CAST(FunExpr)(e) != nullptr) {
+        kids.push_back(CAST(FunExpr)(e)->body);
+    } else if (CAST(CallFunExpr)(e) != nullptr) {
+        kids.push_back(CAST(CallFunExpr)(e)->to_be_called);
+        kids.push_back(CAST(CallFunExpr)(e)->actual_arg);
+    }
+    return kids;
+}
+
+// A copy of `e` with `kids` in place of `children(e)`
+static PTR(Expr) with_children(PTR(Expr) e, const std::vector<PTR(Expr)> &kids) {
+    if (CAST(AddExpr)(e) != nullptr)
+        return NEW(AddExpr)(kids[0], kids[1]);
+    if (CAST(MultExpr)(e) != nullptr)
+        return NEW(MultExpr)(kids[0], kids[1]);
+    if (CAST(EqualExpr)(e) != nullptr)
+        return NEW(EqualExpr)(kids[0], kids[1]);
+    if (CAST(LetExpr)(e) != nullptr)
+        return NEW(LetExpr)(CAST(LetExpr)(e)->name, kids[0], kids[1]);
+    if (CAST(IfExpr)(e) != nullptr)
+        return NEW(IfExpr)(kids[0], kids[1], kids[2]);
+    if (CAST(FunExpr)(e) != nullptr)
+        return NEW(FunExpr)(CAST(FunExpr)(e)->formal_arg, kids[0], CAST(FunExpr)(e)->label);
+    if (CAST(CallFunExpr)(e) != nullptr)
+        return NEW(CallFunExpr)(kids[0], kids[1]);
+    return e;
+}
+
+// How many nodes `e` has, counting no further than just past `limit`
+static long expr_size(PTR(Expr) e, long limit) {
+    long size = 1;
+    for (PTR(Expr) kid : children(e)) {
+        if (size > limit)
+            break;
+        size += expr_size(kid, limit - size);
+    }
+    return size;
+}
+
+// Whether the variable `name` appears anywhere in `e`
+static bool mentions(PTR(Expr) e, const std::string &name) {
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr)
+        return var->name == name;
+    for (PTR(Expr) kid : children(e)) {
+        if (mentions(kid, name))
+            return true;
+    }
+    return false;
+}
+
+// Counts, for every `_let` in `e`, its variable's uses in its body
+// into `occurrences`, and uses of the variables `e` is under into the
+// innermost of `counters` for each name
+static void count_occurrences(PTR(Expr) e, std::unordered_map<std::string, std::vector<long*>> &counters) {
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr) {
+        auto found = counters.find(var->name);
+        if (found != counters.end() && !found->second.empty())
+            (*found->second.back())++;
+        return;
+    }
+    PTR(LetExpr) let = CAST(LetExpr)(e);
+    PTR(FunExpr) fun = CAST(FunExpr)(e);
+    if (let != nullptr || fun != nullptr) {
+        long unused = 0;
+        long *count = &unused;
+        if (let != nullptr) {
+            count_occurrences(let->rhs, counters);
+            count = &occurrences[&*let];
+            *count = 0;
+        }
+        std::vector<long*> &inner = counters[let != nullptr ? let->name : fun->formal_arg];
+        inner.push_back(count);
+        count_occurrences(let != nullptr ? let->expr : fun->body, counters);
+        inner.pop_back();
+        return;
+    }
+    // `fold` never looks at the branch a constant test rules out
+    PTR(IfExpr) if_expr = CAST(IfExpr)(e);
+    PTR(BoolExpr) test = if_expr != nullptr ? CAST(BoolExpr)(if_expr->if_part) : nullptr;
+    if (test != nullptr) {
+        count_occurrences(test->rep ? if_expr->then_part : if_expr->else_part, counters);
+        return;
+    }
+    for (PTR(Expr) kid : children(e))
+        count_occurrences(kid, counters);
+}
+
+// Whether every variable named in `e`, except `except`, is bound no
+// deeper in the current scope than `depth` bindings
+static bool bound_within(PTR(Expr) e, long depth, const std::string &except) {
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr) {
+        PTR(FoldBinding) binding = find_binding(var->name);
+        return var->name == except || binding == nullptr || binding->depth <= depth;
+    }
+    for (PTR(Expr) kid : children(e)) {
+        if (!bound_within(kid, depth, except))
+            return false;
+    }
+    return true;
+}
+
+/* Sets up `binding` for `_let name = rhs _in body`, about to be
+ folded, so that a right-hand side that cannot fail can be put in
+ place of its uses (see `replace_use`). `uses` is how often `body`
+ names it, or -1 if not known. */
+static void prepare_binding(PTR(FoldBinding) binding, PTR(Expr) rhs, PTR(Val) rhs_val, long uses) {
+    binding->fun_level = fun_depth;
+    binding->inline_level = inline_depth;
+    binding->pending = uses;
+    if (rhs_val == nullptr && is_total(rhs))
+        binding->replacement = rhs;
+}
+
+/* What a use of `binding` becomes: its right-hand side, if it was
+ prepared for that and this is the only use left (or it is a
+ variable), or nullptr. It moves there unless that would put it under
+ a binding of a variable it uses, or (unless it is no more work than
+ a variable) inside a function body, where it would be evaluated once
+ per call. A use folded again as part of an inlined call's body is a
+ copy of one already seen, so it is left. */
+static PTR(Expr) replace_use(PTR(FoldBinding) binding) {
+    if (inline_depth != binding->inline_level)
+        return nullptr;
+    if (binding->pending > 0)
+        binding->pending--;
+    PTR(Expr) rhs = binding->replacement;
+    if (rhs == nullptr)
+        return nullptr;
+    if (CAST(VarExpr)(rhs) == nullptr && (binding->pending != 0 || binding->uses != 0))
+        return nullptr;
+    if (fun_depth != binding->fun_level && CAST(VarExpr)(rhs) == nullptr
+        && CAST(NumExpr)(rhs) == nullptr && CAST(BoolExpr)(rhs) == nullptr
+        && CAST(FunExpr)(rhs) == nullptr)
+        return nullptr;
+    // Its own name in `rhs` means the outer one, which the `_let` no
+    // longer hides once its only use is gone
+    if (!bound_within(rhs, binding->depth - 1, binding->name))
+        return nullptr;
+    // A variable can go in place of every use, each counted as one
+    PTR(VarExpr) var = CAST(VarExpr)(rhs);
+    if (var != nullptr) {
+        // Its own name means the binding under this one
+        std::vector<PTR(FoldBinding)> &bindings = scope[var->name];
+        size_t skip = var->name == binding->name ? 2 : 1;
+        if (bindings.size() >= skip)
+            bindings[bindings.size() - skip]->uses++;
+    } else {
+        binding->replacement = nullptr;
+        binding->moved = true;
+    }
+    return rhs;
+}
+
+/* Whether `e` can evaluate to a closure made while evaluating it,
+ `locals` being the `_let`s around it that are part of it. Since `==`
+ compares closures' environments, such a closure would tell that a
+ call was inlined and its parameter's binding dropped or moved. */
+static bool may_make_closure(PTR(Expr) e, std::vector<std::string> &locals) {
+    if (CAST(FunExpr)(e) != nullptr || CAST(CallFunExpr)(e) != nullptr)
+        return true;
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr)
+        return std::find(locals.begin(), locals.end(), var->name) != locals.end();
+    PTR(IfExpr) if_expr = CAST(IfExpr)(e);
+    if (if_expr != nullptr)
+        return may_make_closure(if_expr->then_part, locals) || may_make_closure(if_expr->else_part, locals);
+    PTR(LetExpr) let = CAST(LetExpr)(e);
+    if (let != nullptr) {
+        locals.push_back(let->name);
+        bool result = may_make_closure(let->expr, locals);
+        locals.pop_back();
+        return result;
+    }
+    return false;
+}
+
+// Whether inlining a call to a function with this body is invisible:
+// it makes no closures, or (when the call's result is called right
+// away) only a `_fun` whose own calls make none
+static bool inlinable_body(PTR(Expr) body, bool callee) {
+    std::vector<std::string> locals;
+    if (!may_make_closure(body, locals))
+        return true;
+    PTR(FunExpr) fun = CAST(FunExpr)(body);
+    return callee && fun != nullptr && !may_make_closure(fun->body, locals);
+}
+
+/* Takes back the uses of the variables free in `e`, which is being
+ dropped: from the counts of uses if it was `folded`, or else from
+ those still pending. `bound` has the names bound inside it so far. */
+static void take_back_uses(PTR(Expr) e, bool folded, std::unordered_map<std::string, int> &bound) {
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr) {
+        PTR(FoldBinding) binding = bound[var->name] == 0 ? find_binding(var->name) : nullptr;
+        if (binding != nullptr && folded)
+            binding->uses--;
+        else if (binding != nullptr && binding->inline_level == inline_depth && binding->pending > 0)
+            binding->pending--;
+        return;
+    }
+    PTR(LetExpr) let = CAST(LetExpr)(e);
+    PTR(FunExpr) fun = CAST(FunExpr)(e);
+    if (let != nullptr || fun != nullptr) {
+        if (let != nullptr)
+            take_back_uses(let->rhs, folded, bound);
+        int &inner = bound[let != nullptr ? let->name : fun->formal_arg];
+        inner++;
+        take_back_uses(let != nullptr ? let->expr : fun->body, folded, bound);
+        inner--;
+        return;
+    }
+    for (PTR(Expr) kid : children(e))
+        take_back_uses(kid, folded, bound);
+}
+
+/* Finishes folding `_let name = rhs _in expr`, with `rhs` and then
+ `expr` (in `binding`) already folded. A constant was substituted,
+ so the binding goes. A right-hand side that cannot fail goes too if
+ nothing uses it (as when it was put in place of its only use), or
+ else moves into the one branch of an `_if` that needs it. `original`
+ is returned if nothing changed. */
+static PTR(Expr) finish_let(const std::string &name, PTR(Expr) rhs, PTR(Val) rhs_val,
+                            PTR(FoldBinding) binding, PTR(Expr) expr,
+                            PTR(Val) &val, PTR(Expr) original) {
+    if (rhs_val != nullptr)
+        return expr;
+    
+    if (is_total(rhs)) {
+        if (binding->uses == 0) {
+            // Uses made by `rhs` itself go with it, unless it was moved
+            if (!binding->moved) {
+                std::unordered_map<std::string, int> bound;
+                take_back_uses(rhs, true, bound);
+            }
+            return expr;
+        }
+        PTR(IfExpr) if_expr = CAST(IfExpr)(expr);
+        if (if_expr != nullptr && binding->split == expr && binding->part_uses[0] == 0) {
+            bool in_then = binding->part_uses[1] > 0;
+            bool in_else = binding->part_uses[2] > 0;
+            val = nullptr;
+            if (in_then && !in_else)
+                return NEW(IfExpr)(if_expr->if_part, NEW(LetExpr)(name, rhs, if_expr->then_part), if_expr->else_part);
+            if (in_else && !in_then)
+                return NEW(IfExpr)(if_expr->if_part, if_expr->then_part, NEW(LetExpr)(name, rhs, if_expr->else_part));
+        }
+    }
+    
+    // Any other right-hand side still has to run (and might fail),
+    // so the whole is not a constant even if the body is
+    val = nullptr;
+    PTR(LetExpr) let = CAST(LetExpr)(original);
+    if (let != nullptr && let->rhs == rhs && let->expr == expr)
+        return original;
+    return NEW(LetExpr)(name, rhs, expr);
+}
+
+// Whether `body`, written where `fold` had `def_env` (which is around
+// the current scope), would mean the same here: nothing bound since
+// then may be named in it
+static bool same_bindings(PTR(Env) def_env, const std::string &formal_arg, PTR(Expr) body) {
+    PTR(VarExpr) var = CAST(VarExpr)(body);
+    if (var != nullptr) {
+        PTR(FoldBinding) binding = find_binding(var->name);
+        return (var->name == formal_arg || binding == nullptr
+                || binding->depth <= scope_depth(def_env));
+    }
+    for (PTR(Expr) kid : children(body)) {
+        if (!same_bindings(def_env, formal_arg, kid))
+            return false;
+    }
+    return true;
+}
+
+// What `fold` binds a variable to when its value folded to `e`
+// (with constant value `val`): the constant, the fact that it is a
+// number, or, for a function, the function as a `FunVal` over `env`,
+// so that calls of it by name can be inlined
+static PTR(Val) binding_for(PTR(Expr) e, PTR(Val) val, PTR(Env) env) {
+    if (val != nullptr)
+        return val;
+    if (is_number(e) || is_total_number(e))
+        return unknown_number;
+    PTR(FunExpr) fun = CAST(FunExpr)(e);
+    if (fun != nullptr)
+        return NEW(FunVal)(fun->formal_arg, fun->body, env, fun->label);
+    return nullptr;
+}
+
+/* Beta-reduces a call of a known function, both already folded, into
+ `_let formal_arg = actual_arg _in body` (which evaluates in the same
+ order) and folds that; nullptr if the function is not known. A
+ function is known if it is written right there, possibly under
+ `_let`s (left around the call, unless they would capture something
+ in the argument), or if it is bound by name to a small enough one
+ whose body means the same here as where it was written. Bodies
+ that could return a new closure are not inlined (see
+ `inlinable_body`); `callee` says the call is itself called. */
+static PTR(Expr) inline_call(PTR(Expr) to_be_called, PTR(Expr) actual_arg, PTR(Val) arg_val,
+                             PTR(Env) env, PTR(Val) &val, bool callee) {
+    if (inline_depth >= MAX_INLINE_DEPTH)
+        return nullptr;
+    
+    PTR(LetExpr) let = CAST(LetExpr)(to_be_called);
+    if (let != nullptr && !mentions(actual_arg, let->name)) {
+        PTR(FoldBinding) let_env = NEW(FoldBinding)(let->name, binding_for(let->rhs, nullptr, env), env);
+        PTR(Expr) inlined;
+        {
+            InScope in_scope(let_env);
+            inlined = inline_call(let->expr, actual_arg, arg_val, let_env, val, callee);
+        }
+        if (inlined == nullptr)
+            return nullptr;
+        val = nullptr;
+        return NEW(LetExpr)(let->name, let->rhs, inlined);
+    }
+    
+    PTR(FunExpr) fun = CAST(FunExpr)(to_be_called);
+    std::string formal_arg;
+    PTR(Expr) body = nullptr;
+    if (fun != nullptr) {
+        if (!inlinable_body(fun->body, callee))
+            return nullptr;
+        formal_arg = fun->formal_arg;
+        body = fun->body;
+    } else if (CAST(VarExpr)(to_be_called) != nullptr) {
+        const std::string &name = CAST(VarExpr)(to_be_called)->name;
+        PTR(FunVal) bound = CAST(FunVal)(known_value(name));
+        if (bound != nullptr && expr_size(bound->body, INLINE_SIZE) <= INLINE_SIZE
+            && inlinable_body(bound->body, callee)
+            && same_bindings(bound->env, bound->formal_arg, bound->body)) {
+            formal_arg = bound->formal_arg;
+            body = bound->body;
+            // The call no longer refers to the function by name
+            count_use(name, -1);
+        }
+    }
+    if (body == nullptr)
+        return nullptr;
+    
+    // `body` is already folded, so its `_let`s are new to `occurrences`
+    std::unordered_map<std::string, std::vector<long*>> counters;
+    long uses = 0;
+    counters[formal_arg].push_back(&uses);
+    count_occurrences(body, counters);
+    
+    PTR(FoldBinding) binding = NEW(FoldBinding)(formal_arg, binding_for(actual_arg, arg_val, env), env);
+    PTR(Expr) body_folded;
+    inline_depth++;
+    prepare_binding(binding, actual_arg, arg_val, uses);
+    {
+        InScope in_scope(binding);
+        body_folded = body->fold(binding, val);
+    }
+    inline_depth--;
+    return finish_let(formal_arg, actual_arg, arg_val, binding, body_folded, val, nullptr);
+}
+
+// Collects the operands of a chain of `+` (or, for `mult`, `*`)
+// from left to right, folding each of them
+static void fold_operands(PTR(Expr) e, bool mult, PTR(Env) env, std::vector<PTR(Expr)> &originals,
+                          std::vector<PTR(Expr)> &exprs, std::vector<PTR(Val)> &vals) {
+    while (1) {
+        PTR(Expr) lhs = nullptr;
+        PTR(Expr) rhs = nullptr;
+        if (!mult && CAST(AddExpr)(e) != nullptr) {
+            lhs = CAST(AddExpr)(e)->lhs;
+            rhs = CAST(AddExpr)(e)->rhs;
+        } else if (mult && CAST(MultExpr)(e) != nullptr) {
+            lhs = CAST(MultExpr)(e)->lhs;
+            rhs = CAST(MultExpr)(e)->rhs;
+        }
+        if (lhs == nullptr) {
+            PTR(Val) val;
+            originals.push_back(e);
+            exprs.push_back(e->fold(env, val));
+            vals.push_back(val);
+            return;
+        }
+        fold_operands(lhs, mult, env, originals, exprs, vals);
+        e = rhs;
+    }
+}
+
+// Builds `exprs[0] + (exprs[1] + ...)`, the way the parser would
+static PTR(Expr) build_chain(std::vector<PTR(Expr)> &exprs, bool mult) {
+    PTR(Expr) e = exprs.back();
+    for (size_t i = exprs.size() - 1; i > 0; i--) {
+        if (mult)
+            e = NEW(MultExpr)(exprs[i - 1], e);
+        else
+            e = NEW(AddExpr)(exprs[i - 1], e);
+    }
+    return e;
+}
+
+/* Folds the whole chain of `+` (or `*`) that starts at `e`, so that
+ `(x + 1) + 2` becomes `x + 3` even though the 1 and the 2 are not
+ siblings. Operands keep their order, with the constants gathered
+ into one where the first of them was; a 0 added or a 1 multiplied is
+ left out, and anything times 0 is 0, but only where no error (such
+ as adding a boolean) would be lost: a lone operand must already be
+ a number, and what a 0 wipes out must be a number that cannot
+ fail. Chains with non-number constants are only folded operand
+ by operand, leaving their errors for run time. */
+static PTR(Expr) fold_chain(PTR(Expr) e, bool mult, PTR(Env) env, PTR(Val) &val) {
+    std::vector<PTR(Expr)> originals;
+    std::vector<PTR(Expr)> exprs;
+    std::vector<PTR(Val)> vals;
+    fold_operands(e, mult, env, originals, exprs, vals);
+    
+    // The other operands, with the constants' place kept by a nullptr
+    std::vector<PTR(Expr)> terms;
+    PTR(Val) constant = nullptr;
+    PTR(Expr) constant_expr = nullptr;
+    bool all_numbers = true;
+    for (size_t i = 0; i < exprs.size(); i++) {
+        if (vals[i] == nullptr) {
+            terms.push_back(exprs[i]);
+        } else if (CAST(NumVal)(vals[i]) == nullptr) {
+            all_numbers = false;
+        } else if (constant == nullptr) {
+            terms.push_back(nullptr);
+            constant = vals[i];
+            constant_expr = exprs[i];
+        } else {
+            constant = mult ? constant->mult_with(vals[i]) : constant->add_to(vals[i]);
+            constant_expr = nullptr;
+        }
+    }
+    
+    val = nullptr;
+    std::vector<PTR(Expr)> result;
+    if (!all_numbers) {
+        result = exprs;
+    } else if (terms.size() == 1 && constant != nullptr) {
+        val = constant;
+        return constant_expr != nullptr ? constant_expr : constant->to_expr();
+    } else {
+        size_t others = terms.size() - (constant != nullptr ? 1 : 0);
+        bool identity = constant != nullptr && constant->equals(NEW(NumVal)(mult ? 1 : 0));
+        bool zero = mult && constant != nullptr && constant->equals(NEW(NumVal)(0));
+        bool total = true;
+        PTR(Expr) other = nullptr;
+        for (PTR(Expr) t : terms) {
+            if (t != nullptr) {
+                total = total && is_total_number(t);
+                other = t;
+            }
+        }
+        
+        if (zero && total) {
+            std::unordered_map<std::string, int> bound;
+            for (PTR(Expr) t : terms) {
+                if (t != nullptr)
+                    take_back_uses(t, true, bound);
+            }
+            val = constant;
+            return constant->to_expr();
+        }
+        bool keep = !identity || (others == 1 && !is_number(other) && !is_total_number(other));
+        for (PTR(Expr) t : terms) {
+            if (t != nullptr)
+                result.push_back(t);
+            else if (keep)
+                result.push_back(constant_expr != nullptr ? constant_expr : constant->to_expr());
+        }
+    }
+    
+    if (result == originals)
+        return e;
+    if (result.size() == 1)
+        return result[0];
+    return build_chain(result, mult);
+}
+
+// How much (see `Expr::cost`) a subexpression written more than once
+// has to be worth for `share_common` to compute it only once
+static const long SHARE_COST = 4;
+
+static size_t combine(size_t h, size_t v) {
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+// A hash that expressions share when `equals` says they are the same,
+// so repeats can be found without comparing everything pairwise
+typedef std::unordered_map<Expr*, size_t> hashes_t;
+
+static size_t structural_hash(PTR(Expr) e, hashes_t &hashes) {
+    auto found = hashes.find(&*e);
+    if (found != hashes.end())
+        return found->second;
+    size_t h = std::hash<std::string>()(typeid(*e).name());
+    if (CAST(NumExpr)(e) != nullptr)
+        h = combine(h, CAST(NumExpr)(e)->big != nullptr ? CAST(NumExpr)(e)->big->hash()
+                                                        : std::hash<long long>()(CAST(NumExpr)(e)->num));
+    else if (CAST(BoolExpr)(e) != nullptr)
+        h = combine(h, std::hash<bool>()(CAST(BoolExpr)(e)->rep));
+    else if (CAST(VarExpr)(e) != nullptr)
+        h = combine(h, std::hash<std::string>()(CAST(VarExpr)(e)->name));
+    else if (CAST(LetExpr)(e) != nullptr)
+        h = combine(h, std::hash<std::string>()(CAST(LetExpr)(e)->name));
+    else if (CAST(FunExpr)(e) != nullptr)
+        h = combine(h, std::hash<std::string>()(CAST(FunExpr)(e)->formal_arg));
+    for (PTR(Expr) kid : children(e))
+        h = combine(h, structural_hash(kid, hashes));
+    hashes[&*e] = h;
+    return h;
+}
+
+// The variable a `_let` or `_fun` binds in its last child, or ""
+static std::string binder_of(PTR(Expr) e) {
+    if (CAST(LetExpr)(e) != nullptr)
+        return CAST(LetExpr)(e)->name;
+    if (CAST(FunExpr)(e) != nullptr)
+        return CAST(FunExpr)(e)->formal_arg;
+    return "";
+}
+
+// Adds the name of every variable written in `e` to `names`
+static void collect_names(PTR(Expr) e, std::set<std::string> &names) {
+    PTR(VarExpr) var = CAST(VarExpr)(e);
+    if (var != nullptr)
+        names.insert(var->name);
+    std::string binder = binder_of(e);
+    if (binder != "")
+        names.insert(binder);
+    for (PTR(Expr) kid : children(e))
+        collect_names(kid, names);
+}
+
+/* What `share_common` needs to know about subexpressions, worked out
+ for each node at most once (in one pass over the tree up front, or
+ the first time it is asked about one), so that the pass stays linear
+ however deeply the tree nests. A node is asked about where it is in
+ the tree, and it is never elsewhere with its variables bound
+ differently, so its answers do not depend on when it is asked. */
+class Sharing {
+public:
+    hashes_t hashes;
+    // How many times each hash appears in the whole tree
+    std::unordered_map<size_t, long> counts;
+    // Every variable name written in the whole tree
+    std::set<std::string> names;
+    // Candidates that were not worth sharing at an expression being
+    // worked on, nor anywhere within it (see `share_at`), latest last
+    std::unordered_set<Expr*> failed;
+    std::vector<Expr*> failed_order;
+    
+    // Counts the hashes in `e`, numbering the nodes in the order they
+    // are reached, and notes where each hash is
+    void count(PTR(Expr) e) {
+        size_t hash = structural_hash(e, hashes);
+        long number = reached++;
+        counts[hash]++;
+        places[hash].push_back(number);
+        bool first = spans.find(&*e) == spans.end();
+        for (PTR(Expr) kid : children(e))
+            count(kid);
+        // A node written in several places has the same parts in each
+        if (first)
+            spans[&*e] = std::make_pair(number, reached);
+    }
+    
+    // Whether `e` is worth computing once and appears more than once
+    bool repeated(PTR(Expr) e) {
+        auto found = counts.find(structural_hash(e, hashes));
+        return found != counts.end() && found->second >= 2 && e->cost() >= SHARE_COST;
+    }
+    
+    // Whether `e` might have a part with the hash `hash`: surely not
+    // if `e` was counted and none of its numbers is where `hash` is
+    bool may_contain(PTR(Expr) e, size_t hash) {
+        auto span = spans.find(&*e);
+        if (span == spans.end())
+            return true;
+        std::vector<long> &at = places[hash];
+        auto after = std::lower_bound(at.begin(), at.end(), span->second.first);
+        return after != at.end() && *after < span->second.second;
+    }
+    
+    // Whether `e` has a repeated part, itself included
+    bool has_repeated(PTR(Expr) e) {
+        auto found = with_repeats.find(&*e);
+        if (found != with_repeats.end())
+            return found->second;
+        bool result = repeated(e);
+        for (PTR(Expr) kid : children(e))
+            result = has_repeated(kid) || result;
+        with_repeats[&*e] = result;
+        return result;
+    }
+    
+    // `is_total` and `is_total_number`, remembered
+    bool total(PTR(Expr) e) {
+        auto found = totals.find(&*e);
+        if (found != totals.end())
+            return found->second;
+        bool result = false;
+        PTR(LetExpr) let = CAST(LetExpr)(e);
+        PTR(IfExpr) if_expr = CAST(IfExpr)(e);
+        PTR(EqualExpr) equal = CAST(EqualExpr)(e);
+        if (CAST(NumExpr)(e) != nullptr || CAST(BoolExpr)(e) != nullptr || CAST(FunExpr)(e) != nullptr)
+            result = true;
+        else if (CAST(VarExpr)(e) != nullptr)
+            result = find_binding(CAST(VarExpr)(e)->name) != nullptr;
+        else if (CAST(AddExpr)(e) != nullptr || CAST(MultExpr)(e) != nullptr)
+            result = total_number(e);
+        else if (equal != nullptr)
+            result = total(equal->lhs) && total(equal->rhs);
+        else if (if_expr != nullptr)
+            result = (CAST(EqualExpr)(if_expr->if_part) != nullptr && total(if_expr->if_part)
+                      && total(if_expr->then_part) && total(if_expr->else_part));
+        else if (let != nullptr && total(let->rhs)) {
+            InScope in_scope(let_binding(let, nullptr));
+            result = total(let->expr);
+        }
+        totals[&*e] = result;
+        return result;
+    }
+    
+    bool total_number(PTR(Expr) e) {
+        auto found = numbers.find(&*e);
+        if (found != numbers.end())
+            return found->second;
+        bool result = false;
+        PTR(AddExpr) add = CAST(AddExpr)(e);
+        PTR(MultExpr) mult = CAST(MultExpr)(e);
+        if (CAST(NumExpr)(e) != nullptr)
+            result = true;
+        else if (CAST(VarExpr)(e) != nullptr)
+            result = known_value(CAST(VarExpr)(e)->name) == unknown_number;
+        else if (add != nullptr)
+            result = total_number(add->lhs) && total_number(add->rhs);
+        else if (mult != nullptr)
+            result = total_number(mult->lhs) && total_number(mult->rhs);
+        numbers[&*e] = result;
+        return result;
+    }
+    
+    // What the body of `let` sees its variable bound to, as `is_total`
+    // has it
+    PTR(FoldBinding) let_binding(PTR(LetExpr) let, PTR(Env) env) {
+        return NEW(FoldBinding)(let->name, total_number(let->rhs) ? unknown_number : nullptr, env);
+    }
+    
+    // The first of the repeated subexpressions that evaluating `e`
+    // starts with (see `leading`), or nullptr
+    PTR(Expr) first_leading(PTR(Expr) e) {
+        auto found = firsts.find(&*e);
+        if (found != firsts.end())
+            return found->second;
+        std::vector<PTR(Expr)> kids = children(e);
+        PTR(Expr) first = nullptr;
+        if (CAST(AddExpr)(e) != nullptr || CAST(MultExpr)(e) != nullptr
+            || CAST(EqualExpr)(e) != nullptr || CAST(CallFunExpr)(e) != nullptr) {
+            first = repeated(kids[0]) ? kids[0] : first_leading(kids[0]);
+            if (first == nullptr && total(kids[0]))
+                first = repeated(kids[1]) ? kids[1] : first_leading(kids[1]);
+        } else if (CAST(LetExpr)(e) != nullptr || CAST(IfExpr)(e) != nullptr) {
+            first = repeated(kids[0]) ? kids[0] : first_leading(kids[0]);
+        }
+        firsts[&*e] = first;
+        return first;
+    }
+    
+    /* The repeated subexpressions that evaluating `e` starts with:
+     computing one of them first instead changes nothing, as whatever
+     `e` would do before it cannot fail. Parts with nothing repeated
+     are not looked into. */
+    void leading(PTR(Expr) e, std::vector<PTR(Expr)> &out) {
+        std::vector<PTR(Expr)> kids = children(e);
+        size_t parts = 0;
+        if (CAST(AddExpr)(e) != nullptr || CAST(MultExpr)(e) != nullptr
+            || CAST(EqualExpr)(e) != nullptr || CAST(CallFunExpr)(e) != nullptr)
+            parts = total(kids[0]) ? 2 : 1;
+        else if (CAST(LetExpr)(e) != nullptr || CAST(IfExpr)(e) != nullptr)
+            parts = 1;
+        for (size_t i = 0; i < parts; i++) {
+            if (repeated(kids[i]))
+                out.push_back(kids[i]);
+            if (has_repeated(kids[i]))
+                leading(kids[i], out);
+        }
+    }
+    
+    // A variable name written nowhere in the tree, nor bound around
+    // the current expression, so that nothing captures it
+    std::string fresh_name() {
+        for (long n = 0; ; n++) {
+            std::string name = "cse";
+            for (long k = n; k > 0; k = (k - 1) / 26)
+                name += (char)('a' + (k - 1) % 26);
+            if (names.count(name) == 0 && find_binding(name) == nullptr)
+                return name;
+        }
+    }
+    
+private:
+    long reached = 0;
+    // The numbers of the nodes with each hash, in order, and for each
+    // node the numbers of it and its parts, from its first place
+    std::unordered_map<size_t, std::vector<long>> places;
+    std::unordered_map<Expr*, std::pair<long, long>> spans;
+    std::unordered_map<Expr*, bool> with_repeats;
+    std::unordered_map<Expr*, bool> totals;
+    std::unordered_map<Expr*, bool> numbers;
+    std::unordered_map<Expr*, PTR(Expr)> firsts;
+};
+
+/* `e` with each `shared` in it replaced by `name`, except where some
+ variable `shared` uses (one of `shared_names`) is bound differently;
+ `uses` counts the replacements */
+static PTR(Expr) replace_shared(PTR(Expr) e, PTR(Expr) shared, size_t hash, const std::string &name,
+                                std::set<std::string> &shared_names, Sharing &sharing, long &uses) {
+    if (!sharing.may_contain(e, hash))
+        return e;
+    if (structural_hash(e, sharing.hashes) == hash && e->equals(shared)) {
+        uses++;
+        return NEW(VarExpr)(name);
+    }
+    std::string binder = binder_of(e);
+    std::vector<PTR(Expr)> kids = children(e);
+    bool changed = false;
+    for (size_t i = 0; i < kids.size(); i++) {
+        if (binder != "" && i == kids.size() - 1 && shared_names.count(binder) != 0)
+            continue;
+        PTR(Expr) kid = replace_shared(kids[i], shared, hash, name, shared_names, sharing, uses);
+        changed = changed || kid != kids[i];
+        kids[i] = kid;
+    }
+    return changed ? with_children(e, kids) : e;
+}
+
+// Binds `shared` around `e` if `e` has it twice, or else returns
+// nullptr and marks it as failed
+static PTR(Expr) share_one(PTR(Expr) e, PTR(Expr) shared, PTR(Env) env, Sharing &sharing);
+
+/* Binds a subexpression that `e` computes more than once with a
+ `_let` around `e`, and repeats for the rest. Only one that `e`
+ starts by computing is taken, so that the `_let` runs it no
+ earlier than `e` did; the other copies are anywhere below. One
+ that is not worth it here is not worth it anywhere in `e` either,
+ since the binders between them leave the copies as they were. */
+static PTR(Expr) share_at(PTR(Expr) e, PTR(Env) env, Sharing &sharing) {
+    PTR(Expr) first = sharing.first_leading(e);
+    if (first == nullptr)
+        return e;
+    if (sharing.failed.count(&*first) == 0) {
+        PTR(Expr) shared = share_one(e, first, env, sharing);
+        if (shared != nullptr)
+            return shared;
+    }
+    std::vector<PTR(Expr)> candidates;
+    sharing.leading(e, candidates);
+    for (PTR(Expr) candidate : candidates) {
+        if (sharing.failed.count(&*candidate) != 0)
+            continue;
+        PTR(Expr) shared = share_one(e, candidate, env, sharing);
+        if (shared != nullptr)
+            return shared;
+    }
+    return e;
+}
+
+static PTR(Expr) share_one(PTR(Expr) e, PTR(Expr) shared, PTR(Env) env, Sharing &sharing) {
+    size_t hash = structural_hash(shared, sharing.hashes);
+    std::set<std::string> shared_names;
+    collect_names(shared, shared_names);
+    std::string name = sharing.fresh_name();
+    long uses = 0;
+    PTR(Expr) body = replace_shared(e, shared, hash, name, shared_names, sharing, uses);
+    if (uses < 2) {
+        sharing.failed.insert(&*shared);
+        sharing.failed_order.push_back(&*shared);
+        return nullptr;
+    }
+    PTR(FoldBinding) binding = NEW(FoldBinding)(name, nullptr, env);
+    InScope in_scope(binding);
+    return NEW(LetExpr)(name, shared, share_at(body, binding, sharing));
+}
+
+// Shares the common subexpressions of `e` itself, then within
+// each of its parts, so that a copy is bound as far out as it can be
+static PTR(Expr) share_from(PTR(Expr) e, PTR(Env) env, Sharing &sharing) {
+    size_t failed_before = sharing.failed_order.size();
+    e = share_at(e, env, sharing);
+    std::string binder = binder_of(e);
+    std::vector<PTR(Expr)> kids = children(e);
+    bool changed = false;
+    for (size_t i = 0; i < kids.size(); i++) {
+        PTR(Expr) kid;
+        if (binder != "" && i == kids.size() - 1) {
+            PTR(LetExpr) let = CAST(LetExpr)(e);
+            PTR(FoldBinding) binding = (let != nullptr ? sharing.let_binding(let, env)
+                                        : NEW(FoldBinding)(binder, nullptr, env));
+            InScope in_scope(binding);
+            kid = share_from(kids[i], binding, sharing);
+        } else {
+            kid = share_from(kids[i], env, sharing);
+        }
+        changed = changed || kid != kids[i];
+        kids[i] = kid;
+    }
+    // What failed here may be worth it outside `e`
+    while (sharing.failed_order.size() > failed_before) {
+        sharing.failed.erase(sharing.failed_order.back());
+        sharing.failed_order.pop_back();
+    }
+    return changed ? with_children(e, kids) : e;
+}
+
+/* Common-subexpression elimination, after `fold`: each subexpression
+ worth at least `SHARE_COST` and written twice is computed once,
+ from the outermost expression that starts by computing it. Structural
+ hashes and where they are (counted over the whole tree up front) rule
+ out most candidates, and the parts without a copy, without walking
+ the tree again. */
+static PTR(Expr) share_common(PTR(Expr) e) {
+    Sharing sharing;
+    sharing.count(e);
+    collect_names(e, sharing.names);
+    return share_from(e, Env::emptyenv, sharing);
+}
+
+size_t Expr::tree_hash() {
+    hashes_t hashes;
+    return structural_hash(THIS, hashes);
+}
+
+void Expr::free_variables(std::set<std::string> &names) {
+    PTR(VarExpr) var = CAST(VarExpr)(THIS);
+    if (var != nullptr) {
+        names.insert(var->name);
+        return;
+    }
+    std::string binder = binder_of(THIS);
+    std::vector<PTR(Expr)> kids = children(THIS);
+    for (size_t i = 0; i < kids.size(); i++) {
+        if (binder != "" && i == kids.size() - 1) {
+            // Free in the scope of `binder`, less `binder` itself
+            std::set<std::string> inner;
+            kids[i]->free_variables(inner);
+            inner.erase(binder);
+            names.insert(inner.begin(), inner.end());
+        } else
+            kids[i]->free_variables(names);
+    }
+}
+
+long Expr::cost() {
+    if (cost_estimate < 0)
+        cost_estimate = compute_cost();
+    return cost_estimate;
+}
+
+PTR(Expr) Expr::subst(std::string var, PTR(Val) val) {
+    return subst_expr(var, val->to_expr());
+}
+
+// The bit that stands for `name` in `compute_free_vars`
+static unsigned long long var_bit(const std::string &name) {
+    return 1ULL << (std::hash<std::string>()(name) % 64);
+}
+
+unsigned long long Expr::free_var_bits() {
+    if (!free_vars_known) {
+        free_vars = compute_free_vars();
+        free_vars_known = true;
+    }
+    return free_vars;
+}
+
+bool Expr::may_have_free(const std::string &name) {
+    return (free_var_bits() & var_bit(name)) != 0;
+}
+
+/* Substitutes `replacement` for `var` in `body`, where `body` is in
+ the scope of `name` (bound by a `_let` or `_fun`). If that would
+ capture a variable of `replacement`, `name` is first renamed, in
+ place, to one neither of them uses. */
+static PTR(Expr) subst_under(std::string &name, PTR(Expr) body, const std::string &var, PTR(Expr) replacement) {
+    if (name == var || !body->may_have_free(var))
+        return body;
+    if (replacement->may_have_free(name)) {
+        // With enough variables every signature bit is set, so the
+        // new name is checked against the exact free variables
+        std::set<std::string> used;
+        replacement->free_variables(used);
+        if (used.count(name) != 0) {
+            body->free_variables(used);
+            std::string fresh = name;
+            while (used.count(fresh) != 0)
+                fresh += "a";
+            body = body->subst_expr(name, NEW(VarExpr)(fresh));
+            name = fresh;
+        }
+    }
+    return body->subst_expr(var, replacement);
+}
 
 //NumExpr part
-NumExpr::NumExpr(int num) {
+NumExpr::NumExpr(long long num) {
   this->num = num;
+  this->big = nullptr;
+  COUNT_ALLOC(NumExpr);
+}
+
+NumExpr::NumExpr(const BigNum &n) {
+  if (n.fits()) {
+    this->num = n.to_long();
+    this->big = nullptr;
+  } else {
+    this->num = 0;
+    this->big = NEW(BigNum)(n);
+  }
+  COUNT_ALLOC(NumExpr);
 }
 
 bool NumExpr::equals(PTR(Expr) e) {
   PTR(NumExpr) n = CAST(NumExpr)(e);
   if (n==NULL)
     return false;
+  else if (big == nullptr || n->big == nullptr)
+    return big == n->big && num == n->num;
   else
-    return num == n->num;
+    return big->equals(*n->big);
+}
+
+// The number as a value
+static PTR(Val) num_value(PTR(NumExpr) e) {
+    if (e->big != nullptr)
+        return NEW(NumVal)(*e->big);
+    return NEW(NumVal)(e->num);
 }
 
 PTR(Val) NumExpr::to_value(PTR(Env) env) {
-    return NEW(NumVal)(num);
+    if (big == nullptr)
+        return NEW(NumVal)(num);
+    return num_value(THIS);
 }
 
-PTR(Expr) NumExpr::subst(std::string var, PTR(Val) new_val) {
-    return NEW(NumExpr)(num);
+PTR(Expr) NumExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    return THIS;
 }
 
 bool NumExpr::containsVariables(){
     return false;
 }
 
-PTR(Expr) NumExpr::optimize() {
+PTR(Expr) NumExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    val = num_value(THIS);
     return THIS;
 }
 
 void NumExpr::step_interp() {
     Step::mode = Step::continue_mode;
-    Step::val = NEW(NumVal)(num);
+    Step::val = num_value(THIS);
     Step::cont = Step::cont; /* no-op */
 }
 
 std::string NumExpr::to_string() {
+    if (big != nullptr)
+        return big->to_string();
     return std::to_string(num);
 }
 
+void NumExpr::serialize(ImageWriter &out) {
+    if (big != nullptr) {
+        out.tag(ImageWriter::BIG_NUM);
+        out.big(*big);
+        return;
+    }
+    out.tag(ImageWriter::NUM);
+    out.num(num);
+}
+
+long NumExpr::compute_cost() {
+    return 1;
+}
+
+unsigned long long NumExpr::compute_free_vars() {
+    return 0;
+}
+
 //AddExpr part
 //
 //
 AddExpr::AddExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
   this->lhs = lhs;
   this->rhs = rhs;
+  COUNT_ALLOC(AddExpr);
 }
 
 bool AddExpr::equals(PTR(Expr) e) {
@@ -71,39 +1216,66 @@ bool AddExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) AddExpr::to_value(PTR(Env) env) {
-    return lhs->to_value(env)->add_to(rhs->to_value(env));
+    PTR(Val) lhs_val;
+    PTR(Val) rhs_val;
+    if (Parallel::enabled) {
+        Parallel::to_values(lhs, rhs, env, lhs_val, rhs_val);
+    } else {
+        lhs_val = lhs->to_value(env);
+        rhs_val = rhs->to_value(env);
+    }
+    if (well_typed)
+        return NumVal::add(STATIC_CAST(NumVal)(lhs_val), STATIC_CAST(NumVal)(rhs_val));
+    try {
+        return lhs_val->add_to(rhs_val);
+    } catch (std::runtime_error &) {
+        SourceMap::blame(THIS);
+    }
 }
 
-PTR(Expr) AddExpr::subst(std::string var, PTR(Val) new_val) {
-    return NEW(AddExpr)(lhs->subst(var, new_val), rhs->subst(var, new_val));
+PTR(Expr) AddExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_lhs = lhs->subst_expr(var, replacement);
+    PTR(Expr) new_rhs = rhs->subst_expr(var, replacement);
+    if (new_lhs == lhs && new_rhs == rhs)
+        return THIS;
+    return NEW(AddExpr)(new_lhs, new_rhs);
 }
 
 bool AddExpr::containsVariables(){
     return lhs->containsVariables() || rhs->containsVariables();
 }
 
-PTR(Expr) AddExpr::optimize() {
-    PTR(Expr) lhs_optimized = lhs->optimize();
-    PTR(Expr) rhs_optimized = rhs->optimize();
-    
-    if (!lhs_optimized->containsVariables() && !rhs_optimized->containsVariables()) {
-        PTR(Env) empty_env = NEW(EmptyEnv)();
-        PTR(Val) new_val = lhs_optimized->to_value(empty_env)->add_to(rhs_optimized->to_value(empty_env));
-        return new_val->to_expr();
-    }
-    return NEW(AddExpr)(lhs_optimized, rhs_optimized);
+PTR(Expr) AddExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    return fold_chain(THIS, false, env, val);
 }
 
 void AddExpr::step_interp() {
     Step::mode = Step::interp_mode;
     Step::expr = lhs;
     Step::cont = NEW(RightThenAddCont)(rhs, Step::env, Step::cont);
+    Step::cont->origin = THIS;
 }
 
 std::string AddExpr::to_string() {
     return "(" + lhs->to_string() + " + " + rhs->to_string() + ")";
 }
 
+void AddExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::ADD);
+    lhs->serialize(out);
+    rhs->serialize(out);
+}
+
+long AddExpr::compute_cost() {
+    return 1 + lhs->cost() + rhs->cost();
+}
+
+unsigned long long AddExpr::compute_free_vars() {
+    return lhs->free_var_bits() | rhs->free_var_bits();
+}
+
 //MultExpr part
 //
 //
@@ -111,6 +1283,7 @@ std::string AddExpr::to_string() {
 MultExpr::MultExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
   this->lhs = lhs;
   this->rhs = rhs;
+  COUNT_ALLOC(MultExpr);
 }
 
 bool MultExpr::equals(PTR(Expr) e) {
@@ -122,39 +1295,66 @@ bool MultExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) MultExpr::to_value(PTR(Env) env) {
-    return lhs->to_value(env)->mult_with(rhs->to_value(env));
+    PTR(Val) lhs_val;
+    PTR(Val) rhs_val;
+    if (Parallel::enabled) {
+        Parallel::to_values(lhs, rhs, env, lhs_val, rhs_val);
+    } else {
+        lhs_val = lhs->to_value(env);
+        rhs_val = rhs->to_value(env);
+    }
+    if (well_typed)
+        return NumVal::mult(STATIC_CAST(NumVal)(lhs_val), STATIC_CAST(NumVal)(rhs_val));
+    try {
+        return lhs_val->mult_with(rhs_val);
+    } catch (std::runtime_error &) {
+        SourceMap::blame(THIS);
+    }
 }
 
-PTR(Expr) MultExpr::subst(std::string var, PTR(Val) new_val){
-    return NEW(MultExpr)(lhs->subst(var, new_val), rhs->subst(var, new_val));
+PTR(Expr) MultExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_lhs = lhs->subst_expr(var, replacement);
+    PTR(Expr) new_rhs = rhs->subst_expr(var, replacement);
+    if (new_lhs == lhs && new_rhs == rhs)
+        return THIS;
+    return NEW(MultExpr)(new_lhs, new_rhs);
 }
 
 bool MultExpr::containsVariables(){
     return lhs->containsVariables() || rhs->containsVariables();
 }
 
-PTR(Expr) MultExpr::optimize() {
-    PTR(Expr) lhs_optimized = this->lhs->optimize();
-    PTR(Expr) rhs_optimized = this->rhs->optimize();
-    
-    if (!lhs_optimized->containsVariables() && !rhs_optimized->containsVariables()) {
-        PTR(Env) empty_env = NEW(EmptyEnv)();
-        PTR(Val) new_val = lhs_optimized->to_value(empty_env)->mult_with(rhs_optimized->to_value(empty_env));
-        return new_val->to_expr();
-    }
-    return NEW(MultExpr)(lhs_optimized, rhs_optimized);
+PTR(Expr) MultExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    return fold_chain(THIS, true, env, val);
 }
 
 void MultExpr::step_interp() {
     Step::mode = Step::interp_mode;
     Step::expr = lhs;
     Step::cont = NEW(RightThenMultCont)(rhs, Step::env, Step::cont);
+    Step::cont->origin = THIS;
 }
 
 std::string MultExpr::to_string() {
     return "(" + lhs->to_string() + " * " + rhs->to_string() + ")";
 }
 
+void MultExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::MULT);
+    lhs->serialize(out);
+    rhs->serialize(out);
+}
+
+long MultExpr::compute_cost() {
+    return 1 + lhs->cost() + rhs->cost();
+}
+
+unsigned long long MultExpr::compute_free_vars() {
+    return lhs->free_var_bits() | rhs->free_var_bits();
+}
+
 
 
 // VarExpr part
@@ -163,6 +1363,7 @@ std::string MultExpr::to_string() {
 //
 VarExpr::VarExpr(std::string name) {
   this->name = name;
+  COUNT_ALLOC(VarExpr);
 }
 
 bool VarExpr::equals(PTR(Expr) e) {
@@ -174,22 +1375,38 @@ bool VarExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) VarExpr::to_value(PTR(Env) env) {
-    return env->lookup(name);
+    try {
+        return env->lookup(name);
+    } catch (std::runtime_error &) {
+        SourceMap::blame(THIS);
+    }
 }
 
-PTR(Expr) VarExpr::subst(std::string var, PTR(Val) new_val) {
+PTR(Expr) VarExpr::subst_expr(std::string var, PTR(Expr) replacement) {
     if (name == var)
-        return new_val->to_expr();
+        return replacement;
     else
-        return NEW(VarExpr)(name); // or `return THIS`
+        return THIS;
 }
 
 bool VarExpr::containsVariables(){
     return true;
 }
 
-PTR(Expr) VarExpr::optimize() {
-    return NEW(VarExpr)(name);
+PTR(Expr) VarExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    val = known_value(name);
+    if (val == unknown_number || CAST(FunVal)(val) != nullptr)
+        val = nullptr;
+    if (val != nullptr)
+        return val->to_expr();
+    PTR(FoldBinding) binding = find_binding(name);
+    if (binding != nullptr) {
+        PTR(Expr) replaced = replace_use(binding);
+        if (replaced != nullptr)
+            return replaced;
+        binding->uses++;
+    }
+    return THIS;
 }
 
 void VarExpr::step_interp() {
@@ -202,12 +1419,26 @@ std::string VarExpr::to_string() {
     return name;
 }
 
+void VarExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::VAR);
+    out.name(name);
+}
+
+long VarExpr::compute_cost() {
+    return 1;
+}
+
+unsigned long long VarExpr::compute_free_vars() {
+    return var_bit(name);
+}
+
 
 //BoolExpr part
 //
 //
 BoolExpr::BoolExpr(bool rep) {
   this->rep = rep;
+  COUNT_ALLOC(BoolExpr);
 }
 
 bool BoolExpr::equals(PTR(Expr) e) {
@@ -222,16 +1453,17 @@ PTR(Val) BoolExpr::to_value(PTR(Env) env) {
     return NEW(BoolVal)(rep);
 }
 
-PTR(Expr) BoolExpr::subst(std::string var, PTR(Val) new_val) {
-    return NEW(BoolExpr)(rep);
+PTR(Expr) BoolExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    return THIS;
 }
 
 bool BoolExpr::containsVariables(){
     return false;
 }
 
-PTR(Expr) BoolExpr::optimize() {
-    return NEW(BoolExpr)(rep);
+PTR(Expr) BoolExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    val = NEW(BoolVal)(rep);
+    return THIS;
 }
 
 void BoolExpr::step_interp() {
@@ -247,6 +1479,18 @@ std::string BoolExpr::to_string() {
         return "_false";
 }
 
+void BoolExpr::serialize(ImageWriter &out) {
+    out.tag(rep ? ImageWriter::TRUE_BOOL : ImageWriter::FALSE_BOOL);
+}
+
+long BoolExpr::compute_cost() {
+    return 1;
+}
+
+unsigned long long BoolExpr::compute_free_vars() {
+    return 0;
+}
+
 
 // LetExpr part
 //
@@ -255,6 +1499,7 @@ LetExpr::LetExpr(std::string name, PTR(Expr) rhs, PTR(Expr) expr){
     this->name = name;
     this->rhs=rhs;
     this->expr=expr;
+    COUNT_ALLOC(LetExpr);
 }
 
 bool LetExpr::equals(PTR(Expr) e){
@@ -273,11 +1518,15 @@ PTR(Val) LetExpr::to_value(PTR(Env) env) {
     return expr->to_value(new_env);
 }
 
-PTR(Expr) LetExpr::subst(std::string var, PTR(Val) val) {
-    if (var == name) {
-        return NEW(LetExpr)(var, rhs, expr);
-    }
-    return NEW(LetExpr)(name, rhs->subst(var, val), expr->subst(var, val));
+PTR(Expr) LetExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_rhs = rhs->subst_expr(var, replacement);
+    std::string new_name = name;
+    PTR(Expr) new_expr = subst_under(new_name, expr, var, replacement);
+    if (new_rhs == rhs && new_expr == expr)
+        return THIS;
+    return NEW(LetExpr)(new_name, new_rhs, new_expr);
 }
 
 bool LetExpr::containsVariables(){
@@ -285,15 +1534,18 @@ bool LetExpr::containsVariables(){
         return rhs->containsVariables() || expr->subst(name, rhs->to_value(empty_env))->containsVariables();
     }
 
-PTR(Expr) LetExpr::optimize() {
-    PTR(Expr) rhs_optimized = rhs->optimize();
-    PTR(Expr) expr_optimized = expr->optimize();
-    
-    if (!rhs_optimized->containsVariables()) {
-        PTR(Env) empty_env = NEW(EmptyEnv)();
-        return expr_optimized->subst(name, rhs_optimized->to_value(empty_env))->optimize();
+PTR(Expr) LetExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    PTR(Val) rhs_val;
+    PTR(Expr) rhs_folded = rhs->fold(env, rhs_val);
+    PTR(FoldBinding) binding = NEW(FoldBinding)(name, binding_for(rhs_folded, rhs_val, env), env);
+    auto counted = occurrences.find(&*THIS);
+    prepare_binding(binding, rhs_folded, rhs_val, counted != occurrences.end() ? counted->second : -1);
+    PTR(Expr) expr_folded;
+    {
+        InScope in_scope(binding);
+        expr_folded = expr->fold(binding, val);
     }
-    return NEW(LetExpr)(name, rhs_optimized, expr_optimized);
+    return finish_let(name, rhs_folded, rhs_val, binding, expr_folded, val, THIS);
 }
 
 void LetExpr::step_interp() {
@@ -306,6 +1558,23 @@ std::string LetExpr::to_string() {
     return "(_let " + name + " = " + rhs->to_string() + " _in " + expr->to_string() + ")";
 }
 
+void LetExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::LET);
+    out.name(name);
+    rhs->serialize(out);
+    expr->serialize(out);
+}
+
+long LetExpr::compute_cost() {
+    return 1 + rhs->cost() + expr->cost();
+}
+
+unsigned long long LetExpr::compute_free_vars() {
+    // `name` is not free in `expr`, but its bit may stand for another
+    // variable too, so it stays
+    return rhs->free_var_bits() | expr->free_var_bits();
+}
+
 
 //
 //EqualExpr part
@@ -313,6 +1582,7 @@ std::string LetExpr::to_string() {
 EqualExpr::EqualExpr(PTR(Expr) lhs, PTR(Expr) rhs){
     this->lhs=lhs;
     this->rhs=rhs;
+    COUNT_ALLOC(EqualExpr);
 }
 
 bool EqualExpr::equals(PTR(Expr) e){
@@ -323,8 +1593,14 @@ bool EqualExpr::equals(PTR(Expr) e){
 }
 
 PTR(Val) EqualExpr::to_value(PTR(Env) env) {
-    PTR(Val) lhs_value = lhs->to_value(env);
-    PTR(Val) rhs_value = rhs->to_value(env);
+    PTR(Val) lhs_value;
+    PTR(Val) rhs_value;
+    if (Parallel::enabled) {
+        Parallel::to_values(lhs, rhs, env, lhs_value, rhs_value);
+    } else {
+        lhs_value = lhs->to_value(env);
+        rhs_value = rhs->to_value(env);
+    }
     
     if (lhs_value->equals(rhs_value))
         return NEW(BoolVal)(true);
@@ -332,22 +1608,34 @@ PTR(Val) EqualExpr::to_value(PTR(Env) env) {
         return NEW(BoolVal)(false);
 }
 
-PTR(Expr) EqualExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(EqualExpr)(lhs->subst(var, val), rhs->subst(var, val));
+PTR(Expr) EqualExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_lhs = lhs->subst_expr(var, replacement);
+    PTR(Expr) new_rhs = rhs->subst_expr(var, replacement);
+    if (new_lhs == lhs && new_rhs == rhs)
+        return THIS;
+    return NEW(EqualExpr)(new_lhs, new_rhs);
 }
 
 bool EqualExpr::containsVariables(){
     return lhs->containsVariables() || rhs->containsVariables();
 }
 
-PTR(Expr) EqualExpr::optimize() {
-    PTR(Expr) lhs_optimized = lhs->optimize();
-    PTR(Expr) rhs_optimized = rhs->optimize();
+PTR(Expr) EqualExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    PTR(Val) lhs_val;
+    PTR(Val) rhs_val;
+    PTR(Expr) lhs_folded = lhs->fold(env, lhs_val);
+    PTR(Expr) rhs_folded = rhs->fold(env, rhs_val);
     
-    if (!lhs_optimized->containsVariables() && !rhs_optimized->containsVariables())
-        return NEW(BoolExpr)(lhs_optimized->equals(rhs_optimized));
-    else
-        return NEW(EqualExpr)(lhs_optimized, rhs_optimized);
+    if (lhs_val != nullptr && rhs_val != nullptr) {
+        val = NEW(BoolVal)(lhs_val->equals(rhs_val));
+        return val->to_expr();
+    }
+    val = nullptr;
+    if (lhs_folded == lhs && rhs_folded == rhs)
+        return THIS;
+    return NEW(EqualExpr)(lhs_folded, rhs_folded);
 }
 
 void EqualExpr::step_interp() {
@@ -360,6 +1648,20 @@ std::string EqualExpr::to_string() {
     return "(" + lhs->to_string() + " == " + rhs->to_string() + ")";
 }
 
+void EqualExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::EQUAL);
+    lhs->serialize(out);
+    rhs->serialize(out);
+}
+
+long EqualExpr::compute_cost() {
+    return 1 + lhs->cost() + rhs->cost();
+}
+
+unsigned long long EqualExpr::compute_free_vars() {
+    return lhs->free_var_bits() | rhs->free_var_bits();
+}
+
 
 
 //
@@ -369,6 +1671,7 @@ IfExpr::IfExpr(PTR(Expr) if_part, PTR(Expr) then_part, PTR(Expr) else_part){
     this->if_part = if_part;
     this->then_part = then_part;
     this->else_part = else_part;
+    COUNT_ALLOC(IfExpr);
 }
 
 bool IfExpr::equals(PTR(Expr) e){
@@ -382,15 +1685,26 @@ bool IfExpr::equals(PTR(Expr) e){
 PTR(Val) IfExpr::to_value(PTR(Env) env) {
     PTR(Val) if_value= if_part->to_value(env);
     
-    if (if_value->equals(NEW(BoolVal)(true))) {
+    PTR(BoolVal) test = (well_typed ? STATIC_CAST(BoolVal)(if_value) : CAST(BoolVal)(if_value));
+    // As in the stepper (see `IfBranchCont`)
+    if (test == nullptr)
+        throw ScriptError("if part doesn't evaluate to a bool val!", THIS);
+    if (test->rep) {
         return then_part->to_value(env);
     } else {
         return else_part->to_value(env);
     }
 }
 
-PTR(Expr) IfExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(IfExpr)(if_part->subst(var, val), then_part->subst(var, val), else_part->subst(var, val));
+PTR(Expr) IfExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_if = if_part->subst_expr(var, replacement);
+    PTR(Expr) new_then = then_part->subst_expr(var, replacement);
+    PTR(Expr) new_else = else_part->subst_expr(var, replacement);
+    if (new_if == if_part && new_then == then_part && new_else == else_part)
+        return THIS;
+    return NEW(IfExpr)(new_if, new_then, new_else);
 }
 
 bool IfExpr::containsVariables() {
@@ -406,22 +1720,49 @@ bool IfExpr::containsVariables() {
         return else_part->containsVariables();
 }
 
-PTR(Expr) IfExpr::optimize() {
-    PTR(Expr) if_part_optimized = if_part->optimize();
+PTR(Expr) IfExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    PTR(FoldBinding) around = CAST(FoldBinding)(env);
+    long before = around != nullptr ? around->uses : 0;
+    PTR(Val) if_val;
+    PTR(Expr) if_part_folded = if_part->fold(env, if_val);
     
-    if (if_part_optimized->equals(NEW(BoolExpr)(true))) {
-        return then_part->optimize();
-    } else if (if_part_optimized->equals(NEW(BoolExpr)(false))){
-        return else_part->optimize();
-    } else {
-        return NEW(IfExpr)(if_part_optimized, then_part->optimize(), else_part->optimize());
+    PTR(BoolVal) test = CAST(BoolVal)(if_val);
+    if (test != nullptr) {
+        // Unless `count_occurrences` already left it out
+        std::unordered_map<std::string, int> bound;
+        if (CAST(BoolExpr)(if_part) == nullptr)
+            take_back_uses(test->rep ? else_part : then_part, false, bound);
+        return (test->rep ? then_part : else_part)->fold(env, val);
+    }
+    
+    // How many uses of the innermost binding each part has, so that
+    // a `_let` right around this can tell which parts use it
+    long uses[3];
+    uses[0] = around != nullptr ? around->uses : 0;
+    PTR(Val) branch_val;
+    PTR(Expr) then_part_folded = then_part->fold(env, branch_val);
+    uses[1] = around != nullptr ? around->uses : 0;
+    PTR(Expr) else_part_folded = else_part->fold(env, branch_val);
+    uses[2] = around != nullptr ? around->uses : 0;
+    val = nullptr;
+    PTR(Expr) result = THIS;
+    if (if_part_folded != if_part || then_part_folded != then_part
+        || else_part_folded != else_part)
+        result = NEW(IfExpr)(if_part_folded, then_part_folded, else_part_folded);
+    if (around != nullptr) {
+        around->split = result;
+        around->part_uses[0] = uses[0] - before;
+        around->part_uses[1] = uses[1] - uses[0];
+        around->part_uses[2] = uses[2] - uses[1];
     }
+    return result;
 }
 
 void IfExpr::step_interp() {
     Step::mode = Step::interp_mode;
     Step::expr = if_part;
     Step::cont = NEW(IfBranchCont)(then_part, else_part, Step::env, Step::cont);
+    Step::cont->origin = THIS;
 }
 
 std::string IfExpr::to_string() {
@@ -430,6 +1771,21 @@ std::string IfExpr::to_string() {
     + " _else " + else_part->to_string() + ")";
 }
 
+void IfExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::IF);
+    if_part->serialize(out);
+    then_part->serialize(out);
+    else_part->serialize(out);
+}
+
+long IfExpr::compute_cost() {
+    return 1 + if_part->cost() + std::max(then_part->cost(), else_part->cost());
+}
+
+unsigned long long IfExpr::compute_free_vars() {
+    return if_part->free_var_bits() | then_part->free_var_bits() | else_part->free_var_bits();
+}
+
 
 //funExpr part
 //
@@ -437,6 +1793,15 @@ std::string IfExpr::to_string() {
 FunExpr::FunExpr(std::string formal_arg, PTR(Expr) body) {
     this->formal_arg = formal_arg;
     this->body = body;
+    this->label = "_fun";
+    COUNT_ALLOC(FunExpr);
+}
+
+FunExpr::FunExpr(std::string formal_arg, PTR(Expr) body, std::string label) {
+    this->formal_arg = formal_arg;
+    this->body = body;
+    this->label = label;
+    COUNT_ALLOC(FunExpr);
 }
 
 bool FunExpr::equals(PTR(Expr) e) {
@@ -449,33 +1814,63 @@ bool FunExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) FunExpr::to_value(PTR(Env) env) {
-    return NEW(FunVal)(formal_arg, body, env);
+    return NEW(FunVal)(formal_arg, body, env, label);
 }
 
-PTR(Expr) FunExpr::subst(std::string var, PTR(Val) val) {
-    if (var == formal_arg)
-        return NEW(FunExpr)(formal_arg, body);
-    else
-        return NEW(FunExpr)(formal_arg, body->subst(var, val));
+PTR(Expr) FunExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    std::string new_formal_arg = formal_arg;
+    PTR(Expr) new_body = subst_under(new_formal_arg, body, var, replacement);
+    if (new_body == body)
+        return THIS;
+    return NEW(FunExpr)(new_formal_arg, new_body, label);
 }
 
 bool FunExpr::containsVariables() {
         return body->subst(formal_arg, NEW(NumVal)(0))->containsVariables();
 }
 
-PTR(Expr) FunExpr::optimize() {
-    return NEW(FunExpr)(formal_arg, body->optimize());
+PTR(Expr) FunExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    PTR(Val) body_val;
+    PTR(FoldBinding) binding = NEW(FoldBinding)(formal_arg, nullptr, env);
+    PTR(Expr) body_folded;
+    fun_depth++;
+    {
+        InScope in_scope(binding);
+        body_folded = body->fold(binding, body_val);
+    }
+    fun_depth--;
+    val = nullptr;
+    if (body_folded == body)
+        return THIS;
+    return NEW(FunExpr)(formal_arg, body_folded, label);
 }
 
 void FunExpr::step_interp() {
     Step::mode = Step::continue_mode;
-    Step::val = NEW(FunVal)(formal_arg, body, Step::env);
+    Step::val = NEW(FunVal)(formal_arg, body, Step::env, label);
 }
 
 std::string FunExpr::to_string() {
     return "(_fun(" + formal_arg + ") " + body->to_string() + ")";
 }
 
+void FunExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::FUN);
+    out.name(formal_arg);
+    out.name(label);
+    body->serialize(out);
+}
+
+long FunExpr::compute_cost() {
+    // The body only runs when the function is called
+    body->cost();
+    return 1;
+}
+
+unsigned long long FunExpr::compute_free_vars() {
+    return body->free_var_bits();
+}
+
 
 //callExpr part
 //
@@ -483,6 +1878,7 @@ std::string FunExpr::to_string() {
 CallFunExpr::CallFunExpr(PTR(Expr) to_be_called, PTR(Expr) actual_arg) {
     this->to_be_called = to_be_called;
     this->actual_arg = actual_arg;
+    COUNT_ALLOC(CallFunExpr);
 }
 
 bool CallFunExpr::equals(PTR(Expr) e) {
@@ -494,31 +1890,82 @@ bool CallFunExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) CallFunExpr::to_value(PTR(Env) env) {
-    return to_be_called->to_value(env)->call(actual_arg->to_value(env));
+    PTR(Val) to_be_called_val;
+    PTR(Val) actual_arg_val;
+    if (Parallel::enabled) {
+        Parallel::to_values(to_be_called, actual_arg, env, to_be_called_val, actual_arg_val);
+    } else {
+        to_be_called_val = to_be_called->to_value(env);
+        actual_arg_val = actual_arg->to_value(env);
+    }
+    if (well_typed)
+        return STATIC_CAST(FunVal)(to_be_called_val)->FunVal::call(actual_arg_val);
+    // Errors in the body have been blamed on a node there already
+    try {
+        return to_be_called_val->call(actual_arg_val);
+    } catch (std::runtime_error &) {
+        SourceMap::blame(THIS);
+    }
 }
 
-PTR(Expr) CallFunExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(CallFunExpr)(to_be_called->subst(var, val), actual_arg->subst(var, val));
+PTR(Expr) CallFunExpr::subst_expr(std::string var, PTR(Expr) replacement) {
+    if (!may_have_free(var))
+        return THIS;
+    PTR(Expr) new_to_be_called = to_be_called->subst_expr(var, replacement);
+    PTR(Expr) new_actual_arg = actual_arg->subst_expr(var, replacement);
+    if (new_to_be_called == to_be_called && new_actual_arg == actual_arg)
+        return THIS;
+    return NEW(CallFunExpr)(new_to_be_called, new_actual_arg);
 }
 
 bool CallFunExpr::containsVariables() {
     return actual_arg->containsVariables() || to_be_called->containsVariables();
 }
 
-PTR(Expr) CallFunExpr::optimize() {
-    return NEW(CallFunExpr)(to_be_called->optimize(), actual_arg->optimize());
+PTR(Expr) CallFunExpr::fold(PTR(Env) env, PTR(Val) &val) {
+    bool callee = folding_callee;
+    folding_callee = CAST(CallFunExpr)(to_be_called) != nullptr;
+    PTR(Val) to_be_called_val;
+    PTR(Val) arg_val;
+    PTR(Expr) to_be_called_folded = to_be_called->fold(env, to_be_called_val);
+    folding_callee = false;
+    PTR(Expr) actual_arg_folded = actual_arg->fold(env, arg_val);
+    
+    PTR(Expr) inlined = inline_call(to_be_called_folded, actual_arg_folded, arg_val, env, val, callee);
+    if (inlined != nullptr)
+        return inlined;
+    val = nullptr;
+    if (to_be_called_folded == to_be_called && actual_arg_folded == actual_arg)
+        return THIS;
+    return NEW(CallFunExpr)(to_be_called_folded, actual_arg_folded);
 }
 
 void CallFunExpr::step_interp() {
     Step::mode = Step::interp_mode;
     Step::expr = to_be_called;
     Step::cont = NEW(ArgThenCallCont)(actual_arg, Step::env, Step::cont);
+    Step::cont->origin = THIS;
 }
 
 std::string CallFunExpr::to_string() {
     return to_be_called->to_string() + "(" + actual_arg->to_string() + ")";
 }
 
+void CallFunExpr::serialize(ImageWriter &out) {
+    out.tag(ImageWriter::CALL);
+    to_be_called->serialize(out);
+    actual_arg->serialize(out);
+}
+
+long CallFunExpr::compute_cost() {
+    // A call can do any amount of work, so count it as a lot
+    return CALL_COST + to_be_called->cost() + actual_arg->cost();
+}
+
+unsigned long long CallFunExpr::compute_free_vars() {
+    return to_be_called->free_var_bits() | actual_arg->free_var_bits();
+}
+
 static std::string evaluate_expr(PTR(Expr) expr) {
     try {
         PTR(EmptyEnv) empty_env = NEW(EmptyEnv)();
@@ -667,7 +2114,12 @@ TEST_CASE( "to_value") {
           ->equals(NEW(NumVal)(5)));
     CHECK( Step::interp_by_steps(NEW(LetExpr)("x", NEW(NumExpr)(1), NEW(LetExpr)("x", NEW(NumExpr)(2), NEW(VarExpr)("x"))))
           ->equals(NEW(NumVal)(2)) );
-    
+    // The body sees the `_let`'s scope, not that of a call in the right-hand side
+    CHECK( Step::interp_by_steps(NEW(LetExpr)("y", NEW(NumExpr)(1),
+                                              NEW(LetExpr)("x", NEW(CallFunExpr)(NEW(FunExpr)("y", NEW(VarExpr)("y")), NEW(NumExpr)(2)),
+                                                           NEW(AddExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("y")))))
+          ->equals(NEW(NumVal)(3)) );
+
     // to_value for IfExpr
     CHECK( (NEW(IfExpr)(NEW(BoolExpr)(false), NEW(NumExpr)(3), NEW(NumExpr)(6)))
           ->to_value(Env::emptyenv)->equals(NEW(NumVal)(6)) );
@@ -675,6 +2127,11 @@ TEST_CASE( "to_value") {
           == "free variable: x" );
     CHECK( !(NEW(IfExpr)(NEW(EqualExpr)(NEW(NumExpr)(3), NEW(NumExpr)(4)), NEW(NumExpr)(3), NEW(NumExpr)(6)))
           ->to_value(Env::emptyenv)->equals(NEW(NumVal)(3)) );
+    // Both evaluators reject a test that is not a boolean
+    CHECK_THROWS_WITH( (NEW(IfExpr)(NEW(NumExpr)(1), NEW(NumExpr)(3), NEW(NumExpr)(6)))->to_value(Env::emptyenv),
+                      "if part doesn't evaluate to a bool val!" );
+    CHECK_THROWS_WITH( Step::interp_by_steps(NEW(IfExpr)(NEW(NumExpr)(1), NEW(NumExpr)(3), NEW(NumExpr)(6))),
+                      "if part doesn't evaluate to a bool val!" );
     
     CHECK( Step::interp_by_steps(NEW(IfExpr)(NEW(BoolExpr)(false), NEW(NumExpr)(3), NEW(NumExpr)(6)))
           ->equals(NEW(NumVal)(6)) );
@@ -803,6 +2260,35 @@ TEST_CASE( "subst") {
     CHECK( !(NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))), NEW(NumExpr)(4)))
           ->subst("x", NEW(NumVal)(3))
           ->equals((NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(AddExpr)(NEW(NumExpr)(3), NEW(NumExpr)(3))), NEW(NumExpr)(4)))) );
+
+    // Parts without the variable are shared, not copied
+    PTR(Expr) unchanged = NEW(AddExpr)(NEW(VarExpr)("x"), NEW(MultExpr)(NEW(VarExpr)("y"), NEW(NumExpr)(2)));
+    PTR(Expr) changed = unchanged->subst("x", NEW(NumVal)(1));
+    CHECK( unchanged->subst("z", NEW(NumVal)(1)) == unchanged );
+    CHECK( CAST(AddExpr)(changed)->rhs == CAST(AddExpr)(unchanged)->rhs );
+    PTR(Expr) bound = NEW(LetExpr)("x", NEW(NumExpr)(1), NEW(VarExpr)("x"));
+    CHECK( bound->subst("x", NEW(NumVal)(2)) == bound );
+
+    // A binding that would capture a variable of the replacement is renamed
+    // (to a name that depends on the hash, so only its use is checked)
+    PTR(FunExpr) renamed_fun = CAST(FunExpr)((NEW(FunExpr)("y", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("y"))))
+                                             ->subst_expr("x", NEW(VarExpr)("y")));
+    CHECK( renamed_fun->formal_arg != "y" );
+    CHECK( renamed_fun->body->equals(NEW(AddExpr)(NEW(VarExpr)("y"), NEW(VarExpr)(renamed_fun->formal_arg))) );
+    PTR(LetExpr) renamed_let = CAST(LetExpr)((NEW(LetExpr)("y", NEW(VarExpr)("x"), NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("y"))))
+                                             ->subst_expr("x", NEW(VarExpr)("y")));
+    CHECK( renamed_let->name != "y" );
+    CHECK( renamed_let->rhs->equals(NEW(VarExpr)("y")) );
+    CHECK( renamed_let->expr->equals(NEW(MultExpr)(NEW(VarExpr)("y"), NEW(VarExpr)(renamed_let->name))) );
+    // ... even when so many variables are free that no name is ruled
+    // out by the signature alone
+    PTR(Expr) many = NEW(VarExpr)("w");
+    for (int i = 0; i < 400; i++)
+        many = NEW(AddExpr)(NEW(VarExpr)("w" + std::to_string(i)), many);
+    PTR(LetExpr) crowded = CAST(LetExpr)((NEW(LetExpr)("x", NEW(NumExpr)(1), NEW(AddExpr)(NEW(VarExpr)("v"), many)))
+                                         ->subst_expr("v", NEW(VarExpr)("x")));
+    CHECK( crowded->name != "x" );
+    CHECK( CAST(AddExpr)(crowded->expr)->lhs->equals(NEW(VarExpr)("x")) );
 }
 
 TEST_CASE("containsVariables") {
@@ -852,6 +2338,12 @@ TEST_CASE("containsVariables") {
     CHECK( (NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("y"))), NEW(NumExpr)(4)))->containsVariables() );
 }
 
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
 TEST_CASE("optimize") {
     // optimize method for NumExpr
     CHECK( (NEW(NumExpr)(3))->optimize()->equals(NEW(NumExpr)(3)) );
@@ -910,9 +2402,118 @@ TEST_CASE("optimize") {
     
     // optimize method for CallFunExpr
     CHECK( (NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))), NEW(NumExpr)(4)))
-          ->optimize()->equals((NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))), NEW(NumExpr)(4)))) );
+          ->optimize()->equals(NEW(NumExpr)(8)) );
     
-    CHECK( !(NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))), NEW(NumExpr)(4)))
+    CHECK( (NEW(CallFunExpr)(NEW(FunExpr)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))), NEW(NumExpr)(4)))
           ->optimize()->equals(NEW(NumExpr)(16)) );
     
+    // Calls of known functions are inlined, in the order they would run
+    CHECK( parse_str("_let f = _fun(x) x * x _in f(3)")->optimize()->equals(NEW(NumExpr)(9)) );
+    CHECK( parse_str("_let add = _fun(x) _fun(y) x + y _in add(1)(2) + add(z)(3)")->optimize()
+          ->equals(parse_str("3 + (_let x = z _in x + 3)")) );
+    CHECK( parse_str("(_fun(x) x + 1)(g(2))")->optimize()->equals(parse_str("_let x = g(2) _in x + 1")) );
+    CHECK( parse_str("(_fun(x) 1)(_true + 1) + 2")->optimize()->equals(parse_str("(_let x = _true + 1 _in 1) + 2")) );
+    // ... but not where the body would see a different `y`,
+    CHECK( parse_str("_let f = _fun(x) x + y _in _let y = 2 _in f(1) + f(2)")->optimize()
+          ->equals(parse_str("_let f = _fun(x) x + y _in f(1) + f(2)")) );
+    // nor when by name the body is too big, nor forever
+    std::string big = "x";
+    for (int i = 0; i < 50; i++)
+        big += " + y";
+    CHECK( parse_str("_let f = _fun(x) " + big + " _in f(3) + f(4)")->optimize()
+          ->to_string().find("f(3)") != std::string::npos );
+    CHECK( parse_str("(_fun(x) x(x))(_fun(x) x(x))")->optimize()->to_string().find("x(x)") != std::string::npos );
+    // nor when the call returns a closure, whose environment `==` sees
+    PTR(Expr) closures = parse_str("_let f = _fun(x) _fun(y) y _in f(1) == f(2)");
+    CHECK( closures->optimize()->to_value(Env::emptyenv)->equals(NEW(BoolVal)(false)) );
+    CHECK( parse_str("(_fun(x) _let g = _fun(y) x _in g)(1)")->optimize()
+          ->equals(parse_str("(_fun(x) _fun(y) x)(1)")) );
+
+    // Bindings that cannot fail go if unused, replace their only use,
+    // or move into the one branch that needs them
+    CHECK( parse_str("_fun(a) _let x = a _in _let z = x == 1 _in 5")->optimize()->equals(parse_str("_fun(a) 5")) );
+    CHECK( parse_str("_let x = _fun(a) a _in g(x)")->optimize()->equals(parse_str("g(_fun(a) a)")) );
+    CHECK( parse_str("_let y = 1 _in _fun(a) _let n = a + 1 _in _let x = n * 2 _in x * y")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a + 1 _in n * 2")) );
+    CHECK( parse_str("_fun(a) _let n = a * 2 _in _let x = n * n _in _if a == 0 _then 1 _else x + x")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a * 2 _in _if a == 0 _then 1 _else _let x = n * n _in x + x")) );
+    // A use in a branch never taken, or wiped out by a 0, is not one
+    CHECK( parse_str("_fun(a) _let n = a * 2 _in _let x = n * n _in _if _true _then x _else x")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a * 2 _in n * n")) );
+    CHECK( parse_str("_fun(a) _let n = a * 2 _in _let x = n * n _in (x + 1) * 0 + 5")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a * 2 _in 5")) );
+    // A variable takes the place of every use of another
+    CHECK( parse_str("_fun(a) _let x = a _in x * x")->optimize()->equals(parse_str("_fun(a) a * a")) );
+    // ... but those that might fail stay, and so does work a function
+    // would repeat on every call, or a use the rhs would be captured at
+    CHECK( parse_str("_let x = g(1) _in 5")->optimize()->equals(parse_str("_let x = g(1) _in 5")) );
+    CHECK( parse_str("_let x = y + 1 _in 5")->optimize()->equals(parse_str("_let x = y + 1 _in 5")) );
+    CHECK( parse_str("_fun(a) _let n = a * 2 _in _let x = n * n _in _fun(b) x + b")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a * 2 _in _let x = n * n _in _fun(b) x + b")) );
+    CHECK( parse_str("_fun(a) _let n = a * 2 _in _let x = n + 1 _in _fun(n) x + n")->optimize()
+          ->equals(parse_str("_fun(a) _let n = a * 2 _in _let x = n + 1 _in _fun(n) x + n")) );
+
+    // Repeated work is done once, from where it is first done
+    CHECK( parse_str("f(x) + f(x)")->optimize()->equals(parse_str("_let cse = f(x) _in cse + cse")) );
+    CHECK( parse_str("_fun(cse) (cse * cse + 1) * (cse * cse + 1) * g(cse * cse + 1)")->optimize()
+          ->equals(parse_str("_fun(cse) _let csea = cse * cse + 1 _in csea * (csea * g(csea))")) );
+    CHECK( parse_str("_fun(g) g(1) + (f(x) + f(x)) * f(x)")->optimize()
+          ->equals(parse_str("_fun(g) g(1) + (_let cse = f(x) _in (cse + cse) * cse)")) );
+    // ... but not ahead of something that could fail first, nor where
+    // another binding of the same name is in the way
+    CHECK( parse_str("(g(1) + f(x)) + f(x)")->optimize()->equals(parse_str("(g(1) + f(x)) + f(x)")) );
+    CHECK( parse_str("_fun(x) f(x) + (_fun(x) f(x))")->optimize()
+          ->equals(parse_str("_fun(x) f(x) + (_fun(x) f(x))")) );
+    CHECK( parse_str("_if a == 1 _then f(x) _else f(x)")->optimize()
+          ->equals(parse_str("_if a == 1 _then f(x) _else f(x)")) );
+    // ... nor under a name some binding inside would capture
+    PTR(Expr) captured = parse_str("_fun(f) _fun(g) f(2) + g(_fun(cse) f(2))")->optimize();
+    CHECK( captured->equals(parse_str("_fun(f) _fun(g) _let csea = f(2) _in csea + g(_fun(cse) csea)")) );
+    CHECK( (NEW(CallFunExpr)(NEW(CallFunExpr)(captured, parse_str("_fun(a) a * 10")), parse_str("_fun(h) h(7)")))
+          ->to_value(Env::emptyenv)->equals(NEW(NumVal)(40)) );
+    
+    // Constants flow through `_let` and stop at a parameter of the same name
+    PTR(Expr) shadowed = NEW(LetExpr)("x", NEW(NumExpr)(2),
+                                      NEW(AddExpr)(NEW(VarExpr)("x"),
+                                                   NEW(FunExpr)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x")))));
+    CHECK( shadowed->optimize()->equals(NEW(AddExpr)(NEW(NumExpr)(2),
+                                                     NEW(FunExpr)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))))) );
+    
+    // Errors are left for run time rather than raised by the optimizer
+    PTR(Expr) bad = NEW(AddExpr)(NEW(NumExpr)(1), NEW(BoolExpr)(true));
+    CHECK( bad->optimize()->equals(bad) );
+    CHECK( (NEW(MultExpr)(NEW(VarExpr)("y"), bad))->optimize()->to_string() == "(y * (1 + _true))" );
+    
+    // `==` compares values, not how they were written
+    CHECK( (NEW(EqualExpr)(NEW(AddExpr)(NEW(NumExpr)(1), NEW(NumExpr)(1)), NEW(NumExpr)(2)))
+          ->optimize()->equals(NEW(BoolExpr)(true)) );
+    
+    // Chains of `+` and `*` are folded as a whole
+    CHECK( parse_str("(x + 1) + 2")->optimize()->equals(parse_str("x + 3")) );
+    CHECK( parse_str("2 * (x * 3) * y")->optimize()->equals(parse_str("6 * x * y")) );
+    CHECK( parse_str("(x + 1) * 1")->optimize()->equals(parse_str("x + 1")) );
+    CHECK( parse_str("x + 0 + y")->optimize()->equals(parse_str("x + y")) );
+    CHECK( parse_str("_let y = z + 1 _in y * x * 0")->optimize()->equals(parse_str("_let y = z + 1 _in y * x * 0")) );
+    CHECK( parse_str("_let y = z + 1 _in 0 * y")->optimize()->equals(parse_str("_let y = z + 1 _in 0")) );
+    
+    // ... but never in a way that would hide an error or a loop
+    const char *kept[] = { "_true * 0", "x * 0", "x + 0", "1 * f(2)", "2 + _true + 3", "(_fun(x) x) * 0" };
+    for (const char *k : kept)
+        CHECK( parse_str(k)->optimize()->equals(parse_str(k)) );
+    
+    // Nothing to fold means nothing is rebuilt
+    PTR(Expr) unchanged = NEW(CallFunExpr)(NEW(VarExpr)("f"), NEW(AddExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(1)));
+    CHECK( unchanged->optimize() == unchanged );
+}
+
+TEST_CASE( "tree_hash and free_variables" ) {
+    CHECK( parse_str("_let x = 1 _in f(x) + 2")->tree_hash() == parse_str("_let x = 1 _in f(x) + 2")->tree_hash() );
+    CHECK( parse_str("_let x = 1 _in f(x) + 2")->tree_hash() != parse_str("_let x = 1 _in f(x) + 3")->tree_hash() );
+    
+    std::set<std::string> names;
+    parse_str("_let x = y _in _fun(z) x + z + w(x)")->free_variables(names);
+    CHECK( names == std::set<std::string>({ "w", "y" }) );
+    names.clear();
+    parse_str("_let x = x _in x")->free_variables(names);
+    CHECK( names == std::set<std::string>({ "x" }) );
 }
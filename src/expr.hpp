@@ -10,48 +10,109 @@
 #define expr_hpp
 
 #include <stdio.h>
+#include <set>
 #include <string>
 #include "value.hpp"
 #include "pointer.hpp"
+#include "arena.hpp"
 
 class Val;
 class Env;
+class ImageWriter;
 
 class Expr ENABLE_THIS(Expr){
 public:
+    ARENA_ALLOCATED
+    
     virtual bool equals(PTR(Expr) e) = 0;
     
     //For counting the value of expression
     virtual PTR(Val) to_value(PTR(Env) env) = 0;
     
     //For substituting a number with a variable by its value
-    virtual PTR(Expr) subst(std::string var, PTR(Val) val) = 0;
+    PTR(Expr) subst(std::string var, PTR(Val) val);
+    
+    //For substituting `replacement` for the free occurrences of `var`:
+    //a part with none is returned as it is, not copied, and a `_let`
+    //or `_fun` that would capture a variable of `replacement` is renamed
+    virtual PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement) = 0;
+    
+    //For checking whether `name` might occur free in an expression;
+    //false means it surely does not
+    bool may_have_free(const std::string &name);
+    
+    //The free variables as one bit per name (by its hash), or'ed over
+    //the parts, so there may be more bits than variables but never
+    //fewer; computed once, then cached
+    unsigned long long free_var_bits();
     
     //For checking if an expression contains variable, both decided or undecided.
     virtual bool containsVariables() = 0;
     
-    //For optimizing an expression, also applied in --opt mode
-    virtual PTR(Expr) optimize() = 0;
+    //A hash that expressions share when `equals` says they are the
+    //same, so an unchanged part of an edited script can be found again
+    size_t tree_hash();
+    
+    //Adds the names of the variables free in an expression to `names`
+    void free_variables(std::set<std::string> &names);
+    
+    //For optimizing an expression, also applied in --opt mode;
+    //a single `fold` over the tree, then repeated subexpressions
+    //are computed once each with a `_let`
+    PTR(Expr) optimize();
+    
+    //For folding constants bottom-up: returns the folded expression
+    //and sets `val` to its value if that is a number or a boolean
+    //known now, or to nullptr otherwise. `env` maps each variable in
+    //scope to its constant value, or to nullptr if it has none.
+    virtual PTR(Expr) fold(PTR(Env) env, PTR(Val) &val) = 0;
     
     //For both step and optimize an expression in --step mode
     virtual void step_interp() = 0;
     
     //For making an expression to a string which can be printed out
     virtual std::string to_string() = 0;
+    
+    //For writing an expression into a compiled image, see serialize.hpp
+    virtual void serialize(ImageWriter &out) = 0;
+    
+    //For estimating how much work evaluating an expression is, so
+    //--parallel knows what is worth a task; computed once, then cached
+    long cost();
+    
+    //Set by `TypeCheck::mark` on every node of a program that has a
+    //type: the values reaching the node are then surely the kinds it
+    //needs, and evaluation skips checking them
+    bool well_typed = false;
+    
+protected:
+    long cost_estimate = -1;
+    virtual long compute_cost() = 0;
+    
+    unsigned long long free_vars = 0;
+    bool free_vars_known = false;
+    virtual unsigned long long compute_free_vars() = 0;
 };
 
 class NumExpr : public Expr {
 public:
-    int num;
+    // As in `NumVal`: the number, or `big` if it does not fit
+    long long num;
+    PTR(BigNum) big;
 
-    NumExpr(int num);
+    NumExpr(long long num);
+    NumExpr(const BigNum &n);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class AddExpr : public Expr {
@@ -62,11 +123,15 @@ public:
     AddExpr(PTR(Expr) lhs, PTR(Expr) rhs);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class MultExpr : public Expr {
@@ -77,11 +142,15 @@ public:
     MultExpr(PTR(Expr) lhs, PTR(Expr) rhs);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class VarExpr : public Expr {
@@ -91,11 +160,15 @@ public:
     VarExpr(std::string name);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class BoolExpr : public Expr {
@@ -105,11 +178,15 @@ public:
     BoolExpr(bool rep);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class LetExpr : public Expr {
@@ -121,11 +198,15 @@ public:
     LetExpr(std::string name, PTR(Expr) rhs, PTR(Expr) expr);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class EqualExpr : public Expr {
@@ -136,11 +217,15 @@ public:
     EqualExpr(PTR(Expr) lhs, PTR(Expr) rhs);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class IfExpr : public Expr {
@@ -152,26 +237,37 @@ public:
     IfExpr(PTR(Expr) if_part, PTR(Expr) then_part, PTR(Expr) else_part);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class FunExpr : public Expr {
 public:
     std::string formal_arg;
     PTR(Expr) body;
+    // The name the profiler reports calls under
+    std::string label;
     
     FunExpr(std::string formal_arg, PTR(Expr) body);
+    FunExpr(std::string formal_arg, PTR(Expr) body, std::string label);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 class CallFunExpr : public Expr {
@@ -182,11 +278,15 @@ public:
     CallFunExpr(PTR(Expr) to_be_called, PTR(Expr) actual_arg);
     bool equals(PTR(Expr) e);
     PTR(Val) to_value(PTR(Env) env);
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Expr) subst_expr(std::string var, PTR(Expr) replacement);
     bool containsVariables();
-    PTR(Expr) optimize();
+    PTR(Expr) fold(PTR(Env) env, PTR(Val) &val);
     void step_interp();
     std::string to_string();
+    void serialize(ImageWriter &out);
+protected:
+    long compute_cost();
+    unsigned long long compute_free_vars();
 };
 
 #endif /* expr_hpp */
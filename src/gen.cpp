@@ -0,0 +1,318 @@
+//
+//  gen.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <sstream>
+#include <vector>
+#include "gen.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+#include "types.hpp"
+
+bool GenOptions::take_flag(int argc, char *argv[], int &i) {
+    if (i + 1 >= argc)
+        return false;
+    int *option = nullptr;
+    if (strcmp(argv[i], "--depth") == 0)
+        option = &depth;
+    else if (strcmp(argv[i], "--breadth") == 0)
+        option = &breadth;
+    else if (strcmp(argv[i], "--closures") == 0)
+        option = &closures;
+    else if (strcmp(argv[i], "--recursion") == 0)
+        option = &recursion;
+    else if (strcmp(argv[i], "--errors") == 0)
+        option = &errors;
+    else
+        return false;
+    *option = atoi(argv[++i]);
+    return true;
+}
+
+/* Makes one program. Each expression is made for the type it must
+ have, and variables are only used where their type fits; functions
+ all take and return numbers. */
+class Generator {
+public:
+    typedef enum {
+        num,
+        boolean,
+        fun
+    } type_t;
+
+    std::mt19937 random;
+    const GenOptions &options;
+    std::vector<std::pair<std::string, type_t>> scope;
+    int names = 0;
+    // Inside a recursive function, which must not start another
+    // recursion, or the number of calls would multiply
+    bool in_recursion = false;
+
+    Generator(unsigned seed, const GenOptions &options) : random(seed), options(options) {
+    }
+
+    int pick(int n) {
+        return (int)(random() % n);
+    }
+
+    bool chance(int percent) {
+        return pick(100) < percent;
+    }
+
+    std::string fresh_name() {
+        std::string name;
+        int n = names++;
+        do {
+            name += (char)('a' + n % 26);
+            n /= 26;
+        } while (n > 0);
+        return name;
+    }
+
+    std::string number(int low, int high) {
+        return std::to_string(low + pick(high - low + 1));
+    }
+
+    // A variable of type `type`, or "" if there is none in scope
+    std::string variable(type_t type) {
+        std::vector<std::string> fits;
+        for (auto &bound : scope)
+            if (bound.second == type)
+                fits.push_back(bound.first);
+        if (fits.empty())
+            return "";
+        return fits[pick((int)fits.size())];
+    }
+
+    std::string leaf(type_t type) {
+        std::string var = (pick(2) ? variable(type) : "");
+        if (var != "")
+            return var;
+        switch (type) {
+            case num:
+                return number(-9, 9);
+            case boolean:
+                return pick(2) ? "_true" : "_false";
+            default:
+                return function(0);
+        }
+    }
+
+    // Whether the expression asked for gets the wrong type instead;
+    // never asks for a random number when `errors` is 0, so that
+    // seeds keep making the same error-free programs
+    bool mistyped() {
+        return options.errors > 0 && chance(options.errors);
+    }
+
+    // An expression of one of the types other than `type`
+    std::string wrong(type_t type, int depth) {
+        type_t other = (type_t)((type + 1 + pick(2)) % 3);
+        return depth <= 0 ? leaf(other) : expr(other, depth - 1);
+    }
+
+    std::string expr(type_t type, int depth) {
+        switch (type) {
+            case num:
+                return number_expr(depth);
+            case boolean:
+                return boolean_expr(depth);
+            default:
+                return function_expr(depth);
+        }
+    }
+
+    std::string number_expr(int depth) {
+        if (mistyped())
+            return wrong(num, depth);
+        if (depth <= 0)
+            return leaf(num);
+        if (!in_recursion && chance(options.recursion))
+            return recursive(depth);
+        if (chance(options.closures))
+            return "(" + function_expr(depth - 1) + ")(" + number_expr(depth - 1) + ")";
+
+        switch (pick(5)) {
+            case 0:
+            case 1:
+                return "(" + number_expr(depth - 1) + " + " + number_expr(depth - 1) + ")";
+            case 2:
+                // A small factor on one side keeps results from
+                // growing too fast to fit a number
+                if (pick(2))
+                    return "(" + number_expr(depth - 1) + " * " + number(-3, 3) + ")";
+                return "(" + number(-3, 3) + " * " + number_expr(depth - 1) + ")";
+            case 3:
+                return if_expr(num, depth);
+            default:
+                return let_expr(num, depth);
+        }
+    }
+
+    std::string boolean_expr(int depth) {
+        if (mistyped())
+            return wrong(boolean, depth);
+        if (depth <= 0)
+            return leaf(boolean);
+
+        switch (pick(4)) {
+            case 0:
+                return "(" + number_expr(depth - 1) + " == " + number_expr(depth - 1) + ")";
+            case 1:
+                return "(" + boolean_expr(depth - 1) + " == " + boolean_expr(depth - 1) + ")";
+            case 2:
+                return if_expr(boolean, depth);
+            default:
+                return let_expr(boolean, depth);
+        }
+    }
+
+    std::string function_expr(int depth) {
+        if (mistyped())
+            return wrong(fun, depth);
+        if (depth <= 0)
+            return leaf(fun);
+
+        switch (pick(4)) {
+            case 0:
+            case 1:
+                return function(depth);
+            case 2:
+                return if_expr(fun, depth);
+            default:
+                return let_expr(fun, depth);
+        }
+    }
+
+    // A `_fun` whose body may use its argument and whatever else is
+    // in scope
+    std::string function(int depth) {
+        std::string arg = fresh_name();
+        scope.push_back(std::make_pair(arg, num));
+        std::string body = (depth <= 0 ? "(" + arg + " + " + leaf(num) + ")" : number_expr(depth - 1));
+        scope.pop_back();
+        return "_fun (" + arg + ") " + body;
+    }
+
+    std::string if_expr(type_t type, int depth) {
+        return "(_if " + boolean_expr(depth - 1)
+        + " _then " + expr(type, depth - 1)
+        + " _else " + expr(type, depth - 1) + ")";
+    }
+
+    std::string let_expr(type_t type, int depth) {
+        int choice = pick(100);
+        type_t rhs_type = (choice < options.closures ? fun : choice < 80 ? num : boolean);
+        std::string name = fresh_name();
+        std::string rhs = expr(rhs_type, depth - 1);
+        scope.push_back(std::make_pair(name, rhs_type));
+        std::string body = expr(type, depth - 1);
+        scope.pop_back();
+        return "(_let " + name + " = " + rhs + " _in " + body + ")";
+    }
+
+    // A function that calls itself (by self-application) until its
+    // argument, which starts at no more than 8, counts down to 0
+    std::string recursive(int depth) {
+        std::string self = fresh_name();
+        std::string n = fresh_name();
+        in_recursion = true;
+        scope.push_back(std::make_pair(n, num));
+        std::string base = number_expr(depth - 1);
+        std::string rest = "(" + self + "(" + self + ")(" + n + " + -1) + " + number_expr(depth - 1) + ")";
+        scope.pop_back();
+        in_recursion = false;
+        return "(_let " + self + " = _fun (" + self + ") _fun (" + n + ") "
+        + "_if " + n + " == 0 _then " + base + " _else " + rest
+        + " _in " + self + "(" + self + ")(" + number(0, 8) + "))";
+    }
+
+    std::string program() {
+        std::string text;
+        int lets = 0;
+        for (; lets < options.breadth; lets++) {
+            int choice = pick(100);
+            type_t type = (choice < options.closures ? fun : choice < 85 ? num : boolean);
+            std::string name = fresh_name();
+            text += "_let " + name + " = " + expr(type, options.depth) + "\n_in ";
+            scope.push_back(std::make_pair(name, type));
+        }
+        text += expr(pick(5) ? num : boolean, options.depth);
+        scope.resize(scope.size() - lets);
+        return text;
+    }
+};
+
+std::string Gen::program(unsigned seed, const GenOptions &options) {
+    Generator generator(seed, options);
+    return generator.program();
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "generated programs" ) {
+    GenOptions options;
+    CHECK( Gen::program(7, options) == Gen::program(7, options) );
+    CHECK( Gen::program(7, options) != Gen::program(8, options) );
+
+    // Nothing but one number or boolean
+    GenOptions tiny;
+    tiny.depth = 0;
+    tiny.breadth = 0;
+    tiny.closures = 0;
+    CHECK( (CAST(NumExpr)(parse_str(Gen::program(1, tiny))) != nullptr
+            || CAST(BoolExpr)(parse_str(Gen::program(1, tiny))) != nullptr) );
+
+    // Every program runs to the same value both ways
+    options.recursion = 20;
+    for (unsigned seed = 0; seed < 100; seed++) {
+        PTR(Expr) e = parse_str(Gen::program(seed, options));
+        std::string direct = e->to_value(Env::emptyenv)->to_string();
+        CHECK( Step::interp_by_steps(e)->to_string() == direct );
+    }
+
+    // Without recursion, every program has a type
+    options.recursion = 0;
+    options.depth = 6;
+    for (unsigned seed = 0; seed < 100; seed++)
+        CHECK_NOTHROW( TypeCheck::infer(parse_str(Gen::program(seed, options))) );
+
+    // With `errors`, some programs fail, the same way both ways
+    options.recursion = 5;
+    options.depth = 4;
+    options.errors = 2;
+    int failed = 0;
+    for (unsigned seed = 0; seed < 100; seed++) {
+        PTR(Expr) e = parse_str(Gen::program(seed, options));
+        std::string direct, stepped;
+        try {
+            direct = e->to_value(Env::emptyenv)->to_string();
+        } catch (std::runtime_error &exn) {
+            direct = "error";
+            failed++;
+        }
+        try {
+            stepped = Step::interp_by_steps(e)->to_string();
+        } catch (std::runtime_error &exn) {
+            stepped = "error";
+        }
+        CHECK( stepped == direct );
+    }
+    CHECK( failed > 10 );
+    CHECK( failed < 100 );
+}
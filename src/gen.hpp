@@ -0,0 +1,49 @@
+//
+//  gen.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef gen_hpp
+#define gen_hpp
+
+#include <stdio.h>
+#include <string>
+
+/* The shape of programs made by `Gen::program`. */
+class GenOptions {
+public:
+    // How deeply expressions nest
+    int depth = 4;
+    // How many `_let`s the program starts with
+    int breadth = 2;
+    // Percent chance that a number comes from calling a function
+    // (often a closure over the variables in scope)
+    int closures = 30;
+    // Percent chance that a number comes from a recursive function
+    // (by self-application, counting down from a small number)
+    int recursion = 5;
+    // Percent chance that an expression has the wrong type (such as
+    // a boolean added to a number), so that the program fails
+    int errors = 0;
+
+    // If `argv[i]` is `--depth`, `--breadth`, `--closures`,
+    // `--recursion` or `--errors` followed by a number, sets that
+    // option, moves `i` to the number and returns true
+    bool take_flag(int argc, char *argv[], int &i);
+};
+
+/* Random programs for fuzzing and load tests. Unless `errors` is
+ set, every program runs to a value without errors: `+` and `*` get
+ numbers, `_if` gets a boolean, calls get functions, and recursion
+ always ends. Without recursion a program also has a type (see
+ types.hpp). */
+class Gen {
+public:
+    // The same `seed` and `options` always make the same program
+    static std::string program(unsigned seed, const GenOptions &options);
+};
+
+#endif /* gen_hpp */
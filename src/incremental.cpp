@@ -0,0 +1,273 @@
+//
+//  incremental.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+#include "incremental.hpp"
+#include "catch.hpp"
+#include "cache.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+
+static const char * const HEADER = "msdscript incremental";
+
+static size_t combine(size_t h, size_t v) {
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+// What identifies values across runs: a number or boolean as it is
+// printed, a closure as its text and the environment it closes over.
+// `==` on closures compares every binding of that environment, not
+// just the ones the body uses, so all of them go into the text. Each
+// environment is written once, to `envs`, and named by its position
+// there; equal environments built separately are written twice, which
+// costs a miss but never a wrong answer.
+class ValueText {
+public:
+    std::string envs;
+    
+    std::string of(PTR(Val) v) {
+        PTR(FunVal) f = CAST(FunVal)(v);
+        if (f == nullptr)
+            return v->to_string();
+        return "(_fun(" + f->formal_arg + ") " + f->body->to_string() + ")@" + std::to_string(id(f->env));
+    }
+    
+private:
+    std::map<PTR(Env), size_t> ids;
+    
+    // 0 is the empty environment
+    size_t id(PTR(Env) env) {
+        // Outermost first, so each binding's `rest` already has a name
+        std::vector<PTR(ExtendedEnv)> chain;
+        PTR(ExtendedEnv) ext;
+        for (PTR(Env) e = env; (ext = CAST(ExtendedEnv)(e)) != nullptr && ids.count(e) == 0; e = ext->rest)
+            chain.push_back(ext);
+        for (size_t i = chain.size(); i-- > 0; ) {
+            std::string val = of(chain[i]->val);
+            size_t n = ids.size() + 1;
+            envs += "@" + std::to_string(n) + " " + chain[i]->name + "=" + val
+                    + " @" + std::to_string(named(chain[i]->rest)) + "\n";
+            ids[chain[i]] = n;
+        }
+        return named(env);
+    }
+    
+    size_t named(PTR(Env) env) {
+        std::map<PTR(Env), size_t>::iterator found = ids.find(env);
+        return found == ids.end() ? 0 : found->second;
+    }
+};
+
+// The value `ValueText` gave for a number or boolean
+static PTR(Val) read_value(const std::string &text) {
+    if (text == "_true")
+        return NEW(BoolVal)(true);
+    if (text == "_false")
+        return NEW(BoolVal)(false);
+    return NEW(NumVal)(BigNum::from_string(text));
+}
+
+// Each entry is its hash, the lengths of its key and value, then the
+// key and value themselves
+Incremental::Incremental(std::string path) {
+    this->path = path;
+    this->reused = 0;
+    this->computed = 0;
+    this->step = false;
+    
+    std::ifstream in(path, std::ios::binary);
+    std::string header;
+    if (!std::getline(in, header) || header != std::string(HEADER) + " " + INTERPRETER_VERSION)
+        return;
+    size_t hash, key_length, value_length;
+    while (in >> hash >> key_length >> value_length && in.get() == '\n') {
+        Entry entry;
+        entry.key.resize(key_length);
+        entry.value.resize(value_length);
+        if (!in.read(&entry.key[0], key_length) || !in.read(&entry.value[0], value_length))
+            break;
+        previous[hash] = entry;
+    }
+}
+
+PTR(Val) Incremental::evaluate(PTR(Expr) e, bool step) {
+    this->step = step;
+    return evaluate_part(e, Env::emptyenv);
+}
+
+// Runs a chain of `_let`s, each right-hand side as a part
+PTR(Val) Incremental::evaluate_lets(PTR(Expr) e, PTR(Env) env) {
+    PTR(LetExpr) let;
+    while ((let = CAST(LetExpr)(e)) != nullptr) {
+        env = NEW(ExtendedEnv)(let->name, evaluate_part(let->rhs, env), env);
+        e = let->expr;
+    }
+    return evaluate_part(e, env);
+}
+
+PTR(Val) Incremental::evaluate_part(PTR(Expr) e, PTR(Env) env) {
+    // Making a closure costs less than looking it up
+    if (CAST(FunExpr)(e) != nullptr)
+        return e->to_value(env);
+    
+    std::set<std::string> names;
+    e->free_variables(names);
+    ValueText text;
+    std::string bindings;
+    bool known = true;
+    for (const std::string &name : names) {
+        try {
+            bindings += name + "=" + text.of(env->lookup(name)) + "\n";
+        } catch (std::runtime_error &) {
+            // Left to evaluation to report
+            known = false;
+        }
+    }
+    
+    size_t hash = 0;
+    std::string key;
+    if (known) {
+        bindings += text.envs;
+        hash = combine(e->tree_hash(), std::hash<std::string>()(bindings));
+        key = e->to_string() + "\n" + bindings;
+        entries_t::iterator found = previous.find(hash);
+        if (found != previous.end() && found->second.key == key) {
+            reused++;
+            current[hash] = found->second;
+            return read_value(found->second.value);
+        }
+    }
+    
+    computed++;
+    PTR(Val) v;
+    if (CAST(LetExpr)(e) != nullptr)
+        v = evaluate_lets(e, env);
+    else if (step)
+        v = Step::interp_by_steps(e, env);
+    else
+        v = e->to_value(env);
+    
+    if (known && CAST(FunVal)(v) == nullptr) {
+        Entry entry;
+        entry.key = key;
+        entry.value = v->to_string();
+        current[hash] = entry;
+        // Found again by a later part, for code written twice
+        previous[hash] = entry;
+    }
+    return v;
+}
+
+void Incremental::save() {
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return;
+        out << HEADER << " " << INTERPRETER_VERSION << "\n";
+        for (auto &entry : current)
+            out << entry.first << " " << entry.second.key.length() << " " << entry.second.value.length() << "\n"
+                << entry.second.key << entry.second.value;
+        if (!out) {
+            out.close();
+            unlink(tmp_path.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        unlink(tmp_path.c_str());
+}
+
+/* for tests */
+static std::string run_edit(const std::string &path, const std::string &text, bool step,
+                            int &reused, int &computed) {
+    Incremental incremental(path);
+    std::istringstream in(text);
+    std::string result;
+    try {
+        result = incremental.evaluate(parse(in), step)->to_string();
+    } catch (std::runtime_error &exn) {
+        result = exn.what();
+    }
+    incremental.save();
+    reused = incremental.reused;
+    computed = incremental.computed;
+    return result;
+}
+
+TEST_CASE( "incremental" ) {
+    std::string fib = "_let fib = _fun(f) _fun(n) _if n == 0 _then 0 _else _if n == 1 _then 1 "
+                      "_else f(f)(n + -1) + f(f)(n + -2) _in ";
+    for (int step = 0; step < 2; step++) {
+        char path[] = "/tmp/msdincXXXXXX";
+        int fd = mkstemp(path);
+        REQUIRE( fd != -1 );
+        close(fd);
+        int reused, computed;
+        
+        CHECK( run_edit(path, fib + "_let a = fib(fib)(15) _in _let b = a * 2 _in a + b", step, reused, computed)
+              == "1830" );
+        CHECK( reused == 0 );
+        
+        // Only the changed body runs again
+        CHECK( run_edit(path, fib + "_let a = fib(fib)(15) _in _let b = a * 2 _in a + b + 1", step, reused, computed)
+              == "1831" );
+        CHECK( reused == 2 );
+        CHECK( computed == 2 );
+        
+        // An unchanged program is one part
+        CHECK( run_edit(path, fib + "_let a = fib(fib)(15) _in _let b = a * 2 _in a + b + 1", step, reused, computed)
+              == "1831" );
+        CHECK( reused == 1 );
+        CHECK( computed == 0 );
+        
+        // A changed function changes what calls it, and what uses that
+        CHECK( run_edit(path, "_let fib = _fun(f) _fun(n) n _in _let a = fib(fib)(15) _in _let b = a * 2 _in a + b + 1",
+                        step, reused, computed) == "46" );
+        CHECK( reused == 0 );
+        
+        // A part depends on the values it uses, not how they were made
+        CHECK( run_edit(path, "_let a = 5 _in _let b = a * 2 _in b + 1", step, reused, computed) == "11" );
+        CHECK( run_edit(path, "_let a = 2 + 3 _in _let b = a * 2 _in b + 1", step, reused, computed) == "11" );
+        CHECK( reused == 2 );
+        CHECK( computed == 2 );
+        
+        // Closures are equal only with equal environments, including
+        // bindings their bodies never use
+        CHECK( run_edit(path, "_let a = 1 _in _let f = _fun(x) x _in _let g = _fun(x) x _in f == g",
+                        step, reused, computed) == "_false" );
+        CHECK( run_edit(path, "_let a = 1 _in _let f = _fun(x) x _in _let g = f _in f == g",
+                        step, reused, computed) == "_true" );
+        CHECK( run_edit(path, "_let a = 1 _in _let f = _fun(x) x _in _let g = f _in f == g",
+                        step, reused, computed) == "_true" );
+        CHECK( reused == 1 );
+        
+        // Errors are raised again, not recorded
+        CHECK( run_edit(path, "_let x = 1 + _true _in x", step, reused, computed) == "input is not a number" );
+        CHECK( run_edit(path, "_let x = 1 + _true _in x", step, reused, computed) == "input is not a number" );
+        CHECK( run_edit(path, "_let x = 1 _in y", step, reused, computed) == "free variable: y" );
+        
+        // A damaged file is as good as none
+        {
+            std::ofstream out(path, std::ios::trunc);
+            out << HEADER << " " << INTERPRETER_VERSION << "\n" << "12 99 1\n_let";
+        }
+        CHECK( run_edit(path, "2 * 21", step, reused, computed) == "42" );
+        CHECK( reused == 0 );
+        unlink(path);
+    }
+}
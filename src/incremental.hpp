@@ -0,0 +1,65 @@
+//
+//  incremental.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef incremental_hpp
+#define incremental_hpp
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include "pointer.hpp"
+
+class Expr;
+class Env;
+class Val;
+
+/* `--incremental FILE`: re-runs an edited script, computing again only
+ the parts that changed. A script is taken as its chain of `_let`s
+ (each right-hand side, itself split the same way if it is a `_let`)
+ and the body at the end. Each part is looked up by its `tree_hash`
+ together with the values of its free variables; a closure's value
+ is its text and the values it captured, so a part that calls an
+ unchanged function on unchanged arguments is found again. A part
+ whose value is a number or boolean is recorded, and FILE keeps the
+ parts of the last run, so it does not grow with edits. An entry
+ holds the part's text, so a hash collision is detected instead of
+ trusted. */
+class Incremental {
+public:
+    std::string path;
+    int reused;
+    int computed;
+    
+    // Loads what the last run at `path` recorded, if anything
+    Incremental(std::string path);
+    
+    // `e`'s value, with `Step::interp_by_steps` for each changed part
+    // if `step` is set, else `to_value`
+    PTR(Val) evaluate(PTR(Expr) e, bool step);
+    
+    // Replaces the file with the parts of this run. Failing to write
+    // is not an error; the next run just computes everything.
+    void save();
+    
+private:
+    class Entry {
+    public:
+        std::string key;
+        std::string value;
+    };
+    typedef std::unordered_map<size_t, Entry> entries_t;
+    
+    entries_t previous;
+    entries_t current;
+    bool step;
+    
+    PTR(Val) evaluate_lets(PTR(Expr) e, PTR(Env) env);
+    PTR(Val) evaluate_part(PTR(Expr) e, PTR(Env) env);
+};
+
+#endif /* incremental_hpp */
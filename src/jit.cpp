@@ -0,0 +1,600 @@
+//
+//  jit.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "jit.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "parse.hpp"
+#include "memo.hpp"
+#include "budget.hpp"
+#include "profile.hpp"
+#include "parallel.hpp"
+#include "gen.hpp"
+
+#if defined(__x86_64__)
+const bool Jit::supported = true;
+#else
+const bool Jit::supported = false;
+#endif
+bool Jit::enabled = false;
+long Jit::threshold = 1000;
+
+long Jit::compiled = 0;
+long Jit::native_calls = 0;
+long Jit::bailouts = 0;
+
+// Native values are 64-bit integers, booleans being 0 or 1; which a
+// value is is known when its code is compiled
+typedef enum {
+    JIT_NUM,
+    JIT_BOOL
+} jit_type_t;
+
+// At most this many held variables are passed to native code
+static const size_t MAX_CAPTURES = 16;
+
+// Native code's entry point, which returns the call's result and
+// sets `bailed` if it had to stop
+typedef long long (*entry_t)(long long arg, const long long *captures, long long *bailed);
+
+class JitEntry {
+public:
+    typedef enum {
+        counting,
+        running,
+        failed
+    } state_t;
+    
+    state_t state;
+    long calls;
+    
+    // For `running`: the code, and what it was specialized for
+    void *code;
+    size_t code_size;
+    std::string formal_arg;
+    jit_type_t arg_type;
+    jit_type_t result_type;
+    // The held variables passed in `captures`, with their types
+    std::vector<std::string> captures;
+    std::vector<jit_type_t> capture_types;
+    // For recursive code: the name of the function that made the
+    // closure, or "" if the body makes no recursive calls
+    std::string self;
+    
+    JitEntry() {
+        state = counting;
+        calls = 0;
+        code = nullptr;
+        code_size = 0;
+    }
+};
+
+static std::unordered_map<Expr*, JitEntry> jit_table;
+
+// Where `name` is bound in `env`, as `Env::lookup` would find it
+static PTR(Val) find_value(PTR(Env) env, const std::string &name) {
+    while (PTR(ExtendedEnv) ee = CAST(ExtendedEnv)(env)) {
+        if (ee->name == name)
+            return ee->val;
+        env = ee->rest;
+    }
+    return nullptr;
+}
+
+static bool type_of(PTR(Val) v, jit_type_t &type) {
+    if (PTR(NumVal) n = CAST(NumVal)(v)) {
+        type = JIT_NUM;
+        return n->big == nullptr;
+    }
+    if (CAST(BoolVal)(v) != nullptr) {
+        type = JIT_BOOL;
+        return true;
+    }
+    return false;
+}
+
+static long long native_value(PTR(Val) v) {
+    if (PTR(NumVal) n = CAST(NumVal)(v))
+        return n->rep;
+    return STATIC_CAST(BoolVal)(v)->rep ? 1 : 0;
+}
+
+// Whether `f` was made by calling the function that `self` names in
+// its environment with itself: then `self(self)` makes a closure with
+// the same body and an environment that finds the same values
+static bool made_by_itself(PTR(FunVal) f, const std::string &self) {
+    PTR(ExtendedEnv) ee = CAST(ExtendedEnv)(f->env);
+    if (ee == nullptr || ee->name != self)
+        return false;
+    PTR(FunVal) maker = CAST(FunVal)(ee->val);
+    if (maker == nullptr || maker->formal_arg != self || maker->env != ee->rest)
+        return false;
+    PTR(FunExpr) made = CAST(FunExpr)(maker->body);
+    return made != nullptr && made->formal_arg == f->formal_arg && made->body == f->body;
+}
+
+// The code generator writes x86-64; elsewhere every call is
+// interpreted, and `--jit` is refused
+#if defined(__x86_64__)
+
+// Raised while compiling a body the JIT does not handle
+class Unsupported {
+};
+
+/* x86-64 instructions, as bytes, for the handful of forms compiled
+ code uses. Expressions leave their value in rax; operands wait on
+ the stack; the argument and `_let` variables live in the frame,
+ below rbp; r12 points to the held variables, r13 holds the stack
+ pointer to return to on a bailout and r14 where to report it. */
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+    
+    void byte(uint8_t b) {
+        code.push_back(b);
+    }
+    void bytes(std::initializer_list<uint8_t> bs) {
+        code.insert(code.end(), bs);
+    }
+    void imm32(int32_t v) {
+        for (int i = 0; i < 4; i++)
+            byte((uint8_t)((uint32_t)v >> (8 * i)));
+    }
+    void imm64(int64_t v) {
+        for (int i = 0; i < 8; i++)
+            byte((uint8_t)((uint64_t)v >> (8 * i)));
+    }
+    
+    // A rel32 jump or call with the opcode `op`, to be patched;
+    // returns where its offset is
+    size_t jump(std::initializer_list<uint8_t> op) {
+        bytes(op);
+        size_t at = code.size();
+        imm32(0);
+        return at;
+    }
+    void patch(size_t at, size_t target) {
+        int32_t rel = (int32_t)((long)target - (long)(at + 4));
+        for (int i = 0; i < 4; i++)
+            code[at + i] = (uint8_t)((uint32_t)rel >> (8 * i));
+    }
+    
+    void mov_rax_imm(long long v) {
+        if (v >= 0 && v <= INT32_MAX) {
+            byte(0xB8);                         // mov eax, imm32
+            imm32((int32_t)v);
+        } else {
+            bytes({0x48, 0xB8});                // mov rax, imm64
+            imm64(v);
+        }
+    }
+    void load_local(int slot) {
+        bytes({0x48, 0x8B, 0x85});              // mov rax, [rbp - 8 * (slot + 1)]
+        imm32(-8 * (slot + 1));
+    }
+    void store_local(int slot) {
+        bytes({0x48, 0x89, 0x85});              // mov [rbp - 8 * (slot + 1)], rax
+        imm32(-8 * (slot + 1));
+    }
+    void load_capture(int index) {
+        bytes({0x49, 0x8B, 0x84, 0x24});        // mov rax, [r12 + 8 * index]
+        imm32(8 * index);
+    }
+    void push_rax() {
+        byte(0x50);
+    }
+    // Leaves the operand that was pushed in rax and the one in rax
+    // in rcx
+    void pop_operands() {
+        bytes({0x48, 0x89, 0xC1});              // mov rcx, rax
+        byte(0x58);                             // pop rax
+    }
+};
+
+/* Compiles one body into a function of its argument (in rdi), under
+ the types it is specialized for, assuming that a recursive call
+ returns `result_type`. */
+class JitCompiler {
+public:
+    Assembler &a;
+    JitEntry &entry;
+    PTR(FunVal) f;
+    jit_type_t result_type;
+    
+    // The argument and `_let` variables in scope, innermost last,
+    // with their frame slots (the argument's is 0)
+    std::vector<std::pair<std::string, int>> scope;
+    int slots;
+    // Offsets of jumps to the bailout, and of recursive calls
+    std::vector<size_t> bailouts;
+    std::vector<size_t> self_calls;
+    
+    JitCompiler(Assembler &a, JitEntry &entry, PTR(FunVal) f, jit_type_t result_type)
+    : a(a), entry(entry), f(f), result_type(result_type) {
+        scope.push_back(std::make_pair(f->formal_arg, 0));
+        slots = 1;
+    }
+    
+    jit_type_t compile(PTR(Expr) e);
+
+private:
+    jit_type_t variable(const std::string &name);
+    bool is_self_call(PTR(CallFunExpr) call);
+};
+
+static bool in_scope(const std::vector<std::pair<std::string, int>> &scope, const std::string &name) {
+    for (auto &binding : scope) {
+        if (binding.first == name)
+            return true;
+    }
+    return false;
+}
+
+jit_type_t JitCompiler::variable(const std::string &name) {
+    for (size_t i = scope.size(); i-- > 0; ) {
+        if (scope[i].first == name) {
+            a.load_local(scope[i].second);
+            return (scope[i].second == 0) ? entry.arg_type : JIT_NUM;
+        }
+    }
+    // A held variable: passed in if it is a number or boolean now
+    jit_type_t type;
+    if (!type_of(find_value(f->env, name), type))
+        throw Unsupported();
+    size_t index = 0;
+    while (index < entry.captures.size() && entry.captures[index] != name)
+        index++;
+    if (index == entry.captures.size()) {
+        if (index == MAX_CAPTURES)
+            throw Unsupported();
+        entry.captures.push_back(name);
+        entry.capture_types.push_back(type);
+    }
+    a.load_capture((int)index);
+    return type;
+}
+
+// Whether `call` is `self(self)(ARG)`, calling this body again
+bool JitCompiler::is_self_call(PTR(CallFunExpr) call) {
+    PTR(CallFunExpr) inner = CAST(CallFunExpr)(call->to_be_called);
+    if (inner == nullptr)
+        return false;
+    PTR(VarExpr) self = CAST(VarExpr)(inner->to_be_called);
+    PTR(VarExpr) self_arg = CAST(VarExpr)(inner->actual_arg);
+    return (self != nullptr && self_arg != nullptr && self->name == self_arg->name
+            && !in_scope(scope, self->name) && made_by_itself(f, self->name));
+}
+
+jit_type_t JitCompiler::compile(PTR(Expr) e) {
+    if (PTR(NumExpr) n = CAST(NumExpr)(e)) {
+        if (n->big != nullptr)
+            throw Unsupported();
+        a.mov_rax_imm(n->num);
+        return JIT_NUM;
+    }
+    if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        a.mov_rax_imm(b->rep ? 1 : 0);
+        return JIT_BOOL;
+    }
+    if (PTR(VarExpr) v = CAST(VarExpr)(e))
+        return variable(v->name);
+    if (PTR(AddExpr) add = CAST(AddExpr)(e)) {
+        if (compile(add->lhs) != JIT_NUM)
+            throw Unsupported();
+        a.push_rax();
+        if (compile(add->rhs) != JIT_NUM)
+            throw Unsupported();
+        a.pop_operands();
+        a.bytes({0x48, 0x01, 0xC8});            // add rax, rcx
+        bailouts.push_back(a.jump({0x0F, 0x80}));   // jo
+        return JIT_NUM;
+    }
+    if (PTR(MultExpr) mult = CAST(MultExpr)(e)) {
+        if (compile(mult->lhs) != JIT_NUM)
+            throw Unsupported();
+        a.push_rax();
+        if (compile(mult->rhs) != JIT_NUM)
+            throw Unsupported();
+        a.pop_operands();
+        a.bytes({0x48, 0x0F, 0xAF, 0xC1});      // imul rax, rcx
+        bailouts.push_back(a.jump({0x0F, 0x80}));   // jo
+        return JIT_NUM;
+    }
+    if (PTR(EqualExpr) equal = CAST(EqualExpr)(e)) {
+        jit_type_t lhs = compile(equal->lhs);
+        a.push_rax();
+        jit_type_t rhs = compile(equal->rhs);
+        a.pop_operands();
+        if (lhs != rhs)
+            a.mov_rax_imm(0);
+        else {
+            a.bytes({0x48, 0x39, 0xC8});        // cmp rax, rcx
+            a.bytes({0x0F, 0x94, 0xC0});        // sete al
+            a.bytes({0x0F, 0xB6, 0xC0});        // movzx eax, al
+        }
+        return JIT_BOOL;
+    }
+    if (PTR(IfExpr) branch = CAST(IfExpr)(e)) {
+        if (compile(branch->if_part) != JIT_BOOL)
+            throw Unsupported();
+        a.bytes({0x48, 0x85, 0xC0});            // test rax, rax
+        size_t to_else = a.jump({0x0F, 0x84});  // je
+        jit_type_t then_type = compile(branch->then_part);
+        size_t to_end = a.jump({0xE9});         // jmp
+        a.patch(to_else, a.code.size());
+        jit_type_t else_type = compile(branch->else_part);
+        a.patch(to_end, a.code.size());
+        if (then_type != else_type)
+            throw Unsupported();
+        return then_type;
+    }
+    if (PTR(LetExpr) let = CAST(LetExpr)(e)) {
+        jit_type_t rhs = compile(let->rhs);
+        // Only the argument's slot is typed by `entry`, so a `_let`
+        // of a boolean is left to the interpreter
+        if (rhs != JIT_NUM)
+            throw Unsupported();
+        int slot = slots++;
+        a.store_local(slot);
+        scope.push_back(std::make_pair(let->name, slot));
+        jit_type_t body = compile(let->expr);
+        scope.pop_back();
+        return body;
+    }
+    if (PTR(CallFunExpr) call = CAST(CallFunExpr)(e)) {
+        if (!is_self_call(call))
+            throw Unsupported();
+        if (compile(call->actual_arg) != entry.arg_type)
+            throw Unsupported();
+        entry.self = CAST(VarExpr)(CAST(CallFunExpr)(call->to_be_called)->to_be_called)->name;
+        a.bytes({0x48, 0x89, 0xC7});            // mov rdi, rax
+        self_calls.push_back(a.jump({0xE8}));   // call
+        return result_type;
+    }
+    throw Unsupported();
+}
+
+// Compiles `f`'s body, as called with `arg`, into `entry`; returns
+// whether it could
+static bool compile_entry(PTR(FunVal) f, PTR(Val) arg, JitEntry &entry) {
+    entry.formal_arg = f->formal_arg;
+    if (!type_of(arg, entry.arg_type))
+        return false;
+    
+    // Try each result type for recursive calls, until the body's
+    // agrees with it
+    for (jit_type_t assumed : { JIT_NUM, JIT_BOOL }) {
+        Assembler a;
+        entry.captures.clear();
+        entry.capture_types.clear();
+        entry.self = "";
+        
+        a.bytes({0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56});  // push rbp, r12, r13, r14
+        a.bytes({0x49, 0x89, 0xF4});            // mov r12, rsi
+        a.bytes({0x49, 0x89, 0xD6});            // mov r14, rdx
+        a.bytes({0x49, 0x89, 0xE5});            // mov r13, rsp
+        size_t call_body = a.jump({0xE8});      // call body
+        size_t epilogue = a.code.size();
+        a.bytes({0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D});  // pop r14, r13, r12, rbp
+        a.byte(0xC3);                           // ret
+        size_t bailout = a.code.size();
+        a.bytes({0x4C, 0x89, 0xEC});            // mov rsp, r13
+        a.bytes({0x49, 0xC7, 0x06});            // mov qword [r14], 1
+        a.imm32(1);
+        a.patch(a.jump({0xE9}), epilogue);      // jmp epilogue
+        
+        size_t body = a.code.size();
+        a.byte(0x55);                           // push rbp
+        a.bytes({0x48, 0x89, 0xE5});            // mov rbp, rsp
+        size_t frame = a.jump({0x48, 0x81, 0xEC});  // sub rsp, frame size
+        a.bytes({0x48, 0x89, 0xBD});            // mov [rbp - 8], rdi
+        a.imm32(-8);
+        JitCompiler compiler(a, entry, f, assumed);
+        jit_type_t result;
+        try {
+            result = compiler.compile(f->body);
+        } catch (Unsupported) {
+            continue;
+        }
+        if (!compiler.self_calls.empty() && result != assumed)
+            continue;
+        a.byte(0xC9);                           // leave
+        a.byte(0xC3);                           // ret
+        
+        a.patch(call_body, body);
+        for (size_t at : compiler.bailouts)
+            a.patch(at, bailout);
+        for (size_t at : compiler.self_calls)
+            a.patch(at, body);
+        int32_t frame_size = 8 * ((compiler.slots + 1) & ~1);
+        for (int i = 0; i < 4; i++)
+            a.code[frame + i] = (uint8_t)((uint32_t)frame_size >> (8 * i));
+        
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t size = (a.code.size() + page - 1) / page * page;
+#ifdef __APPLE__
+        // The hardened runtime only lets memory mapped for a JIT
+        // become executable
+        void *code = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_JIT, -1, 0);
+        if (code == MAP_FAILED)
+            return false;
+        memcpy(code, a.code.data(), a.code.size());
+#else
+        void *code = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+            return false;
+        memcpy(code, a.code.data(), a.code.size());
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(code, size);
+            return false;
+        }
+#endif
+        entry.code = code;
+        entry.code_size = size;
+        entry.result_type = result;
+        return true;
+    }
+    return false;
+}
+
+#else
+
+static bool compile_entry(PTR(FunVal), PTR(Val), JitEntry &) {
+    return false;
+}
+
+#endif
+
+static void retire(JitEntry &entry) {
+    if (entry.code != nullptr)
+        munmap(entry.code, entry.code_size);
+    entry.code = nullptr;
+    entry.state = JitEntry::failed;
+}
+
+PTR(Val) Jit::call(PTR(FunVal) f, PTR(Val) arg) {
+    if (Budget::active || Profiler::mode != Profiler::off || CallMemo::enabled || Parallel::enabled)
+        return nullptr;
+    JitEntry &entry = jit_table[&*f->body];
+    if (entry.state == JitEntry::counting) {
+        if (++entry.calls < threshold)
+            return nullptr;
+        entry.state = compile_entry(f, arg, entry) ? JitEntry::running : JitEntry::failed;
+        if (entry.state == JitEntry::running)
+            compiled++;
+    }
+    if (entry.state != JitEntry::running || f->formal_arg != entry.formal_arg)
+        return nullptr;
+    
+    // Guards: the code is only for the types it was compiled for
+    jit_type_t type;
+    if (!type_of(arg, type) || type != entry.arg_type)
+        return nullptr;
+    if (!entry.self.empty() && !made_by_itself(f, entry.self))
+        return nullptr;
+    long long captures[MAX_CAPTURES];
+    for (size_t i = 0; i < entry.captures.size(); i++) {
+        PTR(Val) v = find_value(f->env, entry.captures[i]);
+        if (!type_of(v, type) || type != entry.capture_types[i])
+            return nullptr;
+        captures[i] = native_value(v);
+    }
+    
+    native_calls++;
+    long long bailed = 0;
+    long long result = ((entry_t)entry.code)(native_value(arg), captures, &bailed);
+    if (bailed) {
+        bailouts++;
+        retire(entry);
+        return nullptr;
+    }
+    if (entry.result_type == JIT_NUM)
+        return NEW(NumVal)(result);
+    return NEW(BoolVal)(result != 0);
+}
+
+void Jit::reset() {
+    for (auto &item : jit_table)
+        retire(item.second);
+    jit_table.clear();
+    compiled = 0;
+    native_calls = 0;
+    bailouts = 0;
+}
+
+void Jit::report(std::ostream &out) {
+    out << "jit: " << compiled << " functions compiled, " << native_calls << " native calls, "
+        << bailouts << " bailouts" << std::endl;
+}
+
+#if defined(__x86_64__)
+
+/* for tests */
+static std::string jit_value(const std::string &text) {
+    std::istringstream in(text);
+    return parse(in)->to_value(Env::emptyenv)->to_string();
+}
+
+TEST_CASE( "jit" ) {
+    Jit::reset();
+    Jit::enabled = true;
+    Jit::threshold = 3;
+    
+    // Recursion through self-application runs natively
+    CHECK( jit_value("_let fib = _fun(fib) _fun(x)"
+                     "  _if x == 0 _then 1"
+                     "  _else _if x == 1 _then 1"
+                     "  _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+                     "_in fib(fib)(25)") == "121393" );
+    CHECK( Jit::compiled == 1 );
+    CHECK( Jit::native_calls > 0 );
+    CHECK( Jit::bailouts == 0 );
+    
+    // A boolean result, held variables and `_let`s
+    Jit::reset();
+    CHECK( jit_value("_let even = _fun(e) _fun(n) _if n == 0 _then _true _else _if n == 1 _then _false"
+                     "                  _else e(e)(n + -2)"
+                     "_in even(even)(1001)") == "_false" );
+    CHECK( Jit::compiled == 1 );
+    Jit::reset();
+    CHECK( jit_value("_let k = 3 _in _let on = _true"
+                     "_in _let f = _fun(x) _let y = x * k _in _if on _then y + 1 _else y"
+                     "_in f(1) + f(2) + f(3) + f(4) + f(5)") == "50" );
+    CHECK( Jit::compiled == 1 );
+    CHECK( Jit::native_calls == 3 );
+    
+    // Overflow stops native code, and the call is interpreted again
+    Jit::reset();
+    CHECK( jit_value("_let pow = _fun(p) _fun(n) _if n == 0 _then 1 _else 2 * p(p)(n + -1)"
+                     "_in pow(pow)(10) + pow(pow)(100)") == "1267650600228229401496703206400" );
+    CHECK( Jit::bailouts == 1 );
+    
+    // An argument of another type is interpreted, with its errors
+    Jit::reset();
+    CHECK( jit_value("_let f = _fun(x) _if x == _true _then 0 _else x + 1"
+                     "_in f(1) + f(2) + f(3) + f(_true)") == "9" );
+    Jit::reset();
+    CHECK_THROWS_WITH( jit_value("_let f = _fun(x) x + 1"
+                                 "_in f(1) + f(2) + f(3) + f(_true)"), "cannot add booleans" );
+    CHECK( Jit::native_calls == 1 );
+    
+    // Bodies that make closures or call other functions are not compiled
+    Jit::reset();
+    CHECK( jit_value("_let add = _fun(x) _fun(y) x + y"
+                     "_in add(1)(1) + add(2)(2) + add(3)(3) + add(4)(4)") == "20" );
+    CHECK( Jit::compiled == 1 );
+    CHECK( jit_value("_let twice = _fun(g) _fun(x) g(g(x))"
+                     "_in _let inc = _fun(x) x + 1"
+                     "_in twice(inc)(1) + twice(inc)(2) + twice(inc)(3)") == "12" );
+    
+    // Generated programs agree with the interpreter
+    for (unsigned seed = 1; seed <= 20; seed++) {
+        std::string text = Gen::program(seed, GenOptions());
+        Jit::enabled = false;
+        std::string expected = jit_value(text);
+        Jit::enabled = true;
+        INFO( text );
+        CHECK( jit_value(text) == expected );
+    }
+    
+    Jit::threshold = 1000;
+    Jit::enabled = false;
+    Jit::reset();
+}
+
+#endif
@@ -0,0 +1,63 @@
+//
+//  jit.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef jit_hpp
+#define jit_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include "pointer.hpp"
+
+class Val;
+class FunVal;
+
+/* `--jit`: compiles hot closures to x86-64 machine code. Calls are
+ counted per body, as `CallMemo` identifies closures, so the fresh
+ closures made by `fib(fib)` on every recursive call all count
+ together; once a body has been called `threshold` times, it is
+ compiled, if it can be, into an mmap'd region.
+ 
+ Only bodies that work on numbers and booleans are compiled: literals
+ that fit in 64 bits, the argument, `_let`s, variables the closure
+ holds, `+`, `*`, `==`, `_if`, and recursive calls written
+ `f(f)(ARG)` where `f` is the function that made this closure. The
+ code is specialized for the types the argument and held variables
+ had when it was compiled, and a body that would fail on them (say,
+ by adding a boolean) is not compiled at all.
+ 
+ A call whose values have other types is interpreted. If arithmetic
+ overflows, the native code stops and the whole call is interpreted
+ again, which is safe since evaluation has no side effects, and the
+ body is never run natively again. Nothing is compiled while calls
+ are charged to a `Budget`, profiled, memoized or run in parallel,
+ since native code does none of that. On machines other than x86-64
+ nothing is compiled at all, and `--jit` is refused. */
+class Jit {
+public:
+    // Whether this machine runs the code the JIT writes, which is
+    // only x86-64
+    static const bool supported;
+    
+    static bool enabled;
+    static long threshold;
+    
+    static long compiled;
+    static long native_calls;
+    static long bailouts;
+    
+    // The result of calling `f` with `arg` in native code, or
+    // `nullptr` if the call must be interpreted
+    static PTR(Val) call(PTR(FunVal) f, PTR(Val) arg);
+    
+    // Forgets all counts and code, and the statistics
+    static void reset();
+    
+    static void report(std::ostream &out);
+};
+
+#endif /* jit_hpp */
@@ -18,22 +18,349 @@
 #include "expr.hpp"
 #include "step.hpp"
 #include "parse.hpp"
+#include "serialize.hpp"
+#include "cache.hpp"
+#include "memo.hpp"
+#include "parallel.hpp"
+#include "budget.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "source.hpp"
+#include "types.hpp"
+#include "gen.hpp"
+#include "server.hpp"
+#include "repl.hpp"
+#include "incremental.hpp"
+#include "emitc.hpp"
+#include "jit.hpp"
+#include <thread>
+#include <unistd.h>
+
+// Reads a program from `text`, which holds either script text or
+// a compiled image written by `--compile`; an image skips `parse`.
+// With a cache, script text is looked up there first, and a miss
+// records the parsed (and, for `optimize`, optimized) tree.
+static PTR(Expr) read_program(const std::string &text, bool optimize, CompileCache *cache) {
+    std::istringstream in(text);
+    if (is_image(in)) {
+        bool optimized = false;
+        PTR(Expr) e;
+        {
+            StatsTimer timer(Stats::parse_phase);
+            e = read_image(text, &optimized);
+        }
+        if (optimize && !optimized) {
+            StatsTimer timer(Stats::optimize_phase);
+            e = e->optimize();
+        }
+        return e;
+    }
+    
+    if (cache != nullptr) {
+        PTR(Expr) e = cache->lookup(text, optimize);
+        if (e != nullptr)
+            return e;
+    }
+    
+    PTR(Expr) e;
+    {
+        StatsTimer timer(Stats::parse_phase);
+        e = parse(in);
+    }
+    if (optimize) {
+        StatsTimer timer(Stats::optimize_phase);
+        e = e->optimize();
+    }
+    if (cache != nullptr)
+        cache->store(text, optimize, e);
+    return e;
+}
+
+// For `--serve`: runs one request's program the way `msdscript`
+// with its flags would, each under the server's budget
+static ExecResult serve_request(const std::string &flags, const std::string &program,
+                                long fuel, long timeout_ms) {
+    ExecResult r;
+    bool opt = false, step = false, types = false;
+    std::istringstream words(flags);
+    std::string flag;
+    while (words >> flag) {
+        if (flag == "--opt")
+            opt = true;
+        else if (flag == "--step")
+            step = true;
+        else if (flag == "--types")
+            types = true;
+        else {
+            r.exit_code = 1;
+            r.err = "Unknown mode: " + flag + "\n";
+            return r;
+        }
+    }
+    if ((opt ? 1 : 0) + (step ? 1 : 0) + (types ? 1 : 0) > 1) {
+        r.exit_code = 1;
+        r.err = "Unknown mode: " + flags + "\n";
+        return r;
+    }
+    
+    if (fuel > 0 || timeout_ms > 0)
+        Budget::start(fuel, timeout_ms);
+    SourceMap::recording = !opt;
+    try {
+        PTR(Expr) e = read_program(program, opt, nullptr);
+        if (opt)
+            r.out = e->to_string() + "\n";
+        else if (types)
+            r.out = TypeCheck::infer(e) + "\n";
+        else {
+            TypeCheck::mark(e);
+            PTR(Val) v = step ? Step::interp_by_steps(e) : e->to_value(Env::emptyenv);
+            r.out = v->to_string() + "\n";
+        }
+    } catch (OutOfBudget &exn) {
+        r.exit_code = 2;
+        r.err = std::string(exn.what()) + "\n";
+    } catch (std::bad_alloc &) {
+        r.exit_code = 2;
+        r.err = "out of memory\n";
+    } catch (std::runtime_error &exn) {
+        r.exit_code = 1;
+        r.err = SourceMap::describe(exn, program) + "\n";
+    }
+    Budget::stop();
+    return r;
+}
+
+static void usage_error(const char *arg) {
+    std::cerr << "Unknown mode: " << arg << std::endl;
+    exit(1);
+}
 
 int main(int argc, char *argv[]) {
     
 //    Catch::Session().run(argc, argv);
     
+    bool opt = false, step = false, compile = false, cache_stats = false, memo_stats = false, jit_stats = false;
+    bool parallel = false, types = false, generate = false, repl = false, emit_c = false;
+    unsigned generate_seed = 0;
+    GenOptions shape;
+    long fuel = 0, timeout_ms = 0;
+    int threads = (int)std::thread::hardware_concurrency() - 1;
+    const char *cache_dir = nullptr;
+    const char *profile_file = nullptr;
+    const char *serve_path = nullptr;
+    const char *incremental_path = nullptr;
+    const char *build_c_output = nullptr;
+    int workers = (int)std::thread::hardware_concurrency();
+    Profiler::mode_t profile_mode = Profiler::off;
     
-    if (argc == 1) {
-        std::cout << parse(std::cin)->to_value(Env::emptyenv)->to_string() << std::endl;
-    } else if (argc == 2 && strcmp(argv[1], "--opt")==0) {
-        std::cout << parse(std::cin)->optimize()->to_string() <<std::endl;
-    } else if (argc == 2 && strcmp(argv[1], "--step")==0) {
-        std::cout << Step::interp_by_steps(parse(std::cin))->to_string() << std::endl;
-    } else {
-        std::cerr << "Unknown mode: " << argv[1] << std::endl;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--opt")==0 && !opt)
+            opt = true;
+        else if (strcmp(argv[i], "--step")==0 && !step)
+            step = true;
+        else if (strcmp(argv[i], "--compile")==0 && !compile)
+            compile = true;
+        else if (strcmp(argv[i], "--types")==0 && !types)
+            types = true;
+        else if (strcmp(argv[i], "--cache")==0 && i + 1 < argc)
+            cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--cache-stats")==0)
+            cache_stats = true;
+        else if (strcmp(argv[i], "--memo")==0)
+            CallMemo::enabled = true;
+        else if (strcmp(argv[i], "--memo-size")==0 && i + 1 < argc) {
+            CallMemo::enabled = true;
+            CallMemo::capacity = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--memo-stats")==0)
+            memo_stats = true;
+        else if (strcmp(argv[i], "--jit")==0)
+            Jit::enabled = true;
+        else if (strcmp(argv[i], "--jit-threshold")==0 && i + 1 < argc) {
+            Jit::enabled = true;
+            Jit::threshold = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--jit-stats")==0)
+            jit_stats = true;
+        else if (strcmp(argv[i], "--parallel")==0)
+            parallel = true;
+        else if (strcmp(argv[i], "--threads")==0 && i + 1 < argc) {
+            parallel = true;
+            threads = atoi(argv[++i]) - 1;
+        } else if (strcmp(argv[i], "--stats")==0)
+            Stats::enabled = true;
+        else if (strcmp(argv[i], "--fuel")==0 && i + 1 < argc)
+            fuel = atol(argv[++i]);
+        else if (strcmp(argv[i], "--timeout")==0 && i + 1 < argc)
+            timeout_ms = atol(argv[++i]);
+        else if (strcmp(argv[i], "--profile")==0 && i + 1 < argc) {
+            profile_mode = Profiler::counting;
+            profile_file = argv[++i];
+        } else if (strcmp(argv[i], "--profile-sample")==0 && i + 1 < argc) {
+            profile_mode = Profiler::sampling;
+            profile_file = argv[++i];
+        } else if (strcmp(argv[i], "--generate")==0 && i + 1 < argc) {
+            generate = true;
+            generate_seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--serve")==0 && i + 1 < argc)
+            serve_path = argv[++i];
+        else if (strcmp(argv[i], "--incremental")==0 && i + 1 < argc)
+            incremental_path = argv[++i];
+        else if (strcmp(argv[i], "--emit-c")==0)
+            emit_c = true;
+        else if (strcmp(argv[i], "--build-c")==0 && i + 1 < argc)
+            build_c_output = argv[++i];
+        else if (strcmp(argv[i], "--repl")==0)
+            repl = true;
+        else if (strcmp(argv[i], "--workers")==0 && i + 1 < argc)
+            workers = atoi(argv[++i]);
+        else if (!shape.take_flag(argc, argv, i))
+            usage_error(argv[i]);
+    }
+    if (step && (opt || compile))
+        usage_error("--step");
+    if (parallel && (step || opt || compile))
+        usage_error("--parallel");
+    if (types && (step || opt || compile || parallel))
+        usage_error("--types");
+    if (serve_path != nullptr && (step || opt || compile || types || parallel || generate || cache_dir != nullptr
+                                  || profile_mode != Profiler::off))
+        usage_error("--serve");
+    if (repl && (opt || compile || types || parallel || generate || cache_dir != nullptr
+                 || serve_path != nullptr || profile_mode != Profiler::off))
+        usage_error("--repl");
+    if (incremental_path != nullptr && (opt || compile || types || parallel || generate
+                                        || serve_path != nullptr || repl))
+        usage_error("--incremental");
+    if ((emit_c || build_c_output != nullptr)
+        && (step || compile || types || parallel || generate || serve_path != nullptr || repl
+            || incremental_path != nullptr || fuel > 0 || timeout_ms > 0 || profile_mode != Profiler::off))
+        usage_error(emit_c ? "--emit-c" : "--build-c");
+    if (Jit::enabled && !Jit::supported) {
+        std::cerr << "--jit needs an x86-64 machine" << std::endl;
+        exit(1);
+    }
+    // Native code neither steps, charges fuel, profiles, memoizes
+    // nor runs in parallel, and an arena is reset under it by --serve
+    if (Jit::enabled && (step || parallel || CallMemo::enabled || fuel > 0 || timeout_ms > 0
+                         || profile_mode != Profiler::off || serve_path != nullptr))
+        usage_error("--jit");
+    
+    if (generate) {
+        std::cout << Gen::program(generate_seed, shape) << std::endl;
+        return 0;
+    }
+    
+    if (serve_path != nullptr) {
+        try {
+            Server::run(serve_path, workers, [=](const std::string &flags, const std::string &program) {
+                return serve_request(flags, program, fuel, timeout_ms);
+            });
+        } catch (std::runtime_error &exn) {
+            std::cerr << exn.what() << std::endl;
+            exit(1);
+        }
+        return 0;
+    }
+    
+    if (repl) {
+        Repl session;
+        session.step = step;
+        session.fuel = fuel;
+        session.timeout_ms = timeout_ms;
+        session.loop(std::cin, std::cout, std::cerr, isatty(0));
+        if (memo_stats)
+            CallMemo::report(std::cerr);
+        if (jit_stats)
+            Jit::report(std::cerr);
+        if (Stats::enabled)
+            Stats::report(std::cerr);
+        return 0;
+    }
+    
+    std::string text((std::istreambuf_iterator<char>(std::cin)),
+                     std::istreambuf_iterator<char>());
+    CompileCache cache(cache_dir != nullptr ? cache_dir : "");
+    Incremental incremental(incremental_path != nullptr ? incremental_path : "");
+    
+    if (fuel > 0 || timeout_ms > 0)
+        Budget::start(fuel, timeout_ms);
+    if (profile_mode != Profiler::off && !(opt || compile))
+        Profiler::start(profile_mode, 1000);
+    
+    // Only evaluation reports where an error happened
+    SourceMap::recording = !(opt || compile);
+    
+    try {
+        PTR(Expr) e = read_program(text, opt, cache_dir != nullptr ? &cache : nullptr);
+        
+        if (compile)
+            write_image(e, std::cout, opt);
+        else if (emit_c)
+            CEmitter::emit(e, text, std::cout);
+        else if (build_c_output != nullptr) {
+            std::ostringstream unit;
+            CEmitter::emit(e, text, unit);
+            CEmitter::build(unit.str(), build_c_output);
+        } else if (opt)
+            std::cout << e->to_string() << std::endl;
+        else if (types)
+            std::cout << TypeCheck::infer(e) << std::endl;
+        else {
+            {
+                // A program with a type runs without checking values
+                StatsTimer timer(Stats::typecheck_phase);
+                TypeCheck::mark(e);
+            }
+            PTR(Val) v;
+            {
+                StatsTimer timer(Stats::evaluate_phase);
+                if (incremental_path != nullptr)
+                    v = incremental.evaluate(e, step);
+                else if (step)
+                    v = Step::interp_by_steps(e);
+                else if (parallel) {
+                    Parallel::start(threads);
+                    Parallel::prepare(e);
+                    v = e->to_value(Env::emptyenv);
+                    Parallel::stop();
+                } else
+                    v = e->to_value(Env::emptyenv);
+            }
+            std::cout << v->to_string() << std::endl;
+        }
+    } catch (OutOfBudget &exn) {
+        Parallel::stop();
+        std::cerr << exn.what() << std::endl;
+        exit(2);
+    } catch (std::bad_alloc &) {
+        Parallel::stop();
+        std::cerr << "out of memory" << std::endl;
+        exit(2);
+    } catch (std::runtime_error &exn) {
+        Parallel::stop();
+        std::cerr << SourceMap::describe(exn, text) << std::endl;
         exit(1);
     }
+    
+    if (Profiler::mode != Profiler::off) {
+        std::ofstream out(profile_file);
+        Profiler::write_folded(out);
+        Profiler::stop();
+    }
+    if (cache_stats)
+        std::cerr << "cache: " << cache.hits << " hits, " << cache.misses << " misses" << std::endl;
+    if (incremental_path != nullptr) {
+        incremental.save();
+        if (cache_stats)
+            std::cerr << "incremental: " << incremental.reused << " parts reused, "
+                      << incremental.computed << " computed" << std::endl;
+    }
+    if (memo_stats)
+        CallMemo::report(std::cerr);
+    if (jit_stats)
+        Jit::report(std::cerr);
+    if (Stats::enabled)
+        Stats::report(std::cerr);
 
 //     insert code here...
 //    std::cout << "Hello, World!\n";
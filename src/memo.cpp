@@ -0,0 +1,241 @@
+//
+//  memo.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <sstream>
+#include "memo.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+
+bool CallMemo::enabled = false;
+size_t CallMemo::capacity = 65536;
+
+long CallMemo::hits = 0;
+long CallMemo::misses = 0;
+long CallMemo::evictions = 0;
+
+static size_t env_hash(PTR(Env) env);
+
+static size_t combine(size_t h, size_t v) {
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+static size_t val_hash(PTR(Val) val) {
+    PTR(NumVal) n = CAST(NumVal)(val);
+    if (n != nullptr)
+        return n->big != nullptr ? n->big->hash() : std::hash<long long>()(n->rep);
+    PTR(BoolVal) b = CAST(BoolVal)(val);
+    if (b != nullptr)
+        return b->rep ? 1 : 2;
+    PTR(FunVal) f = CAST(FunVal)(val);
+    if (f != nullptr)
+        return combine(std::hash<Expr*>()(&*f->body), env_hash(f->env));
+    return 0;
+}
+
+// Environments never change, so an `ExtendedEnv` keeps its hash
+// once computed
+static size_t env_hash(PTR(Env) env) {
+    PTR(ExtendedEnv) ee = CAST(ExtendedEnv)(env);
+    if (ee == nullptr)
+        return 0;
+    if (ee->hash == 0) {
+        size_t h = combine(env_hash(ee->rest), std::hash<std::string>()(ee->name));
+        h = combine(h, val_hash(ee->val));
+        ee->hash = (h == 0) ? 1 : h;
+    }
+    return ee->hash;
+}
+
+static bool env_equals(PTR(Env) a, PTR(Env) b);
+
+// Like `Val::equals`, but closures are the same only when they share
+// a body object, which is much cheaper than comparing bodies
+static bool val_equals(PTR(Val) a, PTR(Val) b) {
+    if (a == b)
+        return true;
+    PTR(FunVal) fa = CAST(FunVal)(a);
+    if (fa == nullptr)
+        return a->equals(b);
+    PTR(FunVal) fb = CAST(FunVal)(b);
+    return (fb != nullptr
+            && fa->body == fb->body
+            && fa->formal_arg == fb->formal_arg
+            && env_equals(fa->env, fb->env));
+}
+
+static bool env_equals(PTR(Env) a, PTR(Env) b) {
+    while (a != b) {
+        PTR(ExtendedEnv) ea = CAST(ExtendedEnv)(a);
+        PTR(ExtendedEnv) eb = CAST(ExtendedEnv)(b);
+        if (ea == nullptr || eb == nullptr)
+            return ea == eb;
+        if (ea->hash != 0 && eb->hash != 0 && ea->hash != eb->hash)
+            return false;
+        if (ea->name != eb->name || !val_equals(ea->val, eb->val))
+            return false;
+        a = ea->rest;
+        b = eb->rest;
+    }
+    return true;
+}
+
+class MemoKey {
+public:
+    PTR(Expr) body;
+    PTR(Env) env;
+    PTR(Val) arg;
+    size_t hash;
+    
+    MemoKey(PTR(Expr) body, PTR(Env) env, PTR(Val) arg) {
+        this->body = body;
+        this->env = env;
+        this->arg = arg;
+        this->hash = combine(combine(std::hash<Expr*>()(&*body), env_hash(env)), val_hash(arg));
+    }
+    
+    bool operator==(const MemoKey &other) const {
+        return (hash == other.hash
+                && body == other.body
+                && val_equals(arg, other.arg)
+                && env_equals(env, other.env));
+    }
+};
+
+class MemoKeyHash {
+public:
+    size_t operator()(const MemoKey &key) const {
+        return key.hash;
+    }
+};
+
+typedef std::list<std::pair<MemoKey, PTR(Val)>> memo_list_t;
+
+// Most recently used entries are at the front
+static memo_list_t memo_list;
+static std::unordered_map<MemoKey, memo_list_t::iterator, MemoKeyHash> memo_table;
+// Held while using the table (and computing environment hashes),
+// since --parallel can make calls from several threads
+static std::mutex memo_lock;
+
+bool CallMemo::memoizable(PTR(Val) arg) {
+    return CAST(NumVal)(arg) != nullptr || CAST(BoolVal)(arg) != nullptr;
+}
+
+PTR(Val) CallMemo::lookup(PTR(Expr) body, PTR(Env) env, PTR(Val) arg) {
+    std::lock_guard<std::mutex> guard(memo_lock);
+    auto found = memo_table.find(MemoKey(body, env, arg));
+    if (found == memo_table.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    memo_list.splice(memo_list.begin(), memo_list, found->second);
+    return found->second->second;
+}
+
+void CallMemo::store(PTR(Expr) body, PTR(Env) env, PTR(Val) arg, PTR(Val) result) {
+    std::lock_guard<std::mutex> guard(memo_lock);
+    MemoKey key(body, env, arg);
+    if (memo_table.find(key) != memo_table.end())
+        return;
+    if (capacity == 0)
+        return;
+    if (memo_table.size() >= capacity) {
+        memo_table.erase(memo_list.back().first);
+        memo_list.pop_back();
+        evictions++;
+    }
+    memo_list.push_front(std::make_pair(key, result));
+    memo_table[key] = memo_list.begin();
+}
+
+void CallMemo::reset() {
+    std::lock_guard<std::mutex> guard(memo_lock);
+    memo_table.clear();
+    memo_list.clear();
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+}
+
+void CallMemo::report(std::ostream &out) {
+    std::lock_guard<std::mutex> guard(memo_lock);
+    long calls = hits + misses;
+    out << "memo: " << hits << " hits, " << misses << " misses";
+    if (calls > 0)
+        out << " (" << (100 * hits / calls) << "% hit rate)";
+    out << ", " << evictions << " evictions, "
+        << memo_table.size() << " entries" << std::endl;
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "call memoization" ) {
+    PTR(Expr) fib = parse_str("_let fib = _fun (fib)"
+                              "              _fun (x)"
+                              "                 _if x == 0"
+                              "                 _then 1"
+                              "                 _else _if x == 1"
+                              "                 _then 1"
+                              "                 _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+                              "_in fib(fib)(30)");
+    CallMemo::reset();
+    CallMemo::enabled = true;
+    
+    CHECK( fib->to_value(Env::emptyenv)->to_string() == "1346269" );
+    CHECK( CallMemo::hits > 0 );
+    // Without memoization, this would take over a million calls
+    CHECK( CallMemo::misses < 100 );
+    
+    CallMemo::reset();
+    CHECK( Step::interp_by_steps(fib)->to_string() == "1346269" );
+    CHECK( CallMemo::misses < 100 );
+    
+    // Closures over different values are different functions
+    CallMemo::reset();
+    CHECK( parse_str("_let add = _fun(x) _fun(y) x + y"
+                     "_in add(1)(10) + add(2)(10) + add(1)(10)")
+          ->to_value(Env::emptyenv)->to_string() == "34" );
+    CHECK( Step::interp_by_steps(parse_str("_let add = _fun(x) _fun(y) x + y"
+                                           "_in add(1)(10) + add(2)(10) + add(1)(10)"))
+          ->to_string() == "34" );
+    
+    // Function arguments are not remembered
+    CallMemo::reset();
+    CHECK( parse_str("(_fun(f) f(1))(_fun(x) x + 1)")->to_value(Env::emptyenv)->to_string() == "2" );
+    CHECK( CallMemo::hits + CallMemo::misses == 1 );
+    
+    // The table stays within its bound
+    CallMemo::reset();
+    CallMemo::capacity = 4;
+    CHECK( parse_str("_let fib = _fun (fib)"
+                     "              _fun (x)"
+                     "                 _if x == 0 _then 1"
+                     "                 _else _if x == 1 _then 1"
+                     "                 _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+                     "_in fib(fib)(15)")->to_value(Env::emptyenv)->to_string() == "987" );
+    CHECK( CallMemo::evictions > 0 );
+    std::ostringstream report;
+    CallMemo::report(report);
+    CHECK( report.str().find("4 entries") != std::string::npos );
+    
+    CallMemo::capacity = 65536;
+    CallMemo::enabled = false;
+    CallMemo::reset();
+}
@@ -0,0 +1,53 @@
+//
+//  memo.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef memo_hpp
+#define memo_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include "pointer.hpp"
+
+class Expr;
+class Env;
+class Val;
+
+/* Since evaluation has no side effects, a function called again with
+ the same argument must produce the same value. When `enabled`, calls
+ whose argument is a number or boolean are remembered in a table
+ bounded to `capacity` entries, dropping the least recently used.
+ 
+ A closure is identified by its body (the `Expr` object, not its
+ text) and its environment compared by value, so the fresh but equal
+ closures made by `fib(fib)` on every recursive call all share
+ entries. */
+class CallMemo {
+public:
+    static bool enabled;
+    static size_t capacity;
+    
+    static long hits;
+    static long misses;
+    static long evictions;
+    
+    // Whether a call with this argument can be remembered
+    static bool memoizable(PTR(Val) arg);
+    
+    // The remembered result of calling the closure with `arg`,
+    // or `nullptr`
+    static PTR(Val) lookup(PTR(Expr) body, PTR(Env) env, PTR(Val) arg);
+    
+    static void store(PTR(Expr) body, PTR(Env) env, PTR(Val) arg, PTR(Val) result);
+    
+    // Forgets all entries and statistics
+    static void reset();
+    
+    static void report(std::ostream &out);
+};
+
+#endif /* memo_hpp */
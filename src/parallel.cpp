@@ -0,0 +1,331 @@
+//
+//  parallel.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include "parallel.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "parse.hpp"
+
+bool Parallel::enabled = false;
+long Parallel::threshold = 2000;
+
+// Once a worker has this many tasks waiting, nobody is keeping up
+// with stealing them, so new work is done directly instead
+static const size_t MAX_WAITING = 8;
+
+// Thrown inside a stolen task to stop it; never escapes `Task::run`
+class Abandoned { };
+
+class Task {
+public:
+    PTR(Expr) expr;
+    PTR(Env) env;
+    PTR(Val) val;
+    std::exception_ptr error;
+    std::atomic<bool> done;
+    // Set by the owner when it no longer wants the result
+    std::atomic<bool> cancelled;
+    // Set when the thief gave up before finishing
+    bool abandoned;
+
+    Task(PTR(Expr) expr, PTR(Env) env) : done(false), cancelled(false), abandoned(false) {
+        this->expr = expr;
+        this->env = env;
+    }
+
+    void run() {
+        Task *outer = Parallel::running_task;
+        Parallel::running_task = this;
+        try {
+            val = expr->to_value(env);
+        } catch (Abandoned &) {
+            abandoned = true;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        Parallel::running_task = outer;
+        done.store(true, std::memory_order_release);
+    }
+};
+
+// The owner pushes and pops at the back; thieves take from the front
+class Worker {
+public:
+    std::mutex lock;
+    std::deque<std::shared_ptr<Task>> tasks;
+};
+
+static std::vector<Worker*> workers;
+static std::vector<std::thread> threads;
+static std::atomic<bool> running(false);
+static std::atomic<long> waiting(0);
+static std::mutex idle_lock;
+static std::condition_variable idle;
+
+thread_local Task *Parallel::running_task = nullptr;
+
+// Index of this thread's worker; threads outside the pool share 0
+static thread_local size_t self = 0;
+
+// A stolen task gives up once this thread's stack pointer passes
+// below `stack_floor`, leaving the last quarter of the stack unused
+static thread_local char *stack_floor = nullptr;
+
+static void find_stack_floor() {
+    char *low;
+    size_t size;
+#ifdef __APPLE__
+    size = pthread_get_stacksize_np(pthread_self());
+    low = (char *)pthread_get_stackaddr_np(pthread_self()) - size;
+#else
+    pthread_attr_t attr;
+    void *addr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return;
+    pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    low = (char *)addr;
+#endif
+    stack_floor = low + size / 4;
+}
+
+static bool push(std::shared_ptr<Task> t) {
+    Worker *w = workers[self];
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (w->tasks.size() >= MAX_WAITING)
+            return false;
+        w->tasks.push_back(t);
+    }
+    waiting++;
+    idle.notify_one();
+    return true;
+}
+
+// Takes `t` back if no other worker has stolen it
+static bool unpush(const std::shared_ptr<Task> &t) {
+    Worker *w = workers[self];
+    std::lock_guard<std::mutex> guard(w->lock);
+    if (w->tasks.empty() || w->tasks.back() != t)
+        return false;
+    w->tasks.pop_back();
+    waiting--;
+    return true;
+}
+
+static std::shared_ptr<Task> find_task() {
+    {
+        Worker *w = workers[self];
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (!w->tasks.empty()) {
+            std::shared_ptr<Task> t = w->tasks.back();
+            w->tasks.pop_back();
+            waiting--;
+            return t;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker *w = workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (!w->tasks.empty()) {
+            std::shared_ptr<Task> t = w->tasks.front();
+            w->tasks.pop_front();
+            waiting--;
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+static void work(size_t index) {
+    self = index;
+    find_stack_floor();
+    while (running.load()) {
+        std::shared_ptr<Task> t = find_task();
+        if (t != nullptr) {
+            t->run();
+        } else {
+            std::unique_lock<std::mutex> guard(idle_lock);
+            idle.wait_for(guard, std::chrono::milliseconds(1),
+                          [] { return waiting.load() > 0 || !running.load(); });
+        }
+    }
+}
+
+void Parallel::start(int count) {
+    if (count < 0)
+        count = 0;
+    running = true;
+    self = 0;
+    find_stack_floor();
+    for (int i = 0; i <= count; i++)
+        workers.push_back(new Worker());
+    for (int i = 1; i <= count; i++)
+        threads.push_back(std::thread(work, (size_t)i));
+    enabled = true;
+}
+
+void Parallel::stop() {
+    // A thief may still be running a cancelled task, which only
+    // stops at a `poll` while `enabled` is set
+    running = false;
+    idle.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+    threads.clear();
+    enabled = false;
+    for (Worker *w : workers)
+        delete w;
+    workers.clear();
+}
+
+void Parallel::prepare(PTR(Expr) e) {
+    (void)e->cost();
+}
+
+void Parallel::check() {
+    char here;
+    if (running_task->cancelled.load(std::memory_order_relaxed)
+        || (stack_floor != nullptr && &here < stack_floor))
+        throw Abandoned();
+}
+
+void Parallel::to_values(PTR(Expr) first, PTR(Expr) second, PTR(Env) env,
+                         PTR(Val) &first_val, PTR(Val) &second_val) {
+    if (first->cost() < threshold || second->cost() < threshold) {
+        first_val = first->to_value(env);
+        second_val = second->to_value(env);
+        return;
+    }
+    
+    // Shared with a thief, which may still hold it after we return
+    std::shared_ptr<Task> t = std::make_shared<Task>(second, env);
+    if (!push(t)) {
+        first_val = first->to_value(env);
+        second_val = second->to_value(env);
+        return;
+    }
+
+    std::exception_ptr first_error;
+    try {
+        first_val = first->to_value(env);
+    } catch (...) {
+        first_error = std::current_exception();
+    }
+
+    if (unpush(t)) {
+        // Nobody stole it, so it is just the sequential case
+        if (first_error)
+            std::rethrow_exception(first_error);
+        second_val = second->to_value(env);
+        return;
+    }
+
+    if (first_error) {
+        // Sequential evaluation would never have started the second
+        t->cancelled = true;
+        std::rethrow_exception(first_error);
+    }
+
+    // Someone else is running it; help with other work meanwhile
+    while (!t->done.load(std::memory_order_acquire)) {
+        if (running_task != nullptr && running_task->cancelled.load(std::memory_order_relaxed)) {
+            t->cancelled = true;
+            throw Abandoned();
+        }
+        std::shared_ptr<Task> other = find_task();
+        if (other != nullptr)
+            other->run();
+        else
+            std::this_thread::yield();
+    }
+
+    if (t->abandoned) {
+        // The thief ran short of stack; this thread may have more
+        second_val = second->to_value(env);
+        return;
+    }
+    if (t->error)
+        std::rethrow_exception(t->error);
+    second_val = t->val;
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+/* for tests */
+static std::string to_value_error(PTR(Expr) e) {
+    try {
+        (void)e->to_value(Env::emptyenv);
+        return "";
+    } catch (const std::runtime_error &exn) {
+        return exn.what();
+    }
+}
+
+TEST_CASE( "parallel evaluation" ) {
+    CHECK( parse_str("1 + 2")->cost() == 3 );
+    CHECK( parse_str("(_fun(x) x + 1)(1)")->cost() > 1000 );
+    CHECK( parse_str("_if _true _then f(1) _else 2")->cost() > 1000 );
+
+    PTR(Expr) fib = parse_str("_let fib = _fun (fib)"
+                              "              _fun (x)"
+                              "                 _if x == 0 _then 1"
+                              "                 _else _if x == 1 _then 1"
+                              "                 _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+                              "_in fib(fib)(18)");
+    const char *errors[] = {
+        "(1 + _true) + x",
+        "x + (1 + _true)",
+        "(f(1) + _true) * (g(1) + 2)",
+        "(_fun(x) x + 1)(1)(2) == (_fun(x) x)(y)",
+        "(_fun(x) x + 1)(1) + (_fun(x) x)(_true)",
+        // The second operand would never finish, or overflow the stack
+        "(_let fib = _fun (fib)"
+        "            _fun (x)"
+        "               _if x == 0 _then 1"
+        "               _else _if x == 1 _then 1"
+        "               _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+        " _in fib(fib)(18) + _true)"
+        " + (_let f = _fun(f) _fun(n) f(f)(n + 1) _in f(f)(0))"
+    };
+
+    long old_threshold = Parallel::threshold;
+    Parallel::threshold = 1;
+    Parallel::start(3);
+    Parallel::prepare(fib);
+
+    CHECK( fib->to_value(Env::emptyenv)->to_string() == "4181" );
+    for (const char *error : errors) {
+        PTR(Expr) e = parse_str(error);
+        Parallel::prepare(e);
+        Parallel::enabled = false;
+        std::string expected = to_value_error(e);
+        Parallel::enabled = true;
+        CHECK( expected != "" );
+        CHECK( to_value_error(e) == expected );
+    }
+
+    Parallel::stop();
+    Parallel::threshold = old_threshold;
+}
@@ -0,0 +1,78 @@
+//
+//  parallel.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <stdio.h>
+#include "pointer.hpp"
+
+class Expr;
+class Env;
+class Val;
+class Task;
+
+/* Evaluation has no side effects, so the two operands of `+`, `*`
+ and `==`, and a call's function and argument, can be evaluated at
+ the same time. When `enabled`, `to_value` hands the second operand
+ to a pool of workers (fork) while it evaluates the first, then waits
+ for it (join). Each worker keeps its own deque of tasks and takes
+ from the others' when it runs out (work stealing), and a thread
+ waiting for a join runs other tasks instead of sleeping.
+ 
+ Only operands whose `cost` estimate reaches `threshold` become
+ tasks; small ones are evaluated directly. A task nobody has taken
+ yet by the time of the join is run inline by its owner, so spare
+ parallelism costs one deque push and pop.
+ 
+ Results and errors are the same as sequential evaluation: when
+ both operands fail, the first one's error wins. When the first fails
+ while a thief is still running the second, the error is raised at
+ once and the task is cancelled; the thief notices at its next call
+ (`poll`) and drops it. A thief also drops a task that gets close to
+ the end of its stack, and the owner then evaluates that operand
+ itself, so a stolen task never crashes a program that sequential
+ evaluation would have stopped with an error first. */
+class Parallel {
+public:
+    static bool enabled;
+    static long threshold;
+    
+    // Starts `workers` threads in addition to the calling one
+    // (which becomes worker 0) and sets `enabled`
+    static void start(int workers);
+    
+    // Stops the worker threads and clears `enabled`
+    static void stop();
+    
+    // Fills in the cost estimate of every node in `e` before any
+    // worker can look at them
+    static void prepare(PTR(Expr) e);
+    
+    // Evaluates `first` and then `second` in `env`, perhaps at the
+    // same time
+    static void to_values(PTR(Expr) first, PTR(Expr) second, PTR(Env) env,
+                          PTR(Val) &first_val, PTR(Val) &second_val);
+    
+    // Called on every function call while `enabled`; stops a stolen
+    // task that was cancelled or is running out of stack
+    static inline void poll() {
+        if (running_task != nullptr)
+            check();
+    }
+    
+private:
+    friend class Task;
+    
+    // The stolen task this thread is running, if any
+    static thread_local Task *running_task;
+    
+    static void check();
+};
+
+#endif /* parallel_hpp */
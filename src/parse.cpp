@@ -8,12 +8,14 @@
 
 #include <iostream>
 #include <sstream>
+#include <climits>
 #include "parse.hpp"
 #include "catch.hpp"
 #include "expr.hpp"
 #include "Env.hpp"
 #include "value.hpp"
 #include "step.hpp"
+#include "source.hpp"
 
 PTR(Expr) parse(std::istream &in);
 static PTR(Expr) parse_expr(std::istream &in);
@@ -24,11 +26,14 @@ static PTR(Expr) parse_inner(std::istream &in);
 static PTR(Expr) parse_number(std::istream &in);
 static PTR(Expr) parse_variable(std::istream &in);
 static PTR(Expr) parse_let(std::istream &in);
+static PTR(Expr) parse_let_rhs(std::istream &in, std::string &name);
 static PTR(Expr) parse_if(std::istream &in);
-static PTR(Expr) parse_fun(std::istream &in);
+static PTR(Expr) parse_fun(std::istream &in, long start);
 static std::string parse_keyword(std::istream &in);
 static std::string parse_alphabetic(std::istream &in, std::string prefix);
 static char peek_after_spaces(std::istream &in);
+static long position(std::istream &in);
+static long mark(std::istream &in);
 
 // Take an input stream that contains an expression,
 // and returns the parsed representation of that expression.
@@ -46,6 +51,26 @@ PTR(Expr) parse(std::istream &in) {
     return e;
 }
 
+PTR(Expr) parse_entry(std::istream &in, std::string &name) {
+    name = "";
+    if (peek_after_spaces(in) == '_') {
+        std::streampos start = in.tellg();
+        if (parse_keyword(in) == "_let") {
+            std::string var_name;
+            PTR(Expr) rhs = parse_let_rhs(in, var_name);
+            peek_after_spaces(in);
+            if (in.eof()) {
+                name = var_name;
+                return rhs;
+            }
+        }
+        // Anything else is an expression after all
+        in.clear();
+        in.seekg(start);
+    }
+    return parse(in);
+}
+
 // Takes an input stream that starts with an expression,
 // consuming the largest initial expression possible.
 static PTR(Expr) parse_expr(std::istream &in) {
@@ -69,9 +94,11 @@ static PTR(Expr) parse_comparg(std::istream &in){
     
     char c = peek_after_spaces(in);
     if(c == '+'){
+        long at = mark(in);
         in >> c;
         PTR(Expr) rhs = parse_comparg(in);
         e = NEW(AddExpr)(e, rhs);
+        SourceMap::record(e, at, 1);
     }
     return e;
 }
@@ -86,9 +113,11 @@ static PTR(Expr) parse_addend(std::istream &in) {
   
   char c = peek_after_spaces(in);
   if (c == '*') {
+    long at = mark(in);
     c = in.get();
     PTR(Expr) rhs = parse_addend(in);
     e = NEW(MultExpr)(e, rhs);
+    SourceMap::record(e, at, 1);
   }
   
   return e;
@@ -98,8 +127,10 @@ static PTR(Expr) parse_multicand(std::istream &in) {
     PTR(Expr) e = parse_inner(in);
     
     while (peek_after_spaces(in) == '(') {
+        long at = mark(in);
         PTR(Expr) actual_arg = parse_inner(in);
         e = NEW(CallFunExpr)(e, actual_arg);
+        SourceMap::record(e, at, 1);
     }
     
     return e;
@@ -122,8 +153,11 @@ static PTR(Expr) parse_inner(std::istream &in) {
   } else if (isdigit(c) || c == '-') {
       e = parse_number(in);
   } else if (isalpha(c)) {
+      long at = mark(in);
       e = parse_variable(in);
+      SourceMap::record(e, at, CAST(VarExpr)(e)->name.length());
   } else if (c == '_') {
+      long start = position(in);
       std::string keyword = parse_keyword(in);
       if (keyword == "_true")
           return NEW(BoolExpr)(true);
@@ -131,10 +165,13 @@ static PTR(Expr) parse_inner(std::istream &in) {
           return NEW(BoolExpr)(false);
       else if (keyword == "_let" )
           return parse_let(in);
-      else if (keyword == "_if")
-          return parse_if(in);
+      else if (keyword == "_if") {
+          e = parse_if(in);
+          SourceMap::record(e, SourceMap::recording ? start : -1, 3);
+          return e;
+      }
       else if (keyword == "_fun")
-          return parse_fun(in);
+          return parse_fun(in, start);
       else
           throw std::runtime_error((std::string)"unknown input: " + keyword);
   } else {
@@ -144,23 +181,22 @@ static PTR(Expr) parse_inner(std::istream &in) {
   return e;
 }
 
-// Parses a number, assuming that `in` starts with a digit.
+// Parses a number, assuming that `in` starts with a digit or `-`.
+// One that does not fit in a `long long` becomes a `BigNum`.
 static PTR(Expr) parse_number(std::istream &in) {
-    char next = in.peek();
-    
-    bool isNegative = false;
-    if (next == '-') {
-        isNegative = true;
-        in.get();
-    }
-    
-    int num = 0;
-    in >> num;
-    
-    if (isNegative)
-        return NEW(NumExpr)(-num);
-    else
-        return NEW(NumExpr)(num);
+    std::string digits;
+    if (in.peek() == '-')
+        digits += in.get();
+    
+    while (isdigit(in.peek()))
+        digits += in.get();
+    if (digits == "-")
+        throw std::runtime_error("expected a digit after -");
+    
+    // Up to 18 digits always fit
+    if (digits.length() <= 18)
+        return NEW(NumExpr)(std::stoll(digits));
+    return NEW(NumExpr)(BigNum::from_string(digits));
 }
 
 // Parses an expression, assuming that `in` starts with a letter.
@@ -187,10 +223,23 @@ static std::string parse_alphabetic(std::istream &in, std::string prefix) {
 }
 
 static PTR(Expr) parse_let(std::istream &in) {
+    std::string varName;
+    PTR(Expr) expr_rhs = parse_let_rhs(in, varName);
+    std::string _in = parse_keyword(in);
+    
+    if (_in != "_in")
+        throw std::runtime_error((std::string)"expected _in, but found " + _in);
+    
+    PTR(Expr) expr = parse_expr(in);
+    return NEW(LetExpr)(varName, expr_rhs, expr);
+}
+
+// Parses the `NAME = EXPR` after `_let`, setting `name`
+static PTR(Expr) parse_let_rhs(std::istream &in, std::string &name) {
     peek_after_spaces(in);
-    std::string varName = parse_alphabetic(in, "");
+    name = parse_alphabetic(in, "");
     
-    if (varName == "") {
+    if (name == "") {
         throw std::runtime_error((std::string)"variable name error");
     }
     char c = peek_after_spaces(in);
@@ -201,13 +250,13 @@ static PTR(Expr) parse_let(std::istream &in) {
     c = in.get();
     
     PTR(Expr) expr_rhs = parse_expr(in);
-    std::string _in = parse_keyword(in);
     
-    if (_in != "_in")
-        throw std::runtime_error((std::string)"expected _in, but found " + _in);
+    // Name a function after the variable it is bound to
+    PTR(FunExpr) fun_rhs = CAST(FunExpr)(expr_rhs);
+    if (fun_rhs != NULL)
+        fun_rhs->label = name;
     
-    PTR(Expr) expr = parse_expr(in);
-    return NEW(LetExpr)(varName, expr_rhs, expr);
+    return expr_rhs;
 }
 
 static PTR(Expr) parse_if(std::istream &in) {
@@ -225,7 +274,9 @@ static PTR(Expr) parse_if(std::istream &in) {
     return NEW(IfExpr)(if_part, then_part, else_part);
 }
 
-static PTR(Expr) parse_fun(std::istream &in) {
+// Parses a function; `start` is where its `_fun` keyword begins, so
+// that an unnamed function can be labeled by its span of the source
+static PTR(Expr) parse_fun(std::istream &in, long start) {
     char c = peek_after_spaces(in);
     
     if (c != '(')
@@ -242,7 +293,11 @@ static PTR(Expr) parse_fun(std::istream &in) {
     
     in.get();
     PTR(Expr) body = parse_expr(in);
-    return NEW(FunExpr)(formal_arg, body);
+    long end = position(in);
+    if (start < 0 || end < 0)
+        return NEW(FunExpr)(formal_arg, body);
+    return NEW(FunExpr)(formal_arg, body,
+                        "_fun@" + std::to_string(start) + "-" + std::to_string(end));
 }
 
 // Allow to run no matter has whitespace or not
@@ -257,6 +312,20 @@ static char peek_after_spaces(std::istream &in) {
   return c;
 }
 
+// Offset of the next character of `in`, or -1 if it has none
+// (as for a pipe). This asks the buffer directly, since `tellg`
+// also checks (and, at the end of the input, gives up on) the
+// stream's state, which costs more than the question itself.
+static long position(std::istream &in) {
+    return (long)in.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);
+}
+
+// Where the next node starts, for `SourceMap`; -1 (skipping the
+// lookup) when no spans are being recorded
+static long mark(std::istream &in) {
+    return SourceMap::recording ? position(in) : -1;
+}
+
 /* for tests */
 static PTR(Expr) parse_str(std::string s) {
   std::istringstream in(s);
@@ -275,6 +344,14 @@ static std::string parse_str_error(std::string s) {
 }
 
 TEST_CASE( "Simple expressions" ) {
+    // Numbers of any size
+    CHECK ( parse_str("2147483648")->equals(NEW(NumExpr)(2147483648LL)) );
+    CHECK ( parse_str("-9223372036854775808")->equals(NEW(NumExpr)(LLONG_MIN)) );
+    CHECK ( parse_str("99999999999999999999")->to_string() == "99999999999999999999" );
+    CHECK ( CAST(NumExpr)(parse_str("99999999999999999999"))->big != nullptr );
+    CHECK ( CAST(NumExpr)(parse_str("-000000000000000000000000005"))->big == nullptr );
+    CHECK ( parse_str_error("- 5") == "expected a digit after -" );
+    
     // Single number
     CHECK ( parse_str_error(" ( 1 ") == "expected an end parenthesis" );
     CHECK ( parse_str_error(" 1 )") == "expected end of file at )" );
@@ -336,7 +413,7 @@ TEST_CASE( "Let Expression" ) {
     CHECK(parse_str("_let x = 4 _in _let y = z _in x + y")->optimize()
           ->equals(parse_str("_let y = z _in 4 + y")));
     CHECK(parse_str("_let x = 5 _in _let y = z + 2 _in x + y + (2 * 3)")->optimize()
-          ->equals(parse_str("_let y = z + 2 _in 5 + y + 6")));
+          ->equals(parse_str("_let y = z + 2 _in 11 + y")));
     
     // Let expression on the RHS of a equal sign
     CHECK(parse_str("_let x = _let y = 6 _in y + 5 _in x + 10")->optimize()
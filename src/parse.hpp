@@ -11,9 +11,15 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <string>
 #include "pointer.hpp"
 
 class Expr;
 PTR(Expr) parse(std::istream &in);
 
+// Parses one input of `--repl`: either an expression, leaving `name`
+// empty, or `_let NAME = EXPR` with no `_in`, which sets `name` and
+// returns EXPR. `in` must be seekable, as a `std::istringstream` is.
+PTR(Expr) parse_entry(std::istream &in, std::string &name);
+
 #endif /* parse_hpp */
@@ -14,6 +14,7 @@
 # define NEW(T)  new T
 # define PTR(T)  T*
 # define CAST(T) dynamic_cast<T*>
+# define STATIC_CAST(T) static_cast<T*>
 # define THIS    this
 # define ENABLE_THIS(T) /* empty */
 
@@ -22,6 +23,7 @@
 # define NEW(T)  std::make_shared<T>
 # define PTR(T)  std::shared_ptr<T>
 # define CAST(T) std::dynamic_pointer_cast<T>
+# define STATIC_CAST(T) std::static_pointer_cast<T>
 # define THIS    shared_from_this()
 # define ENABLE_THIS(T) : public std::enable_shared_from_this<T>
 
@@ -0,0 +1,163 @@
+//
+//  profile.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <signal.h>
+#include <sys/time.h>
+#include "profile.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+
+Profiler::mode_t Profiler::mode = Profiler::off;
+
+class ProfileNode {
+public:
+    ProfileNode *parent;
+    std::string label;
+    long count;
+    std::map<std::string, ProfileNode*> children;
+    
+    ProfileNode(ProfileNode *parent, std::string label) {
+        this->parent = parent;
+        this->label = label;
+        this->count = 0;
+    }
+    
+    ~ProfileNode() {
+        for (auto &child : children)
+            delete child.second;
+    }
+};
+
+static ProfileNode *root = nullptr;
+// Each thread of --parallel has its own stack in the shared tree
+static thread_local ProfileNode *current = nullptr;
+static std::mutex profile_lock;
+static volatile sig_atomic_t sample_due = 0;
+
+static void on_timer(int) {
+    sample_due = 1;
+}
+
+void Profiler::start(mode_t new_mode, long interval_us) {
+    stop();
+    root = new ProfileNode(nullptr, "main");
+    current = root;
+    mode = new_mode;
+    if (mode == sampling) {
+        signal(SIGPROF, on_timer);
+        struct itimerval timer;
+        timer.it_interval.tv_sec = interval_us / 1000000;
+        timer.it_interval.tv_usec = interval_us % 1000000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+}
+
+void Profiler::stop() {
+    if (mode == sampling) {
+        struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        signal(SIGPROF, SIG_DFL);
+    }
+    mode = off;
+    delete root;
+    root = nullptr;
+    current = nullptr;
+}
+
+void Profiler::enter(const std::string &label) {
+    std::lock_guard<std::mutex> guard(profile_lock);
+    if (current == nullptr)
+        current = root;
+    ProfileNode *&child = current->children[label];
+    if (child == nullptr)
+        child = new ProfileNode(current, label);
+    current = child;
+    if (mode == counting)
+        current->count++;
+    else if (sample_due) {
+        sample_due = 0;
+        current->count++;
+    }
+}
+
+void Profiler::leave() {
+    std::lock_guard<std::mutex> guard(profile_lock);
+    if (sample_due) {
+        sample_due = 0;
+        current->count++;
+    }
+    if (current->parent != nullptr)
+        current = current->parent;
+}
+
+void Profiler::tick() {
+    if (sample_due) {
+        std::lock_guard<std::mutex> guard(profile_lock);
+        sample_due = 0;
+        (current != nullptr ? current : root)->count++;
+    }
+}
+
+static void write_node(std::ostream &out, ProfileNode *node, std::string stack) {
+    stack += node->label;
+    if (node->count > 0)
+        out << stack << " " << node->count << "\n";
+    for (auto &child : node->children)
+        write_node(out, child.second, stack + ";");
+}
+
+void Profiler::write_folded(std::ostream &out) {
+    std::lock_guard<std::mutex> guard(profile_lock);
+    if (root != nullptr)
+        write_node(out, root, "");
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "profiler" ) {
+    PTR(Expr) e = parse_str("_let twice = _fun(f) _fun(x) f(f(x))"
+                            "_in _let inc = _fun(x) x + 1"
+                            "_in twice(inc)(1) + (_fun(y) y)(2)");
+    // The function `twice` returns is called by `main`, not by `twice`
+    std::string expected = ("main;_fun@21-36 1\n"
+                            "main;_fun@21-36;inc 2\n"
+                            "main;_fun@85-94 1\n"
+                            "main;twice 1\n");
+    
+    Profiler::start(Profiler::counting, 0);
+    CHECK( e->to_value(Env::emptyenv)->to_string() == "5" );
+    std::ostringstream direct;
+    Profiler::write_folded(direct);
+    CHECK( direct.str() == expected );
+    
+    Profiler::start(Profiler::counting, 0);
+    CHECK( Step::interp_by_steps(e)->to_string() == "5" );
+    std::ostringstream steps;
+    Profiler::write_folded(steps);
+    CHECK( steps.str() == expected );
+    
+    // Labels survive optimization (of functions it does not inline)
+    PTR(Expr) kept = parse_str("_let f = _fun(x) x + 1 _in g(f) + g(f)")->optimize();
+    CHECK( CAST(FunExpr)(CAST(LetExpr)(kept)->rhs)->label == "f" );
+    
+    Profiler::stop();
+    CHECK( Profiler::mode == Profiler::off );
+}
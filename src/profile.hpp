@@ -0,0 +1,62 @@
+//
+//  profile.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef profile_hpp
+#define profile_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+
+class ProfileNode;
+
+/* A function-level profiler. The interpreters report each call of a
+ function with its `FunExpr::label` (its `_let` name, or else its
+ source span), and the profiler keeps the current chain of calls as
+ a position in a tree of call stacks, so a call or return is one
+ step up or down that tree.
+ 
+ In `counting` mode every call adds one to its stack; in `sampling`
+ mode a timer asks for the current stack to be recorded about every
+ `interval_us` microseconds of CPU time, at the next call, return or
+ step. `write_folded` prints one "main;f;g count" line per stack, the
+ format that flamegraph tools read. */
+class Profiler {
+public:
+    typedef enum {
+        off,
+        counting,
+        sampling
+    } mode_t;
+    
+    static mode_t mode;
+    
+    static void start(mode_t mode, long interval_us);
+    static void stop();
+    
+    static void enter(const std::string &label);
+    static void leave();
+    
+    // Records a sample if the timer asked for one
+    static void tick();
+    
+    static void write_folded(std::ostream &out);
+};
+
+/* Reports a call for as long as it is in scope */
+class ProfileFrame {
+public:
+    ProfileFrame(const std::string &label) {
+        Profiler::enter(label);
+    }
+    ~ProfileFrame() {
+        Profiler::leave();
+    }
+};
+
+#endif /* profile_hpp */
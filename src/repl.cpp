@@ -0,0 +1,132 @@
+//
+//  repl.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <sstream>
+#include "repl.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+#include "budget.hpp"
+#include "source.hpp"
+#include "types.hpp"
+
+Repl::Repl() {
+    env = Env::emptyenv;
+    step = false;
+    fuel = 0;
+    timeout_ms = 0;
+}
+
+std::string Repl::run(const std::string &line) {
+    size_t start = transcript.length();
+    transcript += line + "\n";
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+        return "";
+    
+    // Parse the line where it is in `transcript`, so that source
+    // spans count from the start of the session
+    std::istringstream in(transcript);
+    in.seekg(start);
+    std::string name;
+    PTR(Expr) e = parse_entry(in, name);
+    // A line that uses no earlier binding may have a type. A closure
+    // bound in `env` can be called by later lines that have none, so
+    // a binding is only checked once when it is a number or boolean
+    if (name.empty())
+        TypeCheck::mark(e);
+    else
+        TypeCheck::mark_plain(e);
+    
+    if (fuel > 0 || timeout_ms > 0)
+        Budget::start(fuel, timeout_ms);
+    PTR(Val) v;
+    try {
+        v = step ? Step::interp_by_steps(e, env) : e->to_value(env);
+    } catch (...) {
+        Budget::stop();
+        throw;
+    }
+    Budget::stop();
+    
+    if (name.empty())
+        return v->to_string();
+    env = NEW(ExtendedEnv)(name, v, env);
+    return name + " = " + v->to_string();
+}
+
+void Repl::loop(std::istream &in, std::ostream &out, std::ostream &err, bool prompt) {
+    SourceMap::recording = true;
+    std::string line;
+    while (true) {
+        if (prompt)
+            out << "> " << std::flush;
+        if (!std::getline(in, line))
+            break;
+        try {
+            std::string result = run(line);
+            if (!result.empty())
+                out << result << std::endl;
+        } catch (std::bad_alloc &) {
+            err << "out of memory" << std::endl;
+        } catch (std::runtime_error &exn) {
+            err << SourceMap::describe(exn, transcript) << std::endl;
+        }
+    }
+    if (prompt)
+        out << std::endl;
+}
+
+/* for tests */
+static std::string run_lines(Repl &repl, const std::string &lines) {
+    std::istringstream in(lines);
+    std::ostringstream out;
+    repl.loop(in, out, out, false);
+    SourceMap::recording = false;
+    return out.str();
+}
+
+TEST_CASE( "repl" ) {
+    for (int step = 0; step < 2; step++) {
+        Repl repl;
+        repl.step = (step == 1);
+        CHECK( run_lines(repl, "_let x = 5\nx * x\n\n_let x = x + 1\nx\n")
+              == "x = 5\n25\nx = 6\n6\n" );
+        
+        // A closure keeps the bindings it was made with
+        CHECK( run_lines(repl, "_let add = _fun(y) x + y\n_let x = 100\nadd(1)\n")
+              == "add = [FUNCTION]\nx = 100\n7\n" );
+        
+        // A line with `_in` is an ordinary expression
+        CHECK( run_lines(repl, "_let x = 2 _in x * x\nx\n") == "4\n100\n" );
+        
+        // A failing line binds nothing, and an error inside an
+        // earlier line's function is placed on that line
+        CHECK( run_lines(repl, "_let bad = _fun(z) z + _true\n_let y = bad(1)\ny\n")
+              == "bad = [FUNCTION]\n"
+              "line 11, column 22: input is not a number\n"
+              "line 13, column 1: free variable: y\n" );
+        CHECK( run_lines(repl, "_let = 3\n(1\n7 == 7\n")
+              == "variable name error\nexpected an end parenthesis\n_true\n" );
+        
+        // A function bound by a line with a type is still checked
+        // when a later line calls it with the wrong kind of value
+        CHECK( run_lines(repl, "_let f = _fun(x) x + 1\nf(_true)\nf(1)\n")
+              == "f = [FUNCTION]\nline 17, column 20: cannot add booleans\n2\n" );
+        CHECK( run_lines(repl, "_let g = _fun(x) _if x _then 1 _else 2\ng(5)\n")
+              == "g = [FUNCTION]\nline 20, column 18: if part doesn't evaluate to a bool val!\n" );
+    }
+    
+    Repl limited;
+    limited.fuel = 100;
+    CHECK( run_lines(limited, "_let f = _fun(f) _fun(n) f(f)(n)\nf(f)(0)\n1 + 1\n")
+          == "f = [FUNCTION]\nout of fuel\n2\n" );
+    CHECK( Budget::active == false );
+}
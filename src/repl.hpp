@@ -0,0 +1,48 @@
+//
+//  repl.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef repl_hpp
+#define repl_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include "pointer.hpp"
+
+class Env;
+
+/* `msdscript --repl`: runs one line at a time, where a line is an
+ expression or a top-level `_let NAME = EXPR` (with no `_in`). A
+ binding's value goes into `env`, which every later line runs in, so
+ a value or closure is computed once however often it is used. A
+ line that fails binds nothing. */
+class Repl {
+public:
+    // Every line so far, so that an error in a function from an
+    // earlier line is reported at its own line
+    std::string transcript;
+    PTR(Env) env;
+    // Run with `Step::interp_by_steps` instead of `to_value`
+    bool step;
+    // Applied to each line, as with `--fuel` and `--timeout`
+    long fuel;
+    long timeout_ms;
+    
+    Repl();
+    
+    // Runs one line, returning what to print for it ("" for a blank
+    // line); throws for an error, as `parse` and `to_value` do
+    std::string run(const std::string &line);
+    
+    // Runs lines from `in` until it ends, printing results to `out`
+    // and errors to `err`, the way `msdscript` would, and a prompt
+    // before each line if `prompt` is set
+    void loop(std::istream &in, std::ostream &out, std::ostream &err, bool prompt);
+};
+
+#endif /* repl_hpp */
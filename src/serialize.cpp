@@ -0,0 +1,289 @@
+//
+//  serialize.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <iterator>
+#include "serialize.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "Env.hpp"
+#include "value.hpp"
+#include "parse.hpp"
+#include "bignum.hpp"
+
+static const char IMAGE_MAGIC[4] = { '\0', 'M', 'S', 'D' };
+
+static void put_varint(std::string &out, unsigned long long n);
+
+void ImageWriter::tag(tag_t t) {
+    tree.push_back((char)t);
+}
+
+void ImageWriter::num(long long n) {
+    put_varint(tree, ((unsigned long long)n << 1) ^ (unsigned long long)(n >> 63));
+}
+
+void ImageWriter::big(const BigNum &n) {
+    tree.push_back(n.negative ? 1 : 0);
+    put_varint(tree, n.limbs.size());
+    for (uint32_t limb : n.limbs)
+        put_varint(tree, limb);
+}
+
+void ImageWriter::name(std::string name) {
+    auto found = name_index.find(name);
+    if (found != name_index.end()) {
+        put_varint(tree, found->second);
+    } else {
+        size_t index = name_index.size();
+        name_index[name] = index;
+        put_varint(names, name.length());
+        names += name;
+        put_varint(tree, index);
+    }
+}
+
+void ImageWriter::finish(std::ostream &out, unsigned char flags) {
+    std::string header(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.push_back((char)IMAGE_VERSION);
+    header.push_back((char)flags);
+    put_varint(header, name_index.size());
+
+    out.write(header.data(), header.length());
+    out.write(names.data(), names.length());
+    out.write(tree.data(), tree.length());
+}
+
+void write_image(PTR(Expr) e, std::ostream &out, bool optimized) {
+    ImageWriter w;
+    e->serialize(w);
+    w.finish(out, optimized ? IMAGE_OPTIMIZED : 0);
+}
+
+bool is_image(std::istream &in) {
+    return in.peek() == IMAGE_MAGIC[0] && !in.eof();
+}
+
+// Decodes an image held in memory, moving a single cursor
+// forward through it; nothing is ever read twice.
+class ImageReader {
+public:
+    const std::string &image;
+    size_t pos;
+    std::vector<std::string> names;
+
+    ImageReader(const std::string &image) : image(image) {
+        pos = 0;
+    }
+
+    unsigned char byte() {
+        if (pos >= image.length())
+            throw std::runtime_error("bad compiled image: truncated");
+        return (unsigned char)image[pos++];
+    }
+
+    unsigned long long varint() {
+        unsigned long long n = 0;
+        int shift = 0;
+        while (1) {
+            unsigned char b = byte();
+            if (shift > 63)
+                throw std::runtime_error("bad compiled image: number too long");
+            n |= (unsigned long long)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return n;
+            shift += 7;
+        }
+    }
+
+    long long num() {
+        unsigned long long z = varint();
+        return (long long)((z >> 1) ^ (~(z & 1) + 1));
+    }
+
+    BigNum big() {
+        bool negative = (byte() != 0);
+        unsigned long long count = varint();
+        if (count > image.length() - pos)
+            throw std::runtime_error("bad compiled image: truncated");
+        BigNum n(0);
+        for (unsigned long long i = 0; i < count; i++)
+            n.limbs.push_back((uint32_t)varint());
+        if (n.limbs.empty() || n.limbs.back() == 0)
+            throw std::runtime_error("bad compiled image: bad number");
+        n.negative = negative;
+        return n;
+    }
+
+    std::string name() {
+        unsigned long long index = varint();
+        if (index >= names.size())
+            throw std::runtime_error("bad compiled image: unknown name");
+        return names[index];
+    }
+
+    void header(bool *optimized) {
+        if (image.compare(0, sizeof(IMAGE_MAGIC), IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+            throw std::runtime_error("bad compiled image: missing header");
+        pos = sizeof(IMAGE_MAGIC);
+        if (byte() != IMAGE_VERSION)
+            throw std::runtime_error("bad compiled image: version mismatch");
+        unsigned char flags = byte();
+        if (optimized != nullptr)
+            *optimized = (flags & IMAGE_OPTIMIZED) != 0;
+
+        unsigned long long count = varint();
+        for (unsigned long long i = 0; i < count; i++) {
+            unsigned long long len = varint();
+            if (len > image.length() - pos)
+                throw std::runtime_error("bad compiled image: truncated");
+            names.push_back(image.substr(pos, len));
+            pos += len;
+        }
+    }
+
+    PTR(Expr) expr() {
+        switch (byte()) {
+            case ImageWriter::NUM:
+                return NEW(NumExpr)(num());
+            case ImageWriter::BIG_NUM:
+                return NEW(NumExpr)(big());
+            case ImageWriter::ADD: {
+                PTR(Expr) lhs = expr();
+                return NEW(AddExpr)(lhs, expr());
+            }
+            case ImageWriter::MULT: {
+                PTR(Expr) lhs = expr();
+                return NEW(MultExpr)(lhs, expr());
+            }
+            case ImageWriter::VAR:
+                return NEW(VarExpr)(name());
+            case ImageWriter::TRUE_BOOL:
+                return NEW(BoolExpr)(true);
+            case ImageWriter::FALSE_BOOL:
+                return NEW(BoolExpr)(false);
+            case ImageWriter::LET: {
+                std::string var = name();
+                PTR(Expr) rhs = expr();
+                return NEW(LetExpr)(var, rhs, expr());
+            }
+            case ImageWriter::EQUAL: {
+                PTR(Expr) lhs = expr();
+                return NEW(EqualExpr)(lhs, expr());
+            }
+            case ImageWriter::IF: {
+                PTR(Expr) if_part = expr();
+                PTR(Expr) then_part = expr();
+                return NEW(IfExpr)(if_part, then_part, expr());
+            }
+            case ImageWriter::FUN: {
+                std::string formal_arg = name();
+                std::string label = name();
+                return NEW(FunExpr)(formal_arg, expr(), label);
+            }
+            case ImageWriter::CALL: {
+                PTR(Expr) to_be_called = expr();
+                return NEW(CallFunExpr)(to_be_called, expr());
+            }
+            default:
+                throw std::runtime_error("bad compiled image: unknown node");
+        }
+    }
+};
+
+PTR(Expr) read_image(const std::string &image, bool *optimized) {
+    ImageReader r(image);
+    r.header(optimized);
+    PTR(Expr) e = r.expr();
+    if (r.pos != image.length())
+        throw std::runtime_error("bad compiled image: trailing bytes");
+    return e;
+}
+
+PTR(Expr) read_image(std::istream &in, bool *optimized) {
+    std::string image((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    return read_image(image, optimized);
+}
+
+static void put_varint(std::string &out, unsigned long long n) {
+    while (n >= 0x80) {
+        out.push_back((char)(n | 0x80));
+        n >>= 7;
+    }
+    out.push_back((char)n);
+}
+
+/* for tests */
+static PTR(Expr) round_trip(std::string s) {
+    std::istringstream in(s);
+    std::ostringstream out;
+    write_image(parse(in), out, false);
+    return read_image(out.str());
+}
+
+/* for tests */
+static std::string read_image_error(std::string image) {
+    try {
+        (void)read_image(image);
+        return "";
+    } catch (const std::runtime_error &exn) {
+        return exn.what();
+    }
+}
+
+TEST_CASE( "compiled images" ) {
+    const char *programs[] = {
+        "1",
+        "-2147483648",
+        "-9223372036854775808",
+        "123456789012345678901234567890 * -98765432109876543210",
+        "x + 2 * y",
+        "_true == _false",
+        "_let x = 5 _in _let x = x + 1 _in x * x",
+        "_if x == 1 _then _fun(y) y _else _fun(z) z + x",
+        "_let fib = _fun (fib)"
+        "              _fun (x)"
+        "                 _if x == 0"
+        "                 _then 1"
+        "                 _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+        "_in fib(fib)(10)"
+    };
+    for (const char *p : programs) {
+        std::istringstream in(p);
+        CHECK( round_trip(p)->equals(parse(in)) );
+    }
+
+    CHECK( round_trip("_let f = _fun(x) x + x _in f(2)")
+          ->to_value(Env::emptyenv)->equals(NEW(NumVal)(4)) );
+    // Profiler labels are kept too
+    CHECK( CAST(FunExpr)(CAST(LetExpr)(round_trip("_let f = _fun(x) x _in f"))->rhs)->label == "f" );
+
+    std::ostringstream out;
+    write_image(NEW(NumExpr)(5), out, true);
+    bool optimized = false;
+    std::istringstream image(out.str());
+    CHECK( is_image(image) );
+    CHECK( read_image(image, &optimized)->equals(NEW(NumExpr)(5)) );
+    CHECK( optimized );
+
+    std::istringstream source("1 + 2");
+    CHECK( !is_image(source) );
+
+    // Names are stored once
+    std::ostringstream names;
+    write_image(NEW(AddExpr)(NEW(VarExpr)("abcdef"), NEW(VarExpr)("abcdef")), names, false);
+    CHECK( names.str().find("abcdef") == names.str().rfind("abcdef") );
+
+    CHECK( read_image_error("1 + 2") == "bad compiled image: missing header" );
+    CHECK( read_image_error(std::string("\0MSD\x7f\0\0\1\2", 9)) == "bad compiled image: version mismatch" );
+    CHECK( read_image_error(out.str().substr(0, out.str().length() - 1)) == "bad compiled image: truncated" );
+    CHECK( read_image_error(out.str() + "x") == "bad compiled image: trailing bytes" );
+}
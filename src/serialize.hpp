@@ -0,0 +1,85 @@
+//
+//  serialize.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef serialize_hpp
+#define serialize_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include "pointer.hpp"
+
+class Expr;
+class BigNum;
+
+/* A compiled image is a parsed (and maybe optimized) `Expr` tree
+ written in a compact binary form, so that a script can be run
+ again without going through `parse`. The layout is:
+ 
+    magic     "\0MSD" -- no script text can start with a NUL
+    version   one byte, `IMAGE_VERSION`
+    flags     one byte, `IMAGE_OPTIMIZED` if `optimize` already ran
+    names     count, then each variable name once (length + bytes)
+    tree      the nodes in prefix order, one tag byte each
+ 
+ A `_fun` node also stores its profiler label as a name.
+ Counts, lengths, name indices and numbers are all varints
+ (numbers zigzag-encoded first), so small programs stay small. A
+ number too big for a `long long` is a `BIG_NUM` node instead: its
+ sign, its count of limbs, then each limb (see bignum.hpp). */
+
+static const unsigned char IMAGE_VERSION = 3;
+static const unsigned char IMAGE_OPTIMIZED = 1;
+
+class ImageWriter {
+public:
+    typedef enum {
+        NUM = 1,
+        ADD,
+        MULT,
+        VAR,
+        TRUE_BOOL,
+        FALSE_BOOL,
+        LET,
+        EQUAL,
+        IF,
+        FUN,
+        CALL,
+        BIG_NUM
+    } tag_t;
+    
+    void tag(tag_t t);
+    void num(long long n);
+    void big(const BigNum &n);
+    void name(std::string name);
+    
+    /* Writes the header, the name table, and the nodes
+     collected so far. */
+    void finish(std::ostream &out, unsigned char flags);
+
+private:
+    std::string tree;
+    std::string names;
+    std::unordered_map<std::string, size_t> name_index;
+};
+
+// Writes `e` to `out` as a compiled image.
+void write_image(PTR(Expr) e, std::ostream &out, bool optimized);
+
+// Checks whether `in` starts with a compiled image (without
+// consuming anything).
+bool is_image(std::istream &in);
+
+// Reads a whole compiled image from `in` and rebuilds its tree.
+// Sets `optimized` (when given) from the image's flags. Throws
+// `runtime_error` for a truncated, corrupt, or out-of-date image.
+PTR(Expr) read_image(std::istream &in, bool *optimized = nullptr);
+PTR(Expr) read_image(const std::string &image, bool *optimized = nullptr);
+
+#endif /* serialize_hpp */
@@ -0,0 +1,428 @@
+//
+//  server.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <deque>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.hpp"
+#include "client.hpp"
+#include "arena.hpp"
+#include "source.hpp"
+#include "memo.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "parse.hpp"
+
+// A client's connection: bytes not yet made into a request, bytes
+// of responses not yet sent, and whether a request of its is running
+class Connection {
+public:
+    int fd;
+    std::string in;
+    std::string out;
+    bool waiting = false;
+    bool closed = false;
+};
+
+class Worker {
+public:
+    pid_t pid = -1;
+    int fd = -1;
+    std::string in;
+    std::string out;
+    // The connection whose request is running, if `busy`
+    long client = -1;
+    bool busy = false;
+};
+
+long Server::recycle_requests = 1000;
+// A worker is also replaced once it has been this big
+static const long RECYCLE_RSS_KB = 256 * 1024;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_serving(int) {
+    stopping = 1;
+}
+
+static void nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// The most memory this process has had resident, in kilobytes
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// In a worker: answers requests on `fd` until the server goes away,
+// or until it is time for a fresh worker. Each response to the
+// server starts with a byte that says whether this worker is leaving.
+static void work(int fd, Server::handler_t &handler) {
+    std::string request;
+    long served = 0;
+    while (read_frame(fd, request)) {
+        size_t newline = request.find('\n');
+        std::string flags = (newline == std::string::npos) ? "" : request.substr(0, newline);
+        std::string program = (newline == std::string::npos) ? request : request.substr(newline + 1);
+        
+        Arena::start();
+        ExecResult r = handler(flags, program);
+        // Nothing may point into the arena once it is reset
+        SourceMap::clear();
+        if (CallMemo::enabled)
+            CallMemo::reset();
+        Arena::reset();
+        
+        bool leaving = (++served >= Server::recycle_requests || peak_rss_kb() >= RECYCLE_RSS_KB);
+        std::string response(1, (char)leaving);
+        response += (char)r.exit_code;
+        response += (r.exit_code == 0 ? r.out : r.err);
+        write_frame(fd, response);
+        if (leaving)
+            return;
+    }
+}
+
+// Forks a worker into `w`; the new process keeps none of the
+// server's other descriptors
+static void start_worker(Worker &w, int listen_fd, std::map<long, Connection> &clients,
+                         std::vector<Worker> &workers, Server::handler_t &handler) {
+    int ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+        throw std::runtime_error("socketpair failed");
+    
+    pid_t pid = fork();
+    if (pid == -1)
+        throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        close(ends[0]);
+        close(listen_fd);
+        for (auto &client : clients)
+            close(client.second.fd);
+        for (Worker &other : workers)
+            if (other.fd != -1)
+                close(other.fd);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        try {
+            work(ends[1], handler);
+        } catch (...) {
+        }
+        _exit(0);
+    }
+    
+    close(ends[1]);
+    nonblocking(ends[0]);
+    w.pid = pid;
+    w.fd = ends[0];
+    w.in.clear();
+    w.out.clear();
+    w.busy = false;
+    w.client = -1;
+}
+
+// What a client is told when its program took the worker down
+static std::string crash_response(int status) {
+    std::string message;
+    if (WIFSIGNALED(status))
+        message = "interpreter stopped by signal " + std::to_string(WTERMSIG(status));
+    else
+        message = "interpreter exited with status " + std::to_string(WEXITSTATUS(status));
+    return std::string(1, (char)1) + message + "\n";
+}
+
+// Reads what is there from `fd` into `buffer`; false at EOF or error
+static bool read_some(int fd, std::string &buffer) {
+    char chunk[65536];
+    ssize_t len;
+    do {
+        len = read(fd, chunk, sizeof(chunk));
+    } while (len == -1 && errno == EINTR);
+    if (len == -1 && errno == EAGAIN)
+        return true;
+    if (len <= 0)
+        return false;
+    buffer.append(chunk, len);
+    return true;
+}
+
+// Writes what `fd` takes from the front of `buffer`; false on error
+static bool write_some(int fd, std::string &buffer) {
+    ssize_t len;
+    do {
+        len = write(fd, buffer.data(), buffer.length());
+    } while (len == -1 && errno == EINTR);
+    if (len == -1 && errno == EAGAIN)
+        return true;
+    if (len < 0)
+        return false;
+    buffer.erase(0, len);
+    return true;
+}
+
+void Server::run(const std::string &path, int worker_count, handler_t handler) {
+    struct sockaddr_un address;
+    if (path.length() >= sizeof(address.sun_path))
+        throw std::runtime_error("socket path too long: " + path);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    
+    unlink(path.c_str());
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1)
+        throw std::runtime_error("socket failed");
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(listen_fd, SOMAXCONN) != 0) {
+        close(listen_fd);
+        throw std::runtime_error("cannot listen on " + path);
+    }
+    nonblocking(listen_fd);
+    
+    // Without SA_RESTART, so that `poll` returns to notice
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = stop_serving;
+    sigaction(SIGTERM, &stop, nullptr);
+    sigaction(SIGINT, &stop, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    stopping = 0;
+    
+    std::map<long, Connection> clients;
+    long next_client = 0;
+    // Requests waiting for a worker, with their connections
+    std::deque<std::pair<long, std::string>> pending;
+    std::vector<Worker> workers(worker_count < 1 ? 1 : worker_count);
+    for (Worker &w : workers)
+        start_worker(w, listen_fd, clients, workers, handler);
+    
+    while (!stopping) {
+        // Hand out requests first, so that their bytes are written
+        // as soon as the workers can take them
+        for (Worker &w : workers) {
+            while (!w.busy && !pending.empty()) {
+                std::pair<long, std::string> request = pending.front();
+                pending.pop_front();
+                if (clients.count(request.first) == 0)
+                    continue;
+                w.out = frame(request.second);
+                w.client = request.first;
+                w.busy = true;
+            }
+        }
+        
+        std::vector<struct pollfd> poll_info;
+        // For each entry of `poll_info`: whether it is a client's, and
+        // the client's id or the worker's index (-1 for listening)
+        std::vector<std::pair<bool, long>> owners;
+        poll_info.push_back({ listen_fd, POLLIN, 0 });
+        owners.push_back(std::make_pair(false, -1));
+        for (auto &client : clients) {
+            short events = (client.second.closed ? 0 : POLLIN) | (client.second.out.empty() ? 0 : POLLOUT);
+            poll_info.push_back({ client.second.fd, events, 0 });
+            owners.push_back(std::make_pair(true, client.first));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            short events = POLLIN | (workers[i].out.empty() ? 0 : POLLOUT);
+            poll_info.push_back({ workers[i].fd, events, 0 });
+            owners.push_back(std::make_pair(false, (long)i));
+        }
+        
+        if (poll(poll_info.data(), (nfds_t)poll_info.size(), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("poll failed");
+        }
+        
+        for (size_t k = 0; k < poll_info.size(); k++) {
+            short revents = poll_info[k].revents;
+            if (revents == 0)
+                continue;
+            
+            if (!owners[k].first && owners[k].second == -1) {
+                int fd;
+                while ((fd = accept(listen_fd, nullptr, nullptr)) != -1) {
+                    nonblocking(fd);
+                    clients[next_client++].fd = fd;
+                }
+            } else if (owners[k].first) {
+                Connection &c = clients[owners[k].second];
+                if ((revents & POLLOUT) && !write_some(c.fd, c.out))
+                    c.closed = true;
+                if ((revents & (POLLIN | POLLHUP | POLLERR)) && !c.closed && !read_some(c.fd, c.in))
+                    c.closed = true;
+                std::string request;
+                if (!c.closed && !c.waiting && take_frame(c.in, request)) {
+                    pending.push_back(std::make_pair(owners[k].second, request));
+                    c.waiting = true;
+                }
+            } else {
+                Worker &w = workers[owners[k].second];
+                if ((revents & POLLOUT) && !write_some(w.fd, w.out))
+                    w.out.clear();
+                bool alive = true;
+                if (revents & (POLLIN | POLLHUP | POLLERR))
+                    alive = read_some(w.fd, w.in);
+                
+                std::string response;
+                bool answered = take_frame(w.in, response);
+                bool leaving = false;
+                if (answered) {
+                    leaving = (response[0] != 0);
+                    response.erase(0, 1);
+                }
+                long client_id = w.client;
+                if (!alive && !answered) {
+                    int status = 0;
+                    waitpid(w.pid, &status, 0);
+                    close(w.fd);
+                    response = crash_response(status);
+                    answered = w.busy;
+                    start_worker(w, listen_fd, clients, workers, handler);
+                } else if (leaving) {
+                    // It exits right after answering; nothing more is
+                    // handed to it
+                    close(w.fd);
+                    waitpid(w.pid, nullptr, 0);
+                    start_worker(w, listen_fd, clients, workers, handler);
+                }
+                if (answered) {
+                    auto client = clients.find(client_id);
+                    if (client != clients.end()) {
+                        Connection &c = client->second;
+                        c.out += frame(response);
+                        c.waiting = false;
+                        std::string request;
+                        if (!c.closed && take_frame(c.in, request)) {
+                            pending.push_back(std::make_pair(client_id, request));
+                            c.waiting = true;
+                        }
+                    }
+                    w.busy = false;
+                    w.client = -1;
+                }
+            }
+        }
+        
+        // A closed connection goes once nothing of its is running
+        for (auto client = clients.begin(); client != clients.end(); ) {
+            if (client->second.closed && !client->second.waiting) {
+                close(client->second.fd);
+                client = clients.erase(client);
+            } else
+                client++;
+        }
+    }
+    
+    for (Worker &w : workers) {
+        close(w.fd);
+        kill(w.pid, SIGTERM);
+        waitpid(w.pid, nullptr, 0);
+    }
+    for (auto &client : clients)
+        close(client.second.fd);
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+/* for tests */
+static ExecResult evaluate_request(const std::string &flags, const std::string &program) {
+    ExecResult r;
+    // Stands for a program that crashes the interpreter
+    if (program == "crash")
+        kill(getpid(), SIGKILL);
+    try {
+        std::istringstream in(program);
+        PTR(Expr) e = parse(in);
+        if (flags == "--opt")
+            r.out = e->optimize()->to_string() + "\n";
+        else
+            r.out = e->to_value(Env::emptyenv)->to_string() + "\n";
+    } catch (std::runtime_error &exn) {
+        r.exit_code = 1;
+        r.err = std::string(exn.what()) + "\n";
+    }
+    return r;
+}
+
+static ServerConnection *connect_when_ready(const std::string &path) {
+    for (int tries = 0; ; tries++) {
+        try {
+            return new ServerConnection(path.c_str());
+        } catch (std::runtime_error &) {
+            if (tries == 500)
+                throw;
+            usleep(10000);
+        }
+    }
+}
+
+TEST_CASE( "server" ) {
+    std::string path = "/tmp/msdscript-test-" + std::to_string(getpid()) + ".sock";
+    long old_recycle_requests = Server::recycle_requests;
+    Server::recycle_requests = 50;
+    pid_t server = fork();
+    if (server == 0) {
+        Server::run(path, 2, evaluate_request);
+        _exit(0);
+    }
+    
+    ServerConnection *first = connect_when_ready(path);
+    ExecResult r = first->run("", "_let x = 5 _in x * x");
+    CHECK( r.exit_code == 0 );
+    CHECK( r.out == "25\n" );
+    r = first->run("--opt", "_let x = 5 _in x * y");
+    CHECK( r.out == "(5 * y)\n" );
+    r = first->run("", "x + 1");
+    CHECK( r.exit_code == 1 );
+    CHECK( r.err == "free variable: x\n" );
+    
+    // A crash costs only its own request, on any connection
+    ServerConnection *second = connect_when_ready(path);
+    r = second->run("", "crash");
+    CHECK( r.exit_code == 1 );
+    CHECK( r.err == "interpreter stopped by signal 9\n" );
+    CHECK( first->run("", "1 + 2").out == "3\n" );
+    CHECK( second->run("", "_true").out == "_true\n" );
+    
+    // Each program's memory is reused by the next, and workers are
+    // replaced along the way without losing a request
+    for (int i = 0; i < 200; i++)
+        CHECK( first->run("", "_let f = _fun(n) n * 2 _in f(" + std::to_string(i) + ")").out
+              == std::to_string(i * 2) + "\n" );
+    delete first;
+    delete second;
+    CHECK( serve_program(path.c_str(), "", "(_fun(x) x + 1)(41)").out == "42\n" );
+    
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    CHECK( WIFEXITED(status) );
+    CHECK( access(path.c_str(), F_OK) != 0 );
+    Server::recycle_requests = old_recycle_requests;
+}
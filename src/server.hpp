@@ -0,0 +1,44 @@
+//
+//  server.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef server_hpp
+#define server_hpp
+
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include "exec.hpp"
+
+/* `msdscript --serve PATH`: answers requests to run programs (see
+ client.hpp for the protocol) on a Unix domain socket, so that a
+ program costs no process start. One process accepts connections
+ and passes requests to a pool of worker processes forked from it,
+ each running one program at a time with everything it allocates in
+ the `Arena`, which is reset after each. A worker is also replaced
+ after many programs or once it has grown big, since the arena does
+ not get back what its objects own on the heap. A program that
+ crashes a worker (say, by recursing too deeply) gets an error
+ response, and the worker is replaced. A connection's requests are answered in
+ order; different connections' requests run at the same time. */
+class Server {
+public:
+    // Runs one program, given the flags line of a request; returns
+    // what `msdscript` would exit with and print
+    typedef std::function<ExecResult(const std::string &flags, const std::string &program)> handler_t;
+
+    // How many programs a worker runs before it is replaced, since
+    // what arena objects own on the heap (long names, vectors, big
+    // numbers' digits) is not given back at `reset`
+    static long recycle_requests;
+
+    // Serves at `path`, replacing any socket there, with `workers`
+    // workers, until SIGTERM or SIGINT; then removes the socket
+    static void run(const std::string &path, int workers, handler_t handler);
+};
+
+#endif /* server_hpp */
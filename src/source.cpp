@@ -0,0 +1,139 @@
+//
+//  source.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <sstream>
+#include "source.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+#include "budget.hpp"
+
+bool SourceMap::recording = false;
+std::vector<SourceMap::Span> SourceMap::spans;
+
+void SourceMap::record(PTR(Expr) e, long start, long length) {
+    if (start < 0)
+        return;
+    Span span;
+    span.expr = &*e;
+    span.start = (uint32_t)start;
+    span.length = (uint32_t)length;
+    spans.push_back(span);
+}
+
+void SourceMap::clear() {
+    spans.clear();
+}
+
+bool SourceMap::find(PTR(Expr) e, Span &span) {
+    // Newest first, in case a node's address has been reused
+    for (size_t i = spans.size(); i > 0; i--) {
+        if (spans[i - 1].expr == &*e) {
+            span = spans[i - 1];
+            return true;
+        }
+    }
+    return false;
+}
+
+void SourceMap::blame(PTR(Expr) e) {
+    try {
+        throw;
+    } catch (ScriptError &) {
+        throw;
+    } catch (OutOfBudget &) {
+        throw;
+    } catch (std::runtime_error &exn) {
+        throw ScriptError(exn.what(), e);
+    }
+}
+
+std::string SourceMap::describe(const std::runtime_error &exn, const std::string &text) {
+    const ScriptError *located = dynamic_cast<const ScriptError*>(&exn);
+    if (located == nullptr || located->where == nullptr)
+        return exn.what();
+    return where(located->where, text) + exn.what();
+}
+
+std::string SourceMap::where(PTR(Expr) e, const std::string &text) {
+    Span span;
+    if (!find(e, span) || span.start > text.length())
+        return "";
+    
+    long line = 1, column = 1;
+    for (uint32_t i = 0; i < span.start; i++) {
+        if (text[i] == '\n') {
+            line++;
+            column = 1;
+        } else
+            column++;
+    }
+    return "line " + std::to_string(line) + ", column " + std::to_string(column) + ": ";
+}
+
+/* for tests */
+static std::string run_error(std::string text, bool steps) {
+    SourceMap::clear();
+    SourceMap::recording = true;
+    std::istringstream in(text);
+    PTR(Expr) e = parse(in);
+    SourceMap::recording = false;
+    try {
+        if (steps)
+            (void)Step::interp_by_steps(e);
+        else
+            (void)e->to_value(Env::emptyenv);
+        return "";
+    } catch (std::runtime_error &exn) {
+        return SourceMap::describe(exn, text);
+    }
+}
+
+TEST_CASE( "source spans" ) {
+    CHECK( run_error("1 +\n  x", false) == "line 2, column 3: free variable: x" );
+    CHECK( run_error("1 +\n  x", true) == "line 2, column 3: free variable: x" );
+    
+    // The innermost failing node is blamed, not the call that led there
+    const char *programs[] = {
+        "_let f = _fun(x) x + _true\n_in 1 + f(2)",
+        "_let f = _fun(x) x * _false\n_in\n   (f(1)) * 2",
+        "_let f = _fun(x) x\n_in 1 + f(2)(3)",
+        "_let f = _fun(x) x\n_in 1 + f(_false)"
+    };
+    const char *expected[] = {
+        "line 1, column 20: input is not a number",
+        "line 1, column 20: input is not a number",
+        "line 2, column 13: ",
+        "line 2, column 7: input is not a number"
+    };
+    for (int i = 0; i < 4; i++) {
+        CHECK( run_error(programs[i], false).find(expected[i]) == 0 );
+        CHECK( run_error(programs[i], true).find(expected[i]) == 0 );
+    }
+    
+    // Both evaluators check that an `_if` test is a boolean
+    CHECK( run_error("_if 1 _then 2 _else 3", false)
+          == "line 1, column 1: if part doesn't evaluate to a bool val!" );
+    CHECK( run_error("_if 1 _then 2 _else 3", true)
+          == "line 1, column 1: if part doesn't evaluate to a bool val!" );
+    
+    // The message itself is unchanged, and without a recorded
+    // span there is nothing to add to it
+    SourceMap::clear();
+    std::istringstream in("x");
+    PTR(Expr) e = parse(in);
+    CHECK_THROWS_WITH( e->to_value(Env::emptyenv), "free variable: x" );
+    try {
+        (void)e->to_value(Env::emptyenv);
+    } catch (std::runtime_error &exn) {
+        CHECK( SourceMap::describe(exn, "x") == "free variable: x" );
+    }
+}
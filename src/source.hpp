@@ -0,0 +1,73 @@
+//
+//  source.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef source_hpp
+#define source_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "pointer.hpp"
+
+class Expr;
+
+/* A runtime error together with the node that raised it. `what()`
+ is still just the message, so callers that only care about that
+ can keep catching `std::runtime_error`. */
+class ScriptError : public std::runtime_error {
+public:
+    PTR(Expr) where;
+    
+    ScriptError(const std::string &what, PTR(Expr) where)
+    : std::runtime_error(what) {
+        this->where = where;
+    }
+};
+
+/* Where in the script each node that can fail at run time came
+ from, kept beside the tree so that `Expr` stays as small as it
+ was. While `recording` is set, `parse` appends one entry per
+ variable, `+`, `*` and call, and the entries are only searched
+ once something goes wrong; otherwise nothing is recorded at all.
+ Offsets are in bytes from the start of the parsed text. */
+class SourceMap {
+public:
+    class Span {
+    public:
+        Expr *expr;
+        uint32_t start;
+        uint32_t length;
+    };
+    
+    static bool recording;
+    static std::vector<Span> spans;
+    
+    static void record(PTR(Expr) e, long start, long length);
+    static void clear();
+    
+    // The span recorded for `e`; false if there is none
+    static bool find(PTR(Expr) e, Span &span);
+    
+    /* To be called inside a `catch`: rethrows the error being
+     handled as a `ScriptError` raised by `e`, unless it already
+     is one (a node inside `e` failed first) or it is not an error
+     in the script at all, such as `OutOfBudget`. */
+    [[noreturn]] static void blame(PTR(Expr) e);
+    
+    // "line L, column C: message" for an error in `text`, or just
+    // the message if nothing is known about where it came from
+    static std::string describe(const std::runtime_error &exn, const std::string &text);
+    
+    // The "line L, column C: " that `describe` puts before an error
+    // raised by `e`, or "" if `e` has no span
+    static std::string where(PTR(Expr) e, const std::string &text);
+};
+
+#endif /* source_hpp */
@@ -0,0 +1,176 @@
+//
+//  stats.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <map>
+#include <mutex>
+#include <typeindex>
+#include <cxxabi.h>
+#include <stdlib.h>
+#include <sstream>
+#include "stats.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "cont.hpp"
+#include "step.hpp"
+#include "Env.hpp"
+#include "parse.hpp"
+
+bool Stats::enabled = false;
+long Stats::max_cont_depth = 0;
+long Stats::max_lookup_depth = 0;
+
+static std::map<std::type_index, long> steps;
+static std::map<std::string, long> allocs;
+static std::chrono::steady_clock::duration times[4];
+
+// --parallel can count from several threads
+static std::mutex stats_lock;
+
+static std::string class_name(const std::type_index &t) {
+    int status = 0;
+    char *name = abi::__cxa_demangle(t.name(), nullptr, nullptr, &status);
+    if (status != 0 || name == nullptr)
+        return t.name();
+    std::string s = name;
+    free(name);
+    return s;
+}
+
+void Stats::count_step(Expr *e) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    steps[std::type_index(typeid(*e))]++;
+}
+
+void Stats::count_step(Cont *c) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    steps[std::type_index(typeid(*c))]++;
+}
+
+void Stats::count_alloc(const char *name) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    allocs[name]++;
+}
+
+void Stats::count_cont(const char *name, Cont *c, Cont *rest) {
+    c->depth = rest->depth + 1;
+    std::lock_guard<std::mutex> guard(stats_lock);
+    allocs[name]++;
+    if (c->depth > max_cont_depth)
+        max_cont_depth = c->depth;
+}
+
+void Stats::note_lookup_depth(long depth) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    if (depth > max_lookup_depth)
+        max_lookup_depth = depth;
+}
+
+void Stats::add_time(phase_t phase, std::chrono::steady_clock::duration d) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    times[phase] += d;
+}
+
+long Stats::step_count(const std::string &name) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    for (auto &step : steps)
+        if (class_name(step.first) == name)
+            return step.second;
+    return 0;
+}
+
+long Stats::alloc_count(const std::string &name) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    auto found = allocs.find(name);
+    return (found == allocs.end()) ? 0 : found->second;
+}
+
+void Stats::reset() {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    steps.clear();
+    allocs.clear();
+    for (auto &t : times)
+        t = std::chrono::steady_clock::duration::zero();
+    max_cont_depth = 0;
+    max_lookup_depth = 0;
+}
+
+static double ms(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void Stats::report(std::ostream &out) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    
+    std::map<std::string, long> named_steps;
+    long total_steps = 0;
+    for (auto &step : steps) {
+        named_steps[class_name(step.first)] += step.second;
+        total_steps += step.second;
+    }
+    out << "steps: " << total_steps << std::endl;
+    for (auto &step : named_steps)
+        out << "  " << step.first << ": " << step.second << std::endl;
+    
+    long total_allocs = 0;
+    for (auto &alloc : allocs)
+        total_allocs += alloc.second;
+    out << "allocations: " << total_allocs << std::endl;
+    for (auto &alloc : allocs)
+        out << "  " << alloc.first << ": " << alloc.second << std::endl;
+    
+    out << "max continuation depth: " << max_cont_depth << std::endl;
+    out << "max lookup depth: " << max_lookup_depth << std::endl;
+    out << "time (ms): parse " << ms(times[parse_phase])
+        << ", optimize " << ms(times[optimize_phase])
+        << ", typecheck " << ms(times[typecheck_phase])
+        << ", evaluate " << ms(times[evaluate_phase]) << std::endl;
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "stats" ) {
+    Stats::reset();
+    Stats::enabled = true;
+    
+    PTR(Expr) e = parse_str("_let x = 1 _in _let y = 2 _in x + y");
+    CHECK( Stats::alloc_count("NumExpr") == 2 );
+    CHECK( Stats::alloc_count("LetExpr") == 2 );
+    
+    CHECK( Step::interp_by_steps(e)->to_string() == "3" );
+    CHECK( Stats::step_count("LetExpr") == 2 );
+    CHECK( Stats::step_count("NumExpr") == 2 );
+    CHECK( Stats::step_count("VarExpr") == 2 );
+    CHECK( Stats::step_count("AddExpr") == 1 );
+    CHECK( Stats::step_count("LetBodyCont") == 2 );
+    CHECK( Stats::step_count("RightThenAddCont") == 1 );
+    CHECK( Stats::step_count("AddCont") == 1 );
+    CHECK( Stats::alloc_count("ExtendedEnv") == 2 );
+    CHECK( Stats::alloc_count("NumVal") == 3 );
+    CHECK( Stats::max_cont_depth == 1 );
+    // `x` is found under `y`
+    CHECK( Stats::max_lookup_depth == 2 );
+    
+    Stats::reset();
+    CHECK( e->to_value(Env::emptyenv)->to_string() == "3" );
+    CHECK( Stats::step_count("AddExpr") == 0 );
+    CHECK( Stats::alloc_count("NumVal") == 3 );
+    CHECK( Stats::max_lookup_depth == 2 );
+    
+    std::ostringstream report;
+    Stats::report(report);
+    CHECK( report.str().find("  NumVal: 3\n") != std::string::npos );
+    
+    Stats::enabled = false;
+    Stats::reset();
+    (void)e->to_value(Env::emptyenv);
+    CHECK( Stats::alloc_count("NumVal") == 0 );
+}
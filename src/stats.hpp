@@ -0,0 +1,78 @@
+//
+//  stats.hpp
+//  
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef stats_hpp
+#define stats_hpp
+
+#include <stdio.h>
+#include <iostream>
+#include <chrono>
+
+class Expr;
+class Cont;
+
+/* Counters for --stats. Every hook is behind a test of `enabled`,
+ so with the flag off the only cost is that one branch. */
+class Stats {
+public:
+    typedef enum {
+        parse_phase,
+        optimize_phase,
+        typecheck_phase,
+        evaluate_phase
+    } phase_t;
+    
+    static bool enabled;
+    
+    // One `Step::interp_by_steps` iteration on `e` or `c`
+    static void count_step(Expr *e);
+    static void count_step(Cont *c);
+    
+    // One object of class `name` created
+    static void count_alloc(const char *name);
+    
+    // A continuation created on top of `rest`; records its depth
+    static void count_cont(const char *name, Cont *c, Cont *rest);
+    
+    // A variable found `depth` `ExtendedEnv`s into an environment
+    static void note_lookup_depth(long depth);
+    
+    static void add_time(phase_t phase, std::chrono::steady_clock::duration d);
+    
+    static long max_cont_depth;
+    static long max_lookup_depth;
+    
+    // Counts so far for a class, by its name
+    static long step_count(const std::string &name);
+    static long alloc_count(const std::string &name);
+    
+    static void reset();
+    static void report(std::ostream &out);
+};
+
+#define COUNT_ALLOC(T) if (Stats::enabled) Stats::count_alloc(#T)
+#define COUNT_CONT(T) if (Stats::enabled) Stats::count_cont(#T, this, rest)
+
+/* Adds the time until it goes out of scope to a phase */
+class StatsTimer {
+public:
+    Stats::phase_t phase;
+    std::chrono::steady_clock::time_point start;
+    
+    StatsTimer(Stats::phase_t phase) {
+        this->phase = phase;
+        if (Stats::enabled)
+            start = std::chrono::steady_clock::now();
+    }
+    ~StatsTimer() {
+        if (Stats::enabled)
+            Stats::add_time(phase, std::chrono::steady_clock::now() - start);
+    }
+};
+
+#endif /* stats_hpp */
@@ -12,6 +12,10 @@
 #include "Env.hpp"
 #include "value.hpp"
 #include "parse.hpp"
+#include "budget.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "source.hpp"
 
 Step::mode_t Step::mode;
 
@@ -21,20 +25,40 @@ PTR(Env) Step::env;
 PTR(Val) Step::val;        /* only for Step::continue_mode */
 
 PTR(Val) Step::interp_by_steps(PTR(Expr) e) {
+    return interp_by_steps(e, Env::emptyenv);
+}
+
+PTR(Val) Step::interp_by_steps(PTR(Expr) e, PTR(Env) env) {
     Step::mode = Step::interp_mode;
     Step::expr = e;
-    Step::env = Env::emptyenv;
+    Step::env = env;
     Step::val = nullptr;
     Step::cont = Cont::done;
     
-    while (1) {
-        if (Step::mode == Step::interp_mode)
-            Step::expr->step_interp();
-        else {
-            if (Step::cont == Cont::done)
-                return Step::val;
-            else
+    // The node that is stepping, to blame if it fails
+    PTR(Expr) at = nullptr;
+    
+    try {
+        while (1) {
+            if (Budget::active)
+                Budget::charge();
+            if (Profiler::mode == Profiler::sampling)
+                Profiler::tick();
+            if (Step::mode == Step::interp_mode) {
+                if (Stats::enabled)
+                    Stats::count_step(Step::expr);
+                at = Step::expr;
+                Step::expr->step_interp();
+            } else {
+                if (Step::cont == Cont::done)
+                    return Step::val;
+                if (Stats::enabled)
+                    Stats::count_step(Step::cont);
+                at = Step::cont->origin;
                 Step::cont->step_continue();
+            }
         }
+    } catch (std::runtime_error &) {
+        SourceMap::blame(at);
     }
 }
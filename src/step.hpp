@@ -51,6 +51,8 @@ public:
      it must not be called recursively, since the whole
      point is to avoid rcursive calls at the C++ level). */
     static PTR(Val) interp_by_steps(PTR(Expr) e);
+    // Same, with `e`'s free variables bound in `env`
+    static PTR(Val) interp_by_steps(PTR(Expr) e, PTR(Env) env);
 };
 
 
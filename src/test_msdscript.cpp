@@ -0,0 +1,265 @@
+//
+//  test_msdscript.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+/* Differential testing: runs many random programs (see gen.hpp)
+ through an `msdscript` binary in each way it can evaluate them and
+ reports every program whose results disagree. This is a program of
+ its own, built from this file, exec.cpp and gen.cpp, whose tests
+ are left out:
+
+     c++ -std=c++14 -O2 -DCATCH_CONFIG_DISABLE -o test_msdscript \
+         test_msdscript.cpp exec.cpp gen.cpp
+     ./test_msdscript [--count N] [--jobs N] [--seed N]
+                      [--depth N] [--breadth N] [--closures PCT]
+                      [--recursion PCT] [--errors PCT] [--timeout MS] [--memory MB]
+                      [--timing FILE] msdscript [script ...]
+
+ Program number `i` is made from seed `N + i`, so one can be made
+ again with `msdscript --generate`. Unless `--errors` says otherwise,
+ 2% of expressions get the wrong type, so that about half of the
+ programs fail and the modes are checked to fail alike. Scripts named on the command
+ line are run along with the random programs. Each run is killed after `--timeout` (10 seconds unless
+ given) or on using more than `--memory`, and such a program is
+ counted apart rather than compared. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "exec.hpp"
+#include "gen.hpp"
+
+// The ways a program is run; `--opt` prints a program, which is
+// then run again without flags to get its value
+typedef enum {
+    plain,
+    step,
+    opt,
+    modes
+} run_mode_t;
+
+static const char *mode_names[modes] = { "interp", "step", "opt" };
+
+// What a mode made of one program
+class Outcome {
+public:
+    int exit_code = 0;
+    bool signaled = false;
+    std::string out;
+    std::string err;
+    double seconds = 0;
+    double cpu_seconds = 0;
+    long max_rss_kb = 0;
+    bool timed_out = false;
+    bool out_of_memory = false;
+
+    // Programs agree when they print the same value, or when both
+    // fail with the same status; messages of errors are not compared,
+    // since the optimized program reports positions in its own text
+    bool same_as(const Outcome &other) const {
+        if (exit_code != other.exit_code || signaled != other.signaled)
+            return false;
+        return exit_code != 0 || out == other.out;
+    }
+
+    std::string describe() const {
+        if (timed_out)
+            return "timed out";
+        if (out_of_memory)
+            return "out of memory";
+        std::string text = (exit_code == 0 ? out : err);
+        while (!text.empty() && text.back() == '\n')
+            text.pop_back();
+        if (signaled)
+            text = "signal " + std::to_string(exit_code);
+        else if (exit_code != 0)
+            text = "exit " + std::to_string(exit_code) + ": " + text;
+        return text;
+    }
+};
+
+static ExecJob make_job(const std::string &binary, const char *flag, const std::string &input,
+                        const ExecLimits &limits) {
+    ExecJob job;
+    job.command.push_back(binary);
+    if (flag != nullptr)
+        job.command.push_back(flag);
+    job.input = input;
+    job.limits = limits;
+    return job;
+}
+
+static Outcome outcome_of(const ExecResult &r) {
+    Outcome o;
+    o.exit_code = r.exit_code;
+    o.signaled = r.signaled;
+    o.out = r.out;
+    o.err = r.err;
+    o.seconds = r.seconds;
+    o.cpu_seconds = r.user_seconds + r.system_seconds;
+    o.max_rss_kb = r.max_rss_kb;
+    o.timed_out = r.timed_out;
+    o.out_of_memory = r.out_of_memory;
+    return o;
+}
+
+static std::string read_file(const char *path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error(std::string("cannot read ") + path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+static void usage() {
+    std::cerr << "usage: test_msdscript [--count N] [--jobs N] [--seed N] [--depth N] [--breadth N]"
+                 " [--closures PCT] [--recursion PCT] [--errors PCT] [--timeout MS] [--memory MB] [--timing FILE]"
+                 " msdscript [script ...]" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    long count = 1000;
+    GenOptions shape;
+    shape.errors = 2;
+    unsigned seed = (unsigned)time(NULL);
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    const char *timing_file = nullptr;
+    ExecLimits limits;
+    limits.timeout_seconds = 10;
+    std::string binary;
+    std::vector<std::string> programs;
+    // Where each program came from
+    std::vector<std::string> names;
+
+    try {
+        int i = 1;
+        for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+            if (i + 1 >= argc)
+                usage();
+            if (shape.take_flag(argc, argv, i))
+                continue;
+            if (strcmp(argv[i], "--count") == 0)
+                count = atol(argv[++i]);
+            else if (strcmp(argv[i], "--jobs") == 0)
+                jobs = (size_t)atol(argv[++i]);
+            else if (strcmp(argv[i], "--seed") == 0)
+                seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+            else if (strcmp(argv[i], "--timeout") == 0)
+                limits.timeout_seconds = atof(argv[++i]) / 1000;
+            else if (strcmp(argv[i], "--memory") == 0)
+                limits.memory_bytes = (size_t)atol(argv[++i]) << 20;
+            else if (strcmp(argv[i], "--timing") == 0)
+                timing_file = argv[++i];
+            else
+                usage();
+        }
+        if (i >= argc)
+            usage();
+        binary = argv[i++];
+        for (; i < argc; i++) {
+            programs.push_back(read_file(argv[i]));
+            names.push_back(argv[i]);
+        }
+    } catch (std::runtime_error &exn) {
+        std::cerr << exn.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "seed " << seed << std::endl;
+    for (long n = 0; n < count; n++) {
+        programs.push_back(Gen::program(seed + (unsigned)n, shape));
+        names.push_back("seed " + std::to_string(seed + (unsigned)n));
+    }
+
+    // Every program in every mode at once, then the optimized
+    // programs that came out of `--opt`
+    std::vector<ExecJob> first;
+    for (const std::string &program : programs) {
+        first.push_back(make_job(binary, nullptr, program, limits));
+        first.push_back(make_job(binary, "--step", program, limits));
+        first.push_back(make_job(binary, "--opt", program, limits));
+    }
+    std::vector<ExecResult> first_results = exec_programs(first, jobs);
+
+    std::vector<std::vector<Outcome>> outcomes(programs.size(), std::vector<Outcome>(modes));
+    std::vector<ExecJob> second;
+    std::vector<size_t> second_of;
+    for (size_t p = 0; p < programs.size(); p++) {
+        for (int m = 0; m < modes; m++)
+            outcomes[p][m] = outcome_of(first_results[p * modes + m]);
+        if (outcomes[p][opt].exit_code == 0 && !outcomes[p][opt].timed_out) {
+            second.push_back(make_job(binary, nullptr, outcomes[p][opt].out, limits));
+            second_of.push_back(p);
+        }
+    }
+    std::vector<ExecResult> second_results = exec_programs(second, jobs);
+    for (size_t k = 0; k < second.size(); k++) {
+        Outcome &o = outcomes[second_of[k]][opt];
+        Outcome optimizing = o;
+        o = outcome_of(second_results[k]);
+        o.seconds += optimizing.seconds;
+        o.cpu_seconds += optimizing.cpu_seconds;
+        o.max_rss_kb = std::max(o.max_rss_kb, optimizing.max_rss_kb);
+    }
+
+    long mismatches = 0, stopped = 0;
+    double totals[modes] = { 0, 0, 0 };
+    std::vector<std::pair<double, size_t>> slowest;
+    for (size_t p = 0; p < programs.size(); p++) {
+        std::vector<Outcome> &o = outcomes[p];
+        for (int m = 0; m < modes; m++)
+            totals[m] += o[m].seconds;
+        slowest.push_back(std::make_pair(o[plain].seconds, p));
+        bool was_stopped = false;
+        for (int m = 0; m < modes; m++)
+            was_stopped = was_stopped || o[m].timed_out || o[m].out_of_memory;
+        if (was_stopped)
+            stopped++;
+        else if (o[plain].same_as(o[step]) && o[plain].same_as(o[opt]))
+            continue;
+        else
+            mismatches++;
+        std::cout << (was_stopped ? "stopped (" : "mismatch (") << names[p] << "): " << programs[p] << std::endl;
+        for (int m = 0; m < modes; m++)
+            std::cout << "  " << mode_names[m] << ": " << o[m].describe() << std::endl;
+    }
+
+    if (timing_file != nullptr) {
+        std::ofstream timing(timing_file);
+        timing << "program";
+        for (int m = 0; m < modes; m++)
+            timing << "\t" << mode_names[m] << "_ms\t" << mode_names[m] << "_cpu_ms\t" << mode_names[m] << "_rss_kb";
+        timing << std::endl;
+        for (size_t p = 0; p < programs.size(); p++) {
+            timing << names[p];
+            for (int m = 0; m < modes; m++)
+                timing << "\t" << outcomes[p][m].seconds * 1000 << "\t" << outcomes[p][m].cpu_seconds * 1000
+                       << "\t" << outcomes[p][m].max_rss_kb;
+            timing << std::endl;
+        }
+    }
+
+    std::cout << programs.size() << " programs, " << mismatches << " mismatches, "
+              << stopped << " stopped by limits" << std::endl;
+    for (int m = 0; m < modes; m++)
+        std::cout << "  " << mode_names[m] << ": " << totals[m] * 1000 / std::max<size_t>(1, programs.size())
+                  << " ms per program" << std::endl;
+    std::sort(slowest.rbegin(), slowest.rend());
+    for (size_t k = 0; k < slowest.size() && k < 3; k++)
+        std::cout << "  slowest (" << names[slowest[k].second] << "): " << slowest[k].first * 1000 << " ms" << std::endl;
+
+    return mismatches == 0 ? 0 : 3;
+}
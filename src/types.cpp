@@ -0,0 +1,335 @@
+//
+//  types.cpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#include <climits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "types.hpp"
+#include "catch.hpp"
+#include "expr.hpp"
+#include "value.hpp"
+#include "Env.hpp"
+#include "step.hpp"
+#include "parse.hpp"
+#include "source.hpp"
+
+/* A type while it is being inferred. A `var` stands for a type not
+ known yet; unifying it with another type sets `link`, and from
+ then on it means whatever `link` does. */
+class Type {
+public:
+    ARENA_ALLOCATED
+    
+    typedef enum {
+        var,
+        num,
+        boolean,
+        fun
+    } kind_t;
+    
+    kind_t kind;
+    PTR(Type) link;
+    // For a `fun`
+    PTR(Type) arg;
+    PTR(Type) result;
+    // For a `var`: how many `_let` right-hand sides it was made in,
+    // or `generic` once its `_let` is done with it, so that each use
+    // of the variable gets a fresh copy
+    int level;
+    
+    Type(kind_t kind, int level) {
+        this->kind = kind;
+        this->link = nullptr;
+        this->arg = nullptr;
+        this->result = nullptr;
+        this->level = level;
+    }
+};
+
+static const int generic = INT_MAX;
+
+// What `t` stands for after following the links of `var`s
+static PTR(Type) resolve(PTR(Type) t) {
+    while (t->kind == Type::var && t->link != nullptr)
+        t = t->link;
+    return t;
+}
+
+static std::string show(PTR(Type) t, std::map<Type*, std::string> &names) {
+    t = resolve(t);
+    switch (t->kind) {
+        case Type::num:
+            return "num";
+        case Type::boolean:
+            return "bool";
+        case Type::fun: {
+            std::string arg = show(t->arg, names);
+            if (resolve(t->arg)->kind == Type::fun)
+                arg = "(" + arg + ")";
+            return arg + " -> " + show(t->result, names);
+        }
+        default: {
+            std::string &name = names[&*t];
+            if (name == "")
+                name = std::string(1, (char)('a' + (names.size() - 1) % 26))
+                       + (names.size() > 26 ? std::to_string((names.size() - 1) / 26) : "");
+            return name;
+        }
+    }
+}
+
+static std::string show(PTR(Type) t) {
+    std::map<Type*, std::string> names;
+    return show(t, names);
+}
+
+class Inference {
+public:
+    int level = 0;
+    // The variables in scope, innermost last
+    std::vector<std::pair<std::string, PTR(Type)>> scope;
+    // Every node seen, for `TypeCheck::mark`
+    std::vector<PTR(Expr)> nodes;
+    
+    PTR(Type) fresh() {
+        return NEW(Type)(Type::var, level);
+    }
+    
+    PTR(Type) fun_type(PTR(Type) arg, PTR(Type) result) {
+        PTR(Type) t = NEW(Type)(Type::fun, 0);
+        t->arg = arg;
+        t->result = result;
+        return t;
+    }
+    
+    // Whether `v` occurs in `t`; also lowers the level of each `var`
+    // in `t` to that of `v`, which `t` is about to be bound to
+    bool occurs(PTR(Type) v, PTR(Type) t) {
+        t = resolve(t);
+        if (t == v)
+            return true;
+        if (t->kind == Type::var) {
+            if (t->level > v->level)
+                t->level = v->level;
+            return false;
+        }
+        if (t->kind == Type::fun)
+            return occurs(v, t->arg) || occurs(v, t->result);
+        return false;
+    }
+    
+    void unify(PTR(Type) expected, PTR(Type) actual) {
+        PTR(Type) a = resolve(expected);
+        PTR(Type) b = resolve(actual);
+        if (a == b)
+            return;
+        if (a->kind == Type::var || b->kind == Type::var) {
+            PTR(Type) v = (a->kind == Type::var) ? a : b;
+            PTR(Type) t = (a->kind == Type::var) ? b : a;
+            if (occurs(v, t))
+                throw std::runtime_error("type error: " + show(t) + " would have to contain itself");
+            v->link = t;
+            return;
+        }
+        if (a->kind == Type::fun && b->kind == Type::fun) {
+            unify(a->arg, b->arg);
+            unify(a->result, b->result);
+            return;
+        }
+        if (a->kind != b->kind)
+            throw std::runtime_error("type error: expected " + show(a) + " but got " + show(b));
+    }
+    
+    // Unifies as part of checking `e`, which is blamed for a mismatch
+    void unify_at(PTR(Expr) e, PTR(Type) expected, PTR(Type) actual) {
+        try {
+            unify(expected, actual);
+        } catch (std::runtime_error &) {
+            SourceMap::blame(e);
+        }
+    }
+    
+    // Makes the `var`s in `t` made since this `_let` started generic
+    void generalize(PTR(Type) t) {
+        t = resolve(t);
+        if (t->kind == Type::var && t->level > level)
+            t->level = generic;
+        else if (t->kind == Type::fun) {
+            generalize(t->arg);
+            generalize(t->result);
+        }
+    }
+    
+    // A copy of `t` with fresh `var`s for its generic ones
+    PTR(Type) instantiate(PTR(Type) t, std::map<Type*, PTR(Type)> &copies) {
+        t = resolve(t);
+        if (t->kind == Type::var && t->level == generic) {
+            PTR(Type) &copy = copies[&*t];
+            if (copy == nullptr)
+                copy = fresh();
+            return copy;
+        }
+        if (t->kind == Type::fun)
+            return fun_type(instantiate(t->arg, copies), instantiate(t->result, copies));
+        return t;
+    }
+    
+    PTR(Type) infer(PTR(Expr) e) {
+        nodes.push_back(e);
+        
+        if (CAST(NumExpr)(e) != nullptr)
+            return NEW(Type)(Type::num, 0);
+        if (CAST(BoolExpr)(e) != nullptr)
+            return NEW(Type)(Type::boolean, 0);
+        
+        PTR(VarExpr) var = CAST(VarExpr)(e);
+        if (var != nullptr) {
+            for (size_t i = scope.size(); i-- > 0; ) {
+                if (scope[i].first == var->name) {
+                    std::map<Type*, PTR(Type)> copies;
+                    return instantiate(scope[i].second, copies);
+                }
+            }
+            throw ScriptError("free variable: " + var->name, e);
+        }
+        
+        PTR(AddExpr) add = CAST(AddExpr)(e);
+        PTR(MultExpr) mult = CAST(MultExpr)(e);
+        if (add != nullptr || mult != nullptr) {
+            PTR(Type) lhs = infer(add != nullptr ? add->lhs : mult->lhs);
+            PTR(Type) rhs = infer(add != nullptr ? add->rhs : mult->rhs);
+            PTR(Type) number = NEW(Type)(Type::num, 0);
+            unify_at(e, number, lhs);
+            unify_at(e, number, rhs);
+            return number;
+        }
+        
+        PTR(EqualExpr) equal = CAST(EqualExpr)(e);
+        if (equal != nullptr) {
+            infer(equal->lhs);
+            infer(equal->rhs);
+            return NEW(Type)(Type::boolean, 0);
+        }
+        
+        PTR(IfExpr) if_expr = CAST(IfExpr)(e);
+        if (if_expr != nullptr) {
+            unify_at(e, NEW(Type)(Type::boolean, 0), infer(if_expr->if_part));
+            PTR(Type) then_type = infer(if_expr->then_part);
+            unify_at(e, then_type, infer(if_expr->else_part));
+            return then_type;
+        }
+        
+        PTR(LetExpr) let = CAST(LetExpr)(e);
+        if (let != nullptr) {
+            level++;
+            PTR(Type) rhs = infer(let->rhs);
+            level--;
+            generalize(rhs);
+            scope.push_back(std::make_pair(let->name, rhs));
+            PTR(Type) body = infer(let->expr);
+            scope.pop_back();
+            return body;
+        }
+        
+        PTR(FunExpr) fun = CAST(FunExpr)(e);
+        if (fun != nullptr) {
+            PTR(Type) arg = fresh();
+            scope.push_back(std::make_pair(fun->formal_arg, arg));
+            PTR(Type) body = infer(fun->body);
+            scope.pop_back();
+            return fun_type(arg, body);
+        }
+        
+        PTR(CallFunExpr) call = CAST(CallFunExpr)(e);
+        PTR(Type) to_be_called = infer(call->to_be_called);
+        PTR(Type) actual_arg = infer(call->actual_arg);
+        PTR(Type) result = fresh();
+        PTR(Type) callee = resolve(to_be_called);
+        if (callee->kind == Type::num || callee->kind == Type::boolean)
+            throw ScriptError("type error: expected a function but got " + show(callee), e);
+        // The function is what is known, the argument what is checked
+        unify_at(e, to_be_called, fun_type(actual_arg, result));
+        return result;
+    }
+};
+
+std::string TypeCheck::infer(PTR(Expr) e) {
+    Inference inference;
+    return show(inference.infer(e));
+}
+
+static bool mark_if(PTR(Expr) e, bool plain) {
+    Inference inference;
+    PTR(Type) type;
+    try {
+        type = resolve(inference.infer(e));
+    } catch (std::runtime_error &) {
+        return false;
+    }
+    if (plain && type->kind != Type::num && type->kind != Type::boolean)
+        return false;
+    for (PTR(Expr) node : inference.nodes)
+        node->well_typed = true;
+    return true;
+}
+
+bool TypeCheck::mark(PTR(Expr) e) {
+    return mark_if(e, false);
+}
+
+bool TypeCheck::mark_plain(PTR(Expr) e) {
+    return mark_if(e, true);
+}
+
+/* for tests */
+static PTR(Expr) parse_str(std::string s) {
+    std::istringstream in(s);
+    return parse(in);
+}
+
+TEST_CASE( "type inference" ) {
+    CHECK( TypeCheck::infer(parse_str("1 + 2 * 3")) == "num" );
+    CHECK( TypeCheck::infer(parse_str("_if 1 == 2 _then _false _else _true")) == "bool" );
+    CHECK( TypeCheck::infer(parse_str("_fun(x) x + 1")) == "num -> num" );
+    CHECK( TypeCheck::infer(parse_str("_fun(f) _fun(x) f(f(x))")) == "(a -> a) -> a -> a" );
+    // `==` takes any two values
+    CHECK( TypeCheck::infer(parse_str("_fun(x) _fun(y) x == y")) == "a -> b -> bool" );
+    // A `_let`-bound function can be used at several types...
+    CHECK( TypeCheck::infer(parse_str("_let id = _fun(x) x _in _if id(_true) _then id(1) _else 2")) == "num" );
+    // ... but a parameter cannot
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("_fun(id) _if id(_true) _then id(1) _else 2")),
+                      "type error: expected bool but got num" );
+    
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("1 + _true")), "type error: expected num but got bool" );
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("_if 1 _then 2 _else 3")), "type error: expected bool but got num" );
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("_if _true _then 2 _else _false")),
+                      "type error: expected num but got bool" );
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("1(2)")), "type error: expected a function but got num" );
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("x + 1")), "free variable: x" );
+    // Recursion by self-application has no type
+    CHECK_THROWS_WITH( TypeCheck::infer(parse_str("_fun(f) f(f)")), "type error: a -> b would have to contain itself" );
+    
+    // Only a program with a type is marked, and then all of it
+    PTR(AddExpr) typed = CAST(AddExpr)(parse_str("(_fun(x) x * 2)(3) + 1"));
+    CHECK( TypeCheck::mark(typed) );
+    CHECK( typed->well_typed );
+    CHECK( CAST(CallFunExpr)(typed->lhs)->to_be_called->well_typed );
+    PTR(AddExpr) untyped = CAST(AddExpr)(parse_str("(_fun(x) x * 2)(3) + _true"));
+    CHECK( !TypeCheck::mark(untyped) );
+    CHECK( !untyped->lhs->well_typed );
+    
+    // A marked program evaluates to the same value by either evaluator
+    PTR(Expr) program = parse_str("_let twice = _fun(f) _fun(x) f(f(x))"
+                                  "_in _let inc = _fun(n) n + 1"
+                                  "_in _if twice(inc)(1) == 3 _then twice(_fun(n) n * n)(3) _else 0");
+    CHECK( TypeCheck::mark(program) );
+    CHECK( program->to_value(Env::emptyenv)->to_string() == "81" );
+    CHECK( Step::interp_by_steps(program)->to_string() == "81" );
+}
@@ -0,0 +1,43 @@
+//
+//  types.hpp
+//
+//
+//  Created by Yuhui on 10/19/26.
+//  Copyright © 2026 Yuhui. All rights reserved.
+//
+
+#ifndef types_hpp
+#define types_hpp
+
+#include <stdio.h>
+#include <string>
+#include "pointer.hpp"
+
+class Expr;
+
+/* Hindley-Milner type inference. A program has a type when every
+ `+` and `*` gets numbers, every `_if` gets a boolean test and two
+ branches of one type, and every call gets a function that takes
+ the argument's type; a function bound by `_let` can be used at
+ several types, and `==` compares any two values. A program with
+ a free variable has no type, and neither does self-application,
+ the usual way to write recursion, so a program without a type is
+ still run, only with every check in place. */
+class TypeCheck {
+public:
+    // The type of `e`, as in `(num -> bool) -> num`; throws a
+    // `ScriptError` (see source.hpp) at the node where types first
+    // disagree
+    static std::string infer(PTR(Expr) e);
+    
+    // Sets `Expr::well_typed` on every node of `e` if `e` has a
+    // type; returns whether it has
+    static bool mark(PTR(Expr) e);
+    
+    // Like `mark`, but only if `e`'s type is `num` or `bool`, so
+    // that no closure made in `e` can outlive it and be called by
+    // code that was never checked
+    static bool mark_plain(PTR(Expr) e);
+};
+
+#endif /* types_hpp */
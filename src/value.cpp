@@ -7,26 +7,53 @@
 //
 
 #include "expr.hpp"
+#include <climits>
+#include <sstream>
 #include <stdexcept>
 #include "catch.hpp"
 #include "Env.hpp"
 #include "value.hpp"
 #include "step.hpp"
 #include "parse.hpp"
+#include "cont.hpp"
+#include "memo.hpp"
+#include "budget.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "types.hpp"
+#include "jit.hpp"
+#include "parallel.hpp"
 
 /**
  Num part
  */
-NumVal::NumVal(int rep) {
+NumVal::NumVal(long long rep) {
   this->rep = rep;
+  this->big = nullptr;
+  COUNT_ALLOC(NumVal);
+}
+
+NumVal::NumVal(const BigNum &n) {
+  if (n.fits()) {
+    this->rep = n.to_long();
+    this->big = nullptr;
+  } else {
+    this->rep = 0;
+    this->big = NEW(BigNum)(n);
+  }
+  COUNT_ALLOC(NumVal);
 }
 
 bool NumVal::equals(PTR(Val) other_val) {
     PTR(NumVal) other_num_val = CAST(NumVal)(other_val);
     if (other_num_val == nullptr)
         return false;
+    // A number is only `big` when it does not fit, so a `big` one
+    // never equals one that is not
+    else if (big == nullptr || other_num_val->big == nullptr)
+        return big == other_num_val->big && rep == other_num_val->rep;
     else
-        return rep == other_num_val->rep;
+        return big->equals(*other_num_val->big);
 }
 
 PTR(Val) NumVal::add_to(PTR(Val) other_val) {
@@ -34,7 +61,7 @@ PTR(Val) NumVal::add_to(PTR(Val) other_val) {
     if (other_num_val == nullptr)
         throw std::runtime_error("input is not a number");
     else
-        return NEW(NumVal)(rep + other_num_val->rep);
+        return add(STATIC_CAST(NumVal)(THIS), other_num_val);
 }
 
 PTR(Val) NumVal::mult_with(PTR(Val) other_val) {
@@ -42,14 +69,30 @@ PTR(Val) NumVal::mult_with(PTR(Val) other_val) {
     if (other_num_val == nullptr)
         throw std::runtime_error("input is not a number");
     else
-        return NEW(NumVal)(rep * other_num_val->rep);
+        return mult(STATIC_CAST(NumVal)(THIS), other_num_val);
+}
+
+PTR(Val) NumVal::add_big(PTR(NumVal) a, PTR(NumVal) b) {
+    return NEW(NumVal)(a->to_big().add(b->to_big()));
+}
+
+PTR(Val) NumVal::mult_big(PTR(NumVal) a, PTR(NumVal) b) {
+    return NEW(NumVal)(a->to_big().mult(b->to_big()));
+}
+
+BigNum NumVal::to_big() {
+    return (big != nullptr) ? *big : BigNum(rep);
 }
 
 PTR(Expr) NumVal::to_expr() {
+    if (big != nullptr)
+        return NEW(NumExpr)(*big);
     return NEW(NumExpr)(rep);
 }
 
 std::string NumVal::to_string() {
+  if (big != nullptr)
+    return big->to_string();
   return std::to_string(rep);
 }
 
@@ -67,6 +110,7 @@ void NumVal::call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) {
  */
 BoolVal::BoolVal(bool rep) {
   this->rep = rep;
+  COUNT_ALLOC(BoolVal);
 }
 
 bool BoolVal::equals(PTR(Val) other_val) {
@@ -113,6 +157,16 @@ FunVal::FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env) {
     this->formal_arg = formal_arg;
     this->body = body;
     this->env = env;
+    this->label = "_fun";
+    COUNT_ALLOC(FunVal);
+}
+
+FunVal::FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env, std::string label) {
+    this->formal_arg = formal_arg;
+    this->body = body;
+    this->env = env;
+    this->label = label;
+    COUNT_ALLOC(FunVal);
 }
 
 
@@ -133,7 +187,7 @@ PTR(Val) FunVal::mult_with(PTR(Val) other_val) {
 }
 
 PTR(Expr) FunVal::to_expr() {
-    return NEW(FunExpr)(formal_arg, body);
+    return NEW(FunExpr)(formal_arg, body, label);
 }
 
 std::string FunVal::to_string() {
@@ -141,10 +195,49 @@ std::string FunVal::to_string() {
 }
 
 PTR(Val) FunVal::call(PTR(Val) actual_arg) {
+    if (Budget::active)
+        Budget::charge();
+    if (Parallel::enabled)
+        Parallel::poll();
+    if (Profiler::mode != Profiler::off) {
+        ProfileFrame frame(label);
+        return call_body(actual_arg);
+    }
+    return call_body(actual_arg);
+}
+
+PTR(Val) FunVal::call_body(PTR(Val) actual_arg) {
+    if (Jit::enabled) {
+        PTR(Val) result = Jit::call(STATIC_CAST(FunVal)(THIS), actual_arg);
+        if (result != nullptr)
+            return result;
+    }
+    if (CallMemo::enabled && CallMemo::memoizable(actual_arg)) {
+        PTR(Val) result = CallMemo::lookup(body, env, actual_arg);
+        if (result == nullptr) {
+            result = body->to_value(NEW(ExtendedEnv)(formal_arg, actual_arg, env));
+            CallMemo::store(body, env, actual_arg, result);
+        }
+        return result;
+    }
     return body->to_value(NEW(ExtendedEnv)(formal_arg, actual_arg, env));
 }
 
 void FunVal::call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) {
+    if (Profiler::mode != Profiler::off) {
+        Profiler::enter(label);
+        rest = NEW(ProfileLeaveCont)(rest);
+    }
+    if (CallMemo::enabled && CallMemo::memoizable(actual_arg_val)) {
+        PTR(Val) result = CallMemo::lookup(body, env, actual_arg_val);
+        if (result != nullptr) {
+            Step::mode = Step::continue_mode;
+            Step::val = result;
+            Step::cont = rest;
+            return;
+        }
+        rest = NEW(MemoCont)(body, env, actual_arg_val, rest);
+    }
     Step::mode = Step::interp_mode;
     Step::expr = body;
     Step::env = NEW(ExtendedEnv)(formal_arg, actual_arg_val, env);
@@ -206,3 +299,42 @@ TEST_CASE( "value to_string" ) {
     CHECK( (NEW(FunVal)("x", NEW(MultExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x")), Env::emptyenv))
           ->to_string() == "[FUNCTION]" );
 }
+
+/* for tests */
+static std::string run_str(std::string s, bool steps) {
+    std::istringstream in(s);
+    PTR(Expr) e = parse(in);
+    TypeCheck::mark(e);
+    return (steps ? Step::interp_by_steps(e) : e->to_value(Env::emptyenv))->to_string();
+}
+
+TEST_CASE( "numbers past 64 bits" ) {
+    PTR(NumVal) max = NEW(NumVal)(LLONG_MAX);
+    PTR(Val) over = max->add_to(NEW(NumVal)(1));
+    CHECK( over->to_string() == "9223372036854775808" );
+    CHECK( CAST(NumVal)(over)->big != nullptr );
+    // ... and back to a `long long` when the result fits again
+    PTR(Val) back = over->add_to(NEW(NumVal)(-1));
+    CHECK( back->equals(max) );
+    CHECK( CAST(NumVal)(back)->big == nullptr );
+    CHECK( !over->equals(max) );
+    CHECK( over->equals(NEW(NumVal)(BigNum::from_string("9223372036854775808"))) );
+    CHECK( (NEW(NumVal)(LLONG_MIN))->mult_with(NEW(NumVal)(-1))->to_string() == "9223372036854775808" );
+    CHECK( over->to_expr()->to_string() == "9223372036854775808" );
+    
+    // Both evaluators, with and without type checks skipped
+    const char *programs[] = {
+        "_let pow = _fun(f) _fun(n) _if n == 0 _then 1 _else 2 * f(f)(n + -1) _in pow(pow)(100)",
+        "(_fun(x) x * x * x)(4294967296) + -1",
+        "99999999999999999999 + 1 == 100000000000000000000"
+    };
+    const char *expected[] = {
+        "1267650600228229401496703205376",
+        "79228162514264337593543950335",
+        "_true"
+    };
+    for (int i = 0; i < 3; i++) {
+        CHECK( run_str(programs[i], false) == expected[i] );
+        CHECK( run_str(programs[i], true) == expected[i] );
+    }
+}
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <string>
 #include "pointer.hpp"
+#include "arena.hpp"
+#include "bignum.hpp"
 #ifndef value_hpp
 #define value_hpp
 
@@ -20,6 +22,8 @@ class Cont;
 
 class Val ENABLE_THIS(Val){
 public:
+    ARENA_ALLOCATED
+    
     virtual bool equals(PTR(Val) val) = 0;
     virtual PTR(Val) add_to(PTR(Val) other_val) = 0;
     virtual PTR(Val) mult_with(PTR(Val) other_val) = 0;
@@ -31,10 +35,20 @@ public:
 
 class NumVal : public Val {
 public:
-    int rep;
-    NumVal(int rep);
+    // The number, unless it does not fit; then it is `big` instead
+    // (which is otherwise `nullptr`)
+    long long rep;
+    PTR(BigNum) big;
+    NumVal(long long rep);
+    NumVal(const BigNum &n);
     bool equals(PTR(Val) val);
     
+    // `a + b` and `a * b`: `long long` arithmetic unless that would
+    // overflow, when the result is made as a `BigNum`
+    static PTR(Val) add(PTR(NumVal) a, PTR(NumVal) b);
+    static PTR(Val) mult(PTR(NumVal) a, PTR(NumVal) b);
+    BigNum to_big();
+    
     PTR(Val) add_to(PTR(Val) other_val);
     PTR(Val) mult_with(PTR(Val) other_val);
     PTR(Expr) to_expr();
@@ -42,8 +56,26 @@ public:
     
     PTR(Val) call(PTR(Val) actual_arg);
     void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest);
+    
+private:
+    static PTR(Val) add_big(PTR(NumVal) a, PTR(NumVal) b);
+    static PTR(Val) mult_big(PTR(NumVal) a, PTR(NumVal) b);
 };
 
+inline PTR(Val) NumVal::add(PTR(NumVal) a, PTR(NumVal) b) {
+    long long sum;
+    if (a->big == nullptr && b->big == nullptr && !__builtin_add_overflow(a->rep, b->rep, &sum))
+        return NEW(NumVal)(sum);
+    return add_big(a, b);
+}
+
+inline PTR(Val) NumVal::mult(PTR(NumVal) a, PTR(NumVal) b) {
+    long long product;
+    if (a->big == nullptr && b->big == nullptr && !__builtin_mul_overflow(a->rep, b->rep, &product))
+        return NEW(NumVal)(product);
+    return mult_big(a, b);
+}
+
 class BoolVal : public Val {
 public:
     bool rep;
@@ -64,8 +96,10 @@ public:
     std::string formal_arg;
     PTR(Expr) body;
     PTR(Env) env;
+    std::string label;
     
     FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env);
+    FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env, std::string label);
     bool equals(PTR(Val) val);
     
     PTR(Val) add_to(PTR(Val) other_val);
@@ -74,6 +108,7 @@ public:
     std::string to_string();
     
     PTR(Val) call(PTR(Val) actual_arg);
+    PTR(Val) call_body(PTR(Val) actual_arg);
     void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest);
 };
 